@@ -2,10 +2,23 @@
 #define HJSON_AFOWENFOWANEFWOAFNLL
 
 #include <cstdint>
+#include <cstddef>
+#include <chrono>
 #include <string>
 #include <memory>
 #include <map>
+#include <vector>
+#include <iterator>
 #include <stdexcept>
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+# include <string_view>
+# include <optional>
+# if defined(__has_include)
+#  if __has_include(<memory_resource>)
+#   include <memory_resource>
+#  endif
+# endif
+#endif
 
 #define HJSON_OP_DECL_VAL(_T, _O) \
 friend Value operator _O(_T, const Value&); \
@@ -66,7 +79,17 @@ class file_error : public std::runtime_error {
 };
 
 
-enum class Type {
+class limit_error : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+
+class frozen_error : public std::logic_error {
+  using std::logic_error::logic_error;
+};
+
+
+enum class Type : unsigned char {
   Undefined,
   Null,
   Bool,
@@ -78,6 +101,9 @@ enum class Type {
 };
 
 
+class MemoryResource;
+
+
 // DecoderOptions defines options for decoding from Hjson.
 struct DecoderOptions {
   // Keep all comments from the Hjson input, store them in
@@ -90,6 +116,29 @@ struct DecoderOptions {
   // If true, an Hjson::syntax_error exception is thrown from the unmarshal
   // functions if a map contains duplicate keys.
   bool duplicateKeyException = false;
+  // If true, equal strings in the returned tree share the same memory, as if
+  // Value::dedupe() had been called on it. Ignored by IncrementalDecoder.
+  bool dedupe = false;
+  // If not null, the returned tree is allocated from this resource, as if
+  // the decoding was done inside a Hjson::MemoryResourceScope.
+  MemoryResource *memoryResource = nullptr;
+  // The following limits are useful when decoding untrusted input. An
+  // Hjson::limit_error exception is thrown from the unmarshal functions if a
+  // limit is exceeded. The value 0 means no limit.
+  //
+  // Maximum nesting depth of vectors and maps. The root container is at
+  // depth 1.
+  size_t maxDepth = 0;
+  // Maximum total number of values, including vectors and maps.
+  size_t maxNodes = 0;
+  // Maximum total number of bytes in all keys and string values.
+  size_t maxStringBytes = 0;
+  // Maximum number of bytes in a single key or string value.
+  size_t maxStringLength = 0;
+  // Maximum time that the decoding is allowed to take. The clock is checked
+  // periodically, so the decoding can take slightly longer than this.
+  std::chrono::steady_clock::duration maxDuration =
+    std::chrono::steady_clock::duration::zero();
 };
 
 
@@ -124,22 +173,171 @@ struct EncoderOptions {
 };
 
 
+// Diagnostic describes a syntax error found by Hjson::Lint().
+struct Diagnostic {
+  // Zero-based byte offset of the error in the input data.
+  size_t offset;
+  // One-based line and column of the error. The column is counted in bytes.
+  size_t line, column;
+  std::string message;
+};
+
+
 class MapProxy;
+class Value;
+class ConstValueRef;
+
+
+// A view of a contiguous array, like std::span in C++20. Returned by
+// Value::double_span() and Value::int64_span().
+template<class T>
+class Span {
+public:
+  Span() : pData(0), nSize(0) {}
+  Span(T *data, size_t size) : pData(data), nSize(size) {}
+
+  T *data() const { return pData; }
+  size_t size() const { return nSize; }
+  bool empty() const { return nSize == 0; }
+  T *begin() const { return pData; }
+  T *end() const { return pData + nSize; }
+  T& operator[](size_t index) const { return pData[index]; }
+
+private:
+  T *pData;
+  size_t nSize;
+};
+
+
+// The memory used by a tree, in bytes, as returned by Value::memory_usage().
+struct MemoryUsage {
+  // Number of nodes (one per Value that is not stored in a packed Vector).
+  size_t nodeCount = 0;
+  // The nodes themselves. Bools, numbers and strings of up to 23 bytes are
+  // stored inside the node.
+  size_t nodeBytes = 0;
+  // Longer strings.
+  size_t stringBytes = 0;
+  // Vector element arrays, including unused capacity.
+  size_t vectorBytes = 0;
+  // The part of vectorBytes that is unused capacity.
+  size_t vectorSlackBytes = 0;
+  // Map hash tables, insertion and sorted order lists and element storage.
+  size_t mapBytes = 0;
+  // Map keys that do not fit inside std::string.
+  size_t keyBytes = 0;
+  // Comments, including the comment strings.
+  size_t commentBytes = 0;
+
+  size_t total() const {
+    return nodeBytes + stringBytes + vectorBytes + mapBytes + keyBytes +
+      commentBytes;
+  }
+};
+
+
+// Iterator for the elements of a Value of type Map. Walks an array of pointers
+// to the elements, so that no key lookups are needed.
+template<class T>
+class MapIterator {
+  template<class> friend class MapIterator;
+
+public:
+  typedef std::bidirectional_iterator_tag iterator_category;
+  typedef T value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef T* pointer;
+  typedef T& reference;
+
+  MapIterator() : pos(0) {}
+  explicit MapIterator(T *const *_pos) : pos(_pos) {}
+  // Allows conversion from iterator to const_iterator.
+  template<class U>
+  MapIterator(const MapIterator<U>& other) : pos(other.pos) {}
+
+  T& operator*() const { return **pos; }
+  T* operator->() const { return *pos; }
+  MapIterator& operator++() {
+    ++pos;
+    return *this;
+  }
+  MapIterator operator++(int) {
+    MapIterator ret = *this;
+    ++*this;
+    return ret;
+  }
+  MapIterator& operator--() {
+    --pos;
+    return *this;
+  }
+  MapIterator operator--(int) {
+    MapIterator ret = *this;
+    --*this;
+    return ret;
+  }
+  bool operator==(const MapIterator& other) const { return pos == other.pos; }
+  bool operator!=(const MapIterator& other) const { return pos != other.pos; }
+
+private:
+  T *const *pos;
+};
+
+
+// A map key together with its precomputed hash. Looking up a HashedKey with
+// Value::find() or Value::contains() skips hashing the key, which is useful
+// for keys that are looked up many times.
+class HashedKey {
+public:
+  HashedKey(const std::string&);
+  HashedKey(const char*);
+
+  const std::string& str() const;
+  size_t hash() const;
+
+private:
+  std::string key;
+  size_t h;
+};
 
 
 class Value {
   friend class MapProxy;
+  friend class ConstValueRef;
+  friend class Overlay;
+  friend class Reclaimer;
+  friend void MergeInto(Value&, const Value&);
+  friend void MergeInto(Value&, Value&&);
+  friend Value MergeLayers(const Value*, size_t);
 
 private:
   class ValueImpl;
   class Comments;
 
-  std::shared_ptr<ValueImpl> prv;
-  std::shared_ptr<Comments> cm;
-
-  Value(std::shared_ptr<ValueImpl>, std::shared_ptr<Comments>);
+  // Points to a reference counted ValueImpl, or to a Comments object if the
+  // lowest bit is set. The Comments object belongs to this Value (it is only
+  // shared with a temporary MapProxy) and points to the ValueImpl. This keeps
+  // the size of a Value down to two pointers.
+  std::uintptr_t ptr;
+
+  explicit Value(ValueImpl*);
+  ValueImpl *prv() const;
+  Comments *cm() const;
+  Comments *_getComments();
+  void _setImpl(ValueImpl*);
+  void _checkMutable();
+  void _share(const Value&);
+  void _takeComments(Value&);
+  void _release();
+  static void _mergeInto(Value& target, Value& ext, bool canMove);
+  static Value _mergeLayers(const std::vector<const Value*>& layers);
 
 public:
+  // Up to version 2.6 these were std::map<std::string, Value>::iterator and
+  // const_iterator. The element type is the same, so code that only uses
+  // auto, it->first, it->second and ++it still compiles.
+  typedef MapIterator<std::pair<const std::string, Value> > iterator;
+  typedef MapIterator<const std::pair<const std::string, Value> > const_iterator;
+
   Value();
   Value(bool);
   Value(float);
@@ -157,6 +355,9 @@ public:
   Value(unsigned long long);
   Value(const char*);
   Value(const std::string&);
+  // Takes over the string buffer, if the string is too long to be stored
+  // inside the Value.
+  Value(std::string&&);
   Value(Type);
   Value(const Value&);
   Value(Value&&);
@@ -247,7 +448,46 @@ public:
   // ignored in the comparison.
   bool deep_equal(const Value&) const;
   // Returns a full clone of the tree for which this Value is the root.
+  // Frozen subtrees (see freeze()) are not copied but shared with the clone.
+  // A shared element is copied when it is accessed for writing through its
+  // parent in the clone (using at() or a bracket operator), so only the path
+  // to a change is copied. Elements reached through non-const iterators are
+  // not copied and stay frozen. Cloning a frozen tree is therefore cheap.
   Value clone() const;
+  // Makes the entire tree for which this Value is the root immutable, so that
+  // it can be read from many threads at the same time without any locks.
+  // Vectors, maps and values that are shared with other trees are also
+  // frozen. Afterwards, functions that would change a Value in the tree throw
+  // Hjson::frozen_error. That includes the non-const functions that return a
+  // reference or an iterator to child elements of a Vector or Map, so use a
+  // const Value or Hjson::ConstValueRef for reading. The non-const bracket
+  // operator for a Map key can still be used for reading, but assigning to it
+  // throws. A frozen tree cannot be unfrozen, but clone() returns a mutable
+  // copy.
+  void freeze();
+  // Returns true if this Value has been frozen by a call to freeze().
+  bool is_frozen() const;
+  // Makes equal String values in the tree for which this Value is the root
+  // share the same memory. A shared String is frozen, so that changing it
+  // through one Value cannot change the others. It is copied when it is
+  // accessed for writing through its parent (see clone()), so use const
+  // access to keep the memory savings. A String that some Value outside of
+  // the tree refers to is left as it is. If "subtrees" is true, equal frozen
+  // subtrees and values of any type are also shared, including their
+  // comments. Must not be called while the tree is read from other threads.
+  void dedupe(bool subtrees = false);
+  // Walks the tree and returns the memory that it uses. Nodes that are
+  // shared within the tree (see clone() and dedupe()) are counted once.
+  // Memory that the allocator adds to each block is not included.
+  MemoryUsage memory_usage() const;
+  // Replaces the tree for which this Value is the root with a copy that is
+  // stored in one block of memory, where each Vector and Map is followed by
+  // its children, and no Vector or String has unused capacity. Makes lookups
+  // and traversals faster, so call it when a tree has been loaded and will
+  // mostly be read, for example before freeze(). Frozen state and comments
+  // are kept. Other Value objects that refer to nodes in the tree keep the
+  // old nodes. Memory that the tree grows into later is allocated as usual.
+  void compact();
 
   // -- Vector and Map specific functions
   // Removes all child elements from this Value if it is of type Vector or Map.
@@ -272,12 +512,45 @@ public:
   // Returns the number of child elements contained in this Value if this Value
   // is of type Vector or Map. Returns 0 if this Value is of any other type.
   size_t size() const;
+  // Allocates room for at least the specified number of child elements in
+  // this Vector or Map, so that adding up to that many elements does not
+  // cause any reallocation. Throws Hjson::type_mismatch if this Value is of
+  // any other type than Vector or Map.
+  void reserve(size_t);
 
   // -- Vector specific function
   // Increases the size of this Vector by adding a Value at the end. Throws
   // Hjson::type_mismatch if this Value is of any other type than Vector or
   // Undefined.
+  //
+  // A Vector where all elements are of type Double, or all are of type Int64,
+  // and have no comments is stored as a packed array of numbers, taking 8
+  // bytes per element. The elements are converted to ordinary Value objects
+  // when they are accessed through a non-const function (such as the
+  // non-const bracket operator), or when an element of another type is
+  // added. Elements read through the const bracket operator of a packed
+  // Vector are created on the first such access, all at once, and then use
+  // about 40 bytes per element in addition to the packed numbers, until the
+  // next push_back() or erase() frees them again (the Vector stays packed).
+  // Use double_span() or int64_span() to avoid that cost. Changing a copy of
+  // such an element only changes the copy, not the Vector. A pushed Double
+  // or Int64 Value is copied into a packed Vector, not shared.
   void push_back(const Value&);
+  void push_back(Value&&);
+  // Returns Hjson::Type::Double or Hjson::Type::Int64 if this Value is a
+  // Vector stored as a packed array of numbers of that type, otherwise
+  // returns Hjson::Type::Undefined.
+  Type packed_type() const;
+  // Direct access to the numbers in a packed Vector. Returns an empty Span if
+  // packed_type() is not Double or Int64, respectively. The Span is
+  // invalidated by any change to the Vector.
+  Span<const double> double_span() const;
+  Span<const std::int64_t> int64_span() const;
+  // Same as push_back(), but the element is constructed from the arguments.
+  template<class... Args>
+  void emplace_back(Args&&... args) {
+    push_back(Value(std::forward<Args>(args)...));
+  }
 
   // -- Map specific functions
   // Get key by its zero-based insertion index. Throws
@@ -293,18 +566,77 @@ public:
   Value& at(const std::string& key);
   const Value& at(const char *key) const;
   Value& at(const char *key);
-  // Iterations are always done in alphabetical key order. Returns a default
-  // constructed iterator if this Value is of any other type than Map.
-  std::map<std::string, Value>::iterator begin();
-  std::map<std::string, Value>::iterator end();
-  std::map<std::string, Value>::const_iterator begin() const;
-  std::map<std::string, Value>::const_iterator end() const;
+  // Returns a pointer to the Value specified by the key parameter, or null if
+  // this Value does not contain the key or is of type Undefined. Throws
+  // Hjson::type_mismatch if this Value is of any other type than Undefined or
+  // Map. Only reads the hash table of the map, so it never allocates any
+  // memory. The pointer is valid until the element is erased from the map.
+  const Value* find(const char *key, size_t keySize) const;
+  const Value* find(const char *key) const;
+  const Value* find(const std::string& key) const;
+  const Value* find(const HashedKey& key) const;
+  // Returns true if find() would return a non-null pointer.
+  bool contains(const char *key, size_t keySize) const;
+  bool contains(const char *key) const;
+  bool contains(const std::string& key) const;
+  bool contains(const HashedKey& key) const;
+#ifdef __cpp_lib_string_view
+  const Value* find(std::string_view key) const {
+    return find(key.data(), key.size());
+  }
+  bool contains(std::string_view key) const {
+    return contains(key.data(), key.size());
+  }
+#endif
+  // Returns a pointer to the Value at the path, or null if there is no Value
+  // at the path. The path is a JSON Pointer (RFC 6901), where each key or
+  // Vector index is preceded by "/", and "~0" and "~1" in a key stand for
+  // "~" and "/". The empty path refers to this Value. Example:
+  // "/server/ports/0". Throws no Hjson exceptions. Allocates no memory,
+  // except for a key containing "~" that is longer than the small string
+  // buffer of std::string, and for an index into a packed Vector (see
+  // push_back()). Then the Value objects for the elements of that Vector are
+  // created on the first such access, the same as for the const bracket
+  // operator. The pointer is valid until the Vector or Map that contains the
+  // Value is changed.
+  const Value* find_path(const char *path, size_t pathSize) const;
+  const Value* find_path(const char *path) const;
+  const Value* find_path(const std::string& path) const;
+#ifdef __cpp_lib_string_view
+  const Value* find_path(std::string_view path) const {
+    return find_path(path.data(), path.size());
+  }
+#endif
+  // Iterations are always done in alphabetical key order. The alphabetical
+  // order is created on demand, the first time it is needed after the Map has
+  // been changed. Returns a default constructed iterator if this Value is of
+  // any other type than Map. The iterators are invalidated when elements are
+  // added to or erased from the Map.
+  iterator begin();
+  iterator end();
+  const_iterator begin() const;
+  const_iterator end() const;
+  // Iterations in insertion order, which is the fastest way to visit all
+  // elements of a Map. Returns a default constructed iterator if this Value is
+  // of any other type than Map. The iterators are invalidated when elements
+  // are added to, erased from or moved in the Map.
+  iterator insertion_begin();
+  iterator insertion_end();
+  const_iterator insertion_begin() const;
+  const_iterator insertion_end() const;
   // Removes the child element specified by the input key if this Value is of
   // type Map. Returns the number of erased elements (0 or 1). Throws
   // Hjson::type_mismatch if this Value is of any other type than Map or
   // Undefined.
   size_t erase(const std::string&);
   size_t erase(const char*);
+  // Sets the element at the key, inserting it if the key does not exist. The
+  // key and the Value are moved into the Map, no MapProxy is created. Returns
+  // true if the key was inserted, false if an existing element was replaced
+  // (in that case, the comments of the existing element are kept, like in an
+  // assignment). Throws Hjson::type_mismatch if this Value is of any other
+  // type than Map or Undefined.
+  bool insert_or_assign(std::string key, Value val);
 
   // These functions throw an error if used on Vector or Map, but will return
   // 0 or 0.0 for the types Undefined and Null. Will parse strings to numbers
@@ -313,6 +645,33 @@ public:
   std::int64_t to_int64() const;
   std::string to_string() const;
 
+  // Non-throwing versions of the conversion operators. Sets the output
+  // parameter and returns true if this Value can be converted: Double or
+  // Int64 to a number, Bool to bool and String to a string. Otherwise
+  // returns false and leaves the output parameter unchanged. Strings are not
+  // parsed to numbers. The pointer from the "const char**" version is valid
+  // until the String is changed or destroyed.
+  bool try_get(bool*) const;
+  bool try_get(double*) const;
+  bool try_get(std::int64_t*) const;
+  bool try_get(std::string*) const;
+  bool try_get(const char**) const;
+#ifdef __cpp_lib_optional
+  template<class T>
+  std::optional<T> try_get() const {
+    T ret;
+    if (try_get(&ret)) {
+      return ret;
+    }
+    return std::nullopt;
+  }
+#endif
+  // Returns a pointer to the value stored in this Value if it is of the type
+  // that corresponds to T (bool, double or std::int64_t), otherwise null. No
+  // conversion is made, so get_if<double>() returns null for an Int64.
+  template<class T>
+  const T* get_if() const;
+
   // Sets comment shown before this Value. If this Value is an element in a
   // Map, the comment is shown before the key.
   void set_comment_before(const std::string&);
@@ -343,6 +702,11 @@ public:
 };
 
 
+template<> const bool* Value::get_if<bool>() const;
+template<> const double* Value::get_if<double>() const;
+template<> const std::int64_t* Value::get_if<std::int64_t>() const;
+
+
 // MapProxy is only used for temporary references to elements in a Map. It is
 // not possible to store a MapProxy in a variable. It only exists to make it
 // possible to check for the existence of a specific key in a Map without
@@ -351,20 +715,20 @@ class MapProxy : public Value {
   friend class Value;
 
 private:
-  std::shared_ptr<ValueImpl> parentPrv;
+  ValueImpl *parentPrv;
   std::string key;
   Value *pTarget;
   // True if an explicit assignment has been made to this MapProxy.
   bool wasAssigned;
 
-  MapProxy(std::shared_ptr<ValueImpl> parent, const std::string& key,
-    Value *pTarget);
+  MapProxy(ValueImpl *parent, const std::string& key, Value *pTarget);
 
   // Make the copy constructor private in order to avoid accidental creation of
   // MapProxy variables like this:
   //   auto myVal = val["one"];
-  MapProxy(const MapProxy&) = default;
+  MapProxy(const MapProxy&);
   MapProxy(Value&&);
+  void _checkParent() const;
 
 public:
   ~MapProxy() override;
@@ -377,6 +741,348 @@ public:
 };
 
 
+// Builder creates a Vector or Map that has room for exactly the specified
+// number of elements, so that no reallocation is needed while the elements
+// are added. All elements are moved into the container.
+//
+//   Hjson::Builder builder(Hjson::Type::Map, 2);
+//   builder.add("name", "first").add("count", 2);
+//   Hjson::Value val = builder.build();
+//
+class Builder {
+public:
+  // Throws Hjson::type_mismatch if "type" is not Vector or Map.
+  Builder(Type type, size_t size);
+
+  // Adds an element to a Vector.
+  Builder& add(Value val);
+  // Adds an element to a Map (or replaces the element if the key already
+  // exists).
+  Builder& add(std::string key, Value val);
+  // Returns the container. The Builder is then empty (Undefined) and can't
+  // be used any more.
+  Value build();
+
+private:
+  Value val;
+};
+
+
+// ConstValueRef is a non-owning, read-only view of a Value. It is only a
+// pointer, so creating, copying and walking a tree with it never changes any
+// reference counts. The viewed tree must outlive the ConstValueRef and must
+// not be modified while the view is in use, which is guaranteed for a tree
+// that has been frozen by Value::freeze().
+class ConstValueRef {
+public:
+  // Iterates over the child elements of a Vector, or over the elements of a
+  // Map in insertion order. Dereferencing gives a ConstValueRef to the
+  // element. Invalidated by any change to the Vector or Map.
+  class const_iterator {
+    friend class ConstValueRef;
+
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef ConstValueRef value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const ConstValueRef* pointer;
+    typedef ConstValueRef reference;
+
+    const_iterator() : pParent(0), index(0) {}
+
+    ConstValueRef operator*() const;
+    // The key of the current element. Throws Hjson::type_mismatch if the
+    // iterated Value is not a Map.
+    const std::string& key() const;
+    // The zero-based index of the current element.
+    int pos() const { return index; }
+
+    const_iterator& operator++() { ++index; return *this; }
+    const_iterator operator++(int) { const_iterator ret = *this; ++index; return ret; }
+    bool operator==(const const_iterator& other) const {
+      return index == other.index && pParent == other.pParent;
+    }
+    bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+  private:
+    const_iterator(const Value *parent, int index) : pParent(parent), index(index) {}
+
+    const Value *pParent;
+    int index;
+  };
+
+  ConstValueRef(const Value&);
+
+  // Same as the corresponding functions in Hjson::Value.
+  Type type() const;
+  bool defined() const;
+  bool empty() const;
+  bool is_container() const;
+  bool is_numeric() const;
+  size_t size() const;
+  // Returns a view of an Undefined Value if the key is not found. Throws
+  // Hjson::type_mismatch if the viewed Value is of any other type than
+  // Undefined or Map.
+  ConstValueRef operator[](const std::string& key) const;
+  ConstValueRef operator[](const char *key) const;
+  ConstValueRef operator[](const HashedKey& key) const;
+  // Same as the const bracket operator for an index in Hjson::Value.
+  ConstValueRef operator[](int index) const;
+  // Same as Value::find() and Value::contains().
+  const Value* find(const std::string& key) const;
+  const Value* find(const char *key) const;
+  const Value* find(const HashedKey& key) const;
+  bool contains(const std::string& key) const;
+  bool contains(const char *key) const;
+  bool contains(const HashedKey& key) const;
+#ifdef __cpp_lib_string_view
+  ConstValueRef operator[](std::string_view key) const;
+  const Value* find(std::string_view key) const {
+    return pVal->find(key);
+  }
+  bool contains(std::string_view key) const {
+    return pVal->contains(key);
+  }
+#endif
+  // Same as Value::key(), but without copying the key.
+  const std::string& key(int index) const;
+  // Returns a default constructed iterator if the viewed Value is of any other
+  // type than Vector or Map.
+  const_iterator begin() const;
+  const_iterator end() const;
+  explicit operator bool() const;
+  double to_double() const;
+  std::int64_t to_int64() const;
+  std::string to_string() const;
+  // Returns the characters of a String without copying them. The pointer is
+  // valid until the String is changed or destroyed. Throws
+  // Hjson::type_mismatch if the viewed Value is not a String.
+  const char* c_str() const;
+#ifdef __cpp_lib_string_view
+  std::string_view to_string_view() const;
+#endif
+  // The viewed Value, for access to all other const functions.
+  const Value& value() const;
+
+private:
+  const Value *pVal;
+};
+
+
+// Overlay is a read-only view of a list of layers, ordered from lowest to
+// highest priority, that behaves like the tree returned by MergeLayers() but
+// resolves each lookup through the layers when it is made. Nothing is copied
+// until value() is called. The layers are referenced, not cloned, so changes
+// in the layers are seen by the Overlay immediately.
+class Overlay {
+public:
+  Overlay();
+  Overlay(const Value *layers, size_t count);
+  Overlay(const std::vector<Value>& layers);
+
+  // Replaces the layer at the index, which must be less than layer_count().
+  void set_layer(size_t index, const Value&);
+  // Adds a layer with higher priority than all current layers.
+  void push_layer(const Value&);
+  size_t layer_count() const;
+
+  // The type of the merged value, which is the type of the highest priority
+  // layer that is not Undefined.
+  Type type() const;
+  bool defined() const;
+  // Returns an Overlay for the merged element at the key. Throws
+  // Hjson::type_mismatch if the merged value is of any other type than
+  // Undefined or Map.
+  Overlay operator[](const std::string& key) const;
+  Overlay operator[](const char *key) const;
+  // All keys of the merged map, in the same order as in the tree returned by
+  // MergeLayers(). Returns an empty vector if the merged value is not a Map.
+  std::vector<std::string> keys() const;
+  // Number of keys in the merged map, or number of elements if the merged
+  // value is a Vector.
+  size_t size() const;
+  // Returns the merged value. Shares the Value from the layer if only one
+  // layer contributes to it, otherwise creates it using MergeLayers().
+  Value value() const;
+  double to_double() const;
+  std::int64_t to_int64() const;
+  std::string to_string() const;
+
+private:
+  std::vector<Value> layers;
+
+  // The range of layers that contribute to the merged value.
+  void _active(size_t *pBegin, size_t *pEnd) const;
+};
+
+
+// MemoryResource is the interface for memory that Value trees can be
+// allocated from, see MemoryResourceScope. It works like
+// std::pmr::memory_resource, which is not available in C++11.
+class MemoryResource {
+public:
+  virtual ~MemoryResource() {}
+
+  virtual void *allocate(size_t bytes, size_t alignment) = 0;
+  virtual void deallocate(void *p, size_t bytes, size_t alignment) = 0;
+};
+
+
+#ifdef __cpp_lib_memory_resource
+// Makes a std::pmr::memory_resource usable as an Hjson::MemoryResource.
+class PmrMemoryResource : public MemoryResource {
+public:
+  explicit PmrMemoryResource(std::pmr::memory_resource *_res) : res(_res) {}
+
+  void *allocate(size_t bytes, size_t alignment) override {
+    return res->allocate(bytes, alignment);
+  }
+  void deallocate(void *p, size_t bytes, size_t alignment) override {
+    res->deallocate(p, bytes, alignment);
+  }
+
+private:
+  std::pmr::memory_resource *res;
+};
+#endif
+
+
+// While a MemoryResourceScope exists, the Value objects created by the same
+// thread are allocated from the resource: the nodes, their comments and the
+// memory for the elements of vectors and maps and for long strings. The
+// memory a Value grows into later comes from the resource it was created
+// with. Map keys and comment strings use the global operator new, since they
+// are exposed as std::string. A tree can be destroyed after the scope has
+// ended, but the resource must outlive the tree, and must be thread safe if
+// the tree is destroyed by another thread (for example by a Reclaimer).
+// Scopes can be nested. A null resource means the global operator new.
+class MemoryResourceScope {
+public:
+  explicit MemoryResourceScope(MemoryResource *resource);
+  ~MemoryResourceScope();
+
+  // The resource of the innermost scope of the calling thread, or null if
+  // there is none.
+  static MemoryResource *current();
+
+  MemoryResourceScope(const MemoryResourceScope&) = delete;
+  MemoryResourceScope& operator=(const MemoryResourceScope&) = delete;
+
+private:
+  MemoryResource *previous;
+};
+
+
+// Statistics for the free lists that the nodes of Value trees are allocated
+// from (unless the Cmake option HJSON_NODE_POOL is OFF). Each thread has its
+// own free lists, and a shared pool that threads move batches of free blocks
+// to and from.
+struct PoolStats {
+  // Number of nodes allocated by the calling thread.
+  std::uint64_t allocations = 0;
+  // Number of those allocations that reused a free block instead of calling
+  // the global operator new.
+  std::uint64_t hits = 0;
+  // Bytes in the free lists of the calling thread.
+  size_t localBytes = 0;
+  // Bytes in the shared pool.
+  size_t sharedBytes = 0;
+};
+
+
+// Returns the pool statistics for the calling thread.
+PoolStats GetPoolStats();
+// Returns all free blocks in the free lists of the calling thread and in the
+// shared pool to the global operator delete.
+void TrimPools();
+
+
+// Reclaimer destroys Value trees on a background thread, so that the thread
+// that drops the last reference to a large tree (for example when swapping
+// in a new config) does not have to wait while all its nodes are freed.
+//
+//   Hjson::Value old = config;
+//   config = newConfig;
+//   reclaimer.reclaim(old);
+//
+// With the Cmake option HJSON_SINGLE_THREADED, only trees that are not
+// referred to by any other Value may be handed to a Reclaimer.
+class Reclaimer {
+public:
+  class Impl;
+
+  // Starts the background thread.
+  Reclaimer();
+  // Waits until all handed over trees have been destroyed, then stops the
+  // background thread.
+  ~Reclaimer();
+
+  // Takes over the reference that "tree" holds and leaves "tree" Undefined.
+  // If that was the last reference, the tree is destroyed on the background
+  // thread. Only takes a lock for a short moment, never waits for the
+  // background thread.
+  void reclaim(Value& tree);
+  // Waits until all trees handed over so far have been destroyed.
+  void flush();
+  // Number of trees that have been handed over but not yet destroyed.
+  size_t pending() const;
+
+private:
+  std::unique_ptr<Impl> prv;
+};
+
+
+// TextEdit describes a change to the text of an Hjson::IncrementalDecoder.
+struct TextEdit {
+  // Byte offset where the change starts, counted in the text that results
+  // from all previous edits.
+  size_t offset;
+  // Number of bytes removed, starting at "offset".
+  size_t removed;
+  // Text inserted at "offset" after the removal.
+  std::string inserted;
+};
+
+
+// IncrementalDecoder keeps a Value tree in sync with an Hjson text that is
+// being edited. After an edit, only the innermost vector or map enclosing the
+// edit is parsed again, and the result is spliced into the existing tree.
+// Edits outside of any bracketed vector or map cause the entire text to be
+// parsed again. The limits in DecoderOptions apply to the entire text, the
+// same as for Unmarshal(). DecoderOptions::dedupe is ignored, since the
+// decoder keeps references to the vectors and maps in the tree, which
+// Value::dedupe() leaves as they are. Use Unmarshal() on text() when a
+// deduplicated tree is needed.
+class IncrementalDecoder {
+public:
+  class Impl;
+
+  // Parses the input text. Throws Hjson::syntax_error if the text is not
+  // valid Hjson.
+  IncrementalDecoder(const std::string& data,
+    const DecoderOptions& options = DecoderOptions());
+  ~IncrementalDecoder();
+
+  // Applies the edits in order and updates the tree. Throws
+  // Hjson::index_out_of_bounds if an edit is outside of the text. Throws
+  // Hjson::syntax_error if the resulting text is not valid Hjson, or
+  // Hjson::limit_error if it exceeds a limit in DecoderOptions, in which
+  // case the tree is not guaranteed to match the text until a later call to
+  // apply() succeeds.
+  void apply(const std::vector<TextEdit>& edits);
+  void apply(const TextEdit& edit);
+
+  // The tree for the current text. The tree is updated in place by apply(),
+  // so it must not be modified by the caller.
+  const Value& root() const;
+  // The current text, including all edits.
+  const std::string& text() const;
+
+private:
+  std::unique_ptr<Impl> prv;
+};
+
+
 class StreamEncoder {
 public:
   const Value& v;
@@ -430,6 +1136,18 @@ Value Unmarshal(const char *data, const DecoderOptions& options = DecoderOptions
 Value Unmarshal(const std::string& data,
   const DecoderOptions& options = DecoderOptions());
 
+// Parses the input text and returns all syntax errors found, in order of
+// appearance. Returns an empty vector if the input is valid Hjson. Unlike the
+// unmarshal functions, parsing continues after an error (from the next line or
+// separator) so that all errors can be reported at once. Throws
+// Hjson::limit_error if a limit in "options" is exceeded.
+std::vector<Diagnostic> Lint(const char *data, size_t dataSize,
+  const DecoderOptions& options = DecoderOptions());
+
+// Parses the input text and returns all syntax errors found.
+std::vector<Diagnostic> Lint(const std::string& data,
+  const DecoderOptions& options = DecoderOptions());
+
 // Reads the entire file (in binary mode) and unmarshals it. Throws
 // Hjson::file_error if the file cannot be opened for reading.
 Value UnmarshalFromFile(const std::string& path,
@@ -454,6 +1172,26 @@ Value UnmarshalFromFile(const std::string& path,
 //
 Value Merge(const Value& base, const Value& ext);
 
+// Merges "ext" into "target", with the same rules as Merge(). Only the parts
+// of "target" that are replaced or extended by "ext" are changed, and maps in
+// "target" keep their insertion order (new keys from "ext" are appended).
+// The elements taken from "ext" are cloned. In the overload for an rvalue, the
+// elements are instead moved from "ext" if no other Value refers to them.
+//
+// Throws Hjson::frozen_error if a map in "target" that must be changed is
+// frozen (frozen subtrees shared by clone() are copied first, as usual).
+//
+void MergeInto(Value& target, const Value& ext);
+void MergeInto(Value& target, Value&& ext);
+
+// Returns the same tree as calling Merge() repeatedly on the layers, from
+// the first layer (lowest priority) to the last layer (highest priority),
+// but in a single traversal and without creating intermediate trees. Only
+// the values that end up in the returned tree are cloned.
+//
+Value MergeLayers(const Value *layers, size_t count);
+Value MergeLayers(const std::vector<Value>& layers);
+
 
 }
 
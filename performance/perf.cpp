@@ -1,8 +1,16 @@
 void perf_multithread();
+void perf_tree();
+void perf_reclaim();
+void perf_compact();
+void perf_access();
 
 
 int main() {
   perf_multithread();
+  perf_tree();
+  perf_reclaim();
+  perf_compact();
+  perf_access();
 
   return 0;
 }
@@ -0,0 +1,131 @@
+#include <hjson.h>
+
+#include <chrono>
+#include <string>
+#include <iostream>
+
+
+static double _seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+    start).count();
+}
+
+
+// Every other route lacks the optional "timeout" key, and every third route
+// has a "weight" that is a String instead of a number.
+static Hjson::Value _build_routes() {
+  Hjson::Value root;
+
+  for (int a = 0; a < 1000; ++a) {
+    Hjson::Value route;
+    route["name"] = "route" + std::to_string(a);
+    if (a % 2 == 0) {
+      route["timeout"] = 30 + a;
+    }
+    if (a % 3 == 0) {
+      route["weight"] = "heavy";
+    } else {
+      route["weight"] = a * 0.5;
+    }
+    root["routes"].push_back(route);
+  }
+
+  root.freeze();
+
+  return root;
+}
+
+
+static std::int64_t _probe_with_exceptions(const Hjson::Value &routes) {
+  std::int64_t sum = 0;
+
+  for (int a = 0; a < int(routes.size()); ++a) {
+    const Hjson::Value &route = routes[a];
+    try {
+      sum += route.at("timeout").to_int64();
+    } catch (const Hjson::index_out_of_bounds&) {
+    }
+    try {
+      sum += static_cast<std::int64_t>(route.at("weight"));
+    } catch (const Hjson::type_mismatch&) {
+    }
+  }
+
+  return sum;
+}
+
+
+static std::int64_t _probe_with_try_get(const Hjson::Value &routes) {
+  std::int64_t sum = 0, i;
+
+  for (int a = 0; a < int(routes.size()); ++a) {
+    const Hjson::Value &route = routes[a];
+    const Hjson::Value *pTimeout = route.find("timeout");
+    if (pTimeout && pTimeout->try_get(&i)) {
+      sum += i;
+    }
+    if (route.find("weight")->try_get(&i)) {
+      sum += i;
+    }
+  }
+
+  return sum;
+}
+
+
+static std::int64_t _probe_with_find_path(const Hjson::Value &root) {
+  std::int64_t sum = 0, i;
+  std::string path;
+
+  for (int a = 0; a < int(root.find("routes")->size()); ++a) {
+    path = "/routes/" + std::to_string(a);
+    size_t prefixSize = path.size();
+    path += "/timeout";
+    const Hjson::Value *pVal = root.find_path(path);
+    if (pVal && pVal->try_get(&i)) {
+      sum += i;
+    }
+    path.resize(prefixSize);
+    path += "/weight";
+    pVal = root.find_path(path);
+    if (pVal && pVal->try_get(&i)) {
+      sum += i;
+    }
+  }
+
+  return sum;
+}
+
+
+// Compares ways of reading optional fields that are often missing or of an
+// unexpected type.
+void perf_access() {
+  Hjson::Value root = _build_routes();
+  const Hjson::Value &routes = *root.find("routes");
+  double exceptionTime = 0, tryGetTime = 0, findPathTime = 0;
+  std::int64_t sum = 0;
+
+  for (int a = 0; a < 50; ++a) {
+    auto start = std::chrono::steady_clock::now();
+    sum += _probe_with_exceptions(routes);
+    exceptionTime += _seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    sum += _probe_with_try_get(routes);
+    tryGetTime += _seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    sum += _probe_with_find_path(root);
+    findPathTime += _seconds(start);
+  }
+
+  std::cout << "Optional fields with exceptions: " << exceptionTime <<
+    " seconds" << std::endl;
+  std::cout << "Optional fields with find() and try_get(): " << tryGetTime <<
+    " seconds" << std::endl;
+  std::cout << "Optional fields with find_path() and try_get(): " <<
+    findPathTime << " seconds" << std::endl;
+
+  // Prove that the probing has not been optimized away.
+  std::cout << "Probe sum: " << sum << std::endl;
+}
@@ -0,0 +1,84 @@
+#include <hjson.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+
+
+static double _seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+    start).count();
+}
+
+
+// Builds several trees at the same time, so that the nodes of each tree are
+// spread out in memory like in a tree that has been edited for a long time.
+static Hjson::Value _build_fragmented_tree() {
+  std::vector<Hjson::Value> trees(8);
+
+  for (int a = 0; a < 20000; ++a) {
+    for (auto &tree : trees) {
+      Hjson::Value route;
+      route["name"] = "route" + std::to_string(a);
+      route["port"] = 8000 + a;
+      route["upstream"] = "host" + std::to_string(a % 100) +
+        ".internal.example.com";
+      route["labels"].push_back("public");
+      route["labels"].push_back("v" + std::to_string(a % 7));
+      tree["routes"].push_back(route);
+    }
+  }
+
+  return trees[3];
+}
+
+
+static std::int64_t _traverse(const Hjson::Value &root) {
+  std::int64_t sum = 0;
+  const Hjson::Value *routes = root.find("routes");
+
+  for (int a = 0; a < int(routes->size()); ++a) {
+    const Hjson::Value &route = (*routes)[a];
+    sum += route.find("port")->to_int64();
+    sum += route.find("upstream")->to_string().size();
+    const Hjson::Value &labels = *route.find("labels");
+    for (int b = 0; b < int(labels.size()); ++b) {
+      sum += labels[b].size();
+    }
+  }
+
+  return sum;
+}
+
+
+static double _time_traversal(const Hjson::Value &root, std::int64_t *pSum) {
+  auto start = std::chrono::steady_clock::now();
+  for (int a = 0; a < 20; ++a) {
+    *pSum += _traverse(root);
+  }
+  return _seconds(start);
+}
+
+
+// Compares traversal times before and after Value::compact().
+void perf_compact() {
+  std::int64_t sum = 0;
+  Hjson::Value root = _build_fragmented_tree();
+  root.freeze();
+
+  double before = _time_traversal(root, &sum);
+  auto start = std::chrono::steady_clock::now();
+  root.compact();
+  double compactTime = _seconds(start);
+  double after = _time_traversal(root, &sum);
+
+  std::cout << "Traversal before compact(): " << before << " seconds" <<
+    std::endl;
+  std::cout << "Traversal after compact(): " << after << " seconds" <<
+    std::endl;
+  std::cout << "compact(): " << compactTime << " seconds" << std::endl;
+
+  // Prove that the traversal has not been optimized away.
+  std::cout << "Traversal sum: " << sum << std::endl;
+}
@@ -0,0 +1,77 @@
+#include <hjson.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+
+
+static Hjson::Value _build_config(int version) {
+  Hjson::Value root;
+
+  for (int a = 0; a < 20000; ++a) {
+    Hjson::Value route;
+    route["name"] = "route" + std::to_string(a);
+    route["version"] = version;
+    route["upstream"] = "host" + std::to_string(a % 100) + ".example.com";
+    for (int b = 0; b < 10; ++b) {
+      route["labels"].push_back("label" + std::to_string(b));
+    }
+    root["routes"].push_back(route);
+  }
+
+  return root;
+}
+
+
+static void _print_latency(const char *szName, std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  std::cout << szName << " swap latency: median " <<
+    v[v.size() / 2] * 1000 << " ms, p99 " <<
+    v[v.size() * 99 / 100] * 1000 << " ms, max " << v.back() * 1000 <<
+    " ms" << std::endl;
+}
+
+
+// Measures how long the thread that swaps in a new config is blocked, with
+// and without handing the old config to an Hjson::Reclaimer.
+void perf_reclaim() {
+  const int swapCount = 30;
+  std::vector<Hjson::Value> fresh;
+  std::vector<double> direct, reclaimed;
+
+  for (int a = 0; a < swapCount; ++a) {
+    fresh.push_back(_build_config(a));
+  }
+  Hjson::Value config = _build_config(-1);
+  for (int a = 0; a < swapCount; ++a) {
+    auto start = std::chrono::steady_clock::now();
+    // The old config is destroyed by this thread.
+    config = fresh[a];
+    fresh[a] = Hjson::Value();
+    direct.push_back(std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count());
+  }
+
+  for (int a = 0; a < swapCount; ++a) {
+    fresh[a] = _build_config(a);
+  }
+  {
+    Hjson::Reclaimer reclaimer;
+    for (int a = 0; a < swapCount; ++a) {
+      auto start = std::chrono::steady_clock::now();
+      Hjson::Value old = config;
+      config = fresh[a];
+      fresh[a] = Hjson::Value();
+      reclaimer.reclaim(old);
+      reclaimed.push_back(std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count());
+      // Let the background thread keep up, as it would between real swaps.
+      reclaimer.flush();
+    }
+  }
+
+  _print_latency("Direct", direct);
+  _print_latency("Reclaimer", reclaimed);
+}
@@ -0,0 +1,110 @@
+#include <hjson.h>
+
+#include <chrono>
+#include <string>
+#include <iostream>
+
+
+static double _seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+    start).count();
+}
+
+
+static Hjson::Value _build_tree() {
+  Hjson::Value root;
+
+  for (int a = 0; a < 2000; ++a) {
+    Hjson::Value route;
+    route["name"] = "route" + std::to_string(a);
+    route["port"] = 8000 + a;
+    route["enabled"] = (a % 3 != 0);
+    for (int b = 0; b < 50; ++b) {
+      route["targets"].push_back(Hjson::Value(b * 1.5));
+    }
+    root["routes"].push_back(route);
+  }
+
+  return root;
+}
+
+
+// Every element access returns a Value by value, which updates the reference
+// count of the element twice.
+static std::int64_t _traverse_tree(const Hjson::Value &root) {
+  std::int64_t sum = 0;
+  const Hjson::Value routes = root["routes"];
+
+  for (int a = 0; a < int(routes.size()); ++a) {
+    const Hjson::Value route = routes[a];
+    sum += route["port"].to_int64();
+    if (route["enabled"]) {
+      const Hjson::Value targets = route["targets"];
+      for (int b = 0; b < int(targets.size()); ++b) {
+        Hjson::Value target = targets[b];
+        sum += target.to_int64();
+      }
+    }
+  }
+
+  return sum;
+}
+
+
+// Walks the same elements through ConstValueRef views, which never touch any
+// reference counts.
+static std::int64_t _traverse_tree_ref(const Hjson::Value &root) {
+  std::int64_t sum = 0;
+  Hjson::ConstValueRef routes = Hjson::ConstValueRef(root)["routes"];
+
+  for (Hjson::ConstValueRef route : routes) {
+    sum += route["port"].to_int64();
+    if (route["enabled"]) {
+      for (Hjson::ConstValueRef target : route["targets"]) {
+        sum += target.to_int64();
+      }
+    }
+  }
+
+  return sum;
+}
+
+
+// Measures the parts of the Value life cycle that are dominated by reference
+// counting. Compare the output from builds with and without the Cmake option
+// HJSON_SINGLE_THREADED.
+void perf_tree() {
+  double buildTime = 0, traverseTime = 0, refTraverseTime = 0, destroyTime = 0;
+  std::int64_t sum = 0;
+
+  for (int a = 0; a < 20; ++a) {
+    auto start = std::chrono::steady_clock::now();
+    Hjson::Value *pRoot = new Hjson::Value(_build_tree());
+    buildTime += _seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int b = 0; b < 5; ++b) {
+      sum += _traverse_tree(*pRoot);
+    }
+    traverseTime += _seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int b = 0; b < 5; ++b) {
+      sum += _traverse_tree_ref(*pRoot);
+    }
+    refTraverseTime += _seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    delete pRoot;
+    destroyTime += _seconds(start);
+  }
+
+  std::cout << "Tree build: " << buildTime << " seconds" << std::endl;
+  std::cout << "Tree traversal: " << traverseTime << " seconds" << std::endl;
+  std::cout << "Tree traversal with ConstValueRef: " << refTraverseTime <<
+    " seconds" << std::endl;
+  std::cout << "Tree destruction: " << destroyTime << " seconds" << std::endl;
+
+  // Prove that the traversal has not been optimized away.
+  std::cout << "Traversal sum: " << sum << std::endl;
+}
@@ -4,6 +4,7 @@
 #include <cctype>
 #include <cstring>
 #include <fstream>
+#include <limits>
 
 
 namespace Hjson {
@@ -20,6 +21,18 @@ enum class ParseState {
 };
 
 
+// Compile-time counterpart of the comment and duplicate key settings in
+// DecoderOptions. The parse loop is instantiated once for each combination so
+// that the hot path does not have to check the options for every character.
+template<bool bComments, bool bWhitespaceAsComments, bool bDuplicateKeyException>
+struct ParsePolicy {
+  static const bool comments = bComments || bWhitespaceAsComments;
+  static const bool whitespaceAsComments = bWhitespaceAsComments;
+  static const bool duplicateKeyException = bDuplicateKeyException;
+};
+
+
+template<bool bComments>
 class CommentInfo {
 public:
   CommentInfo() : hasComment(false), cmStart(0), cmEnd(0) {}
@@ -30,11 +43,46 @@ public:
 };
 
 
+// Used when comments are not kept, so that no positions are tracked at all.
+template<>
+class CommentInfo<false> {
+public:
+  static const bool hasComment = false;
+};
+
+
+template<class P>
 class DecodeParent {
 public:
+  typedef CommentInfo<P::comments> CI;
+
+  DecodeParent() : spanIndex(-1) {}
+
   Value val;
-  CommentInfo ciBefore, ciKey, ciElemBefore, ciElemExtra;
+  CI ciBefore, ciKey, ciElemBefore, ciElemExtra;
   std::string key;
+  // Index in Parser::pSpans, or -1 if no span is recorded for this value.
+  int spanIndex;
+};
+
+
+// The position in the input text of a vector or map, used by
+// IncrementalDecoder. The spans are stored in the order that the containers
+// begin, so the descendants of a container are always right after it.
+class ContainerSpan {
+public:
+  // begin is the index of '{' or '[', end is the index after '}' or ']'.
+  size_t begin, end;
+  // The key in the parent map, or the index in the parent vector (-1 if the
+  // parent is a map).
+  std::string key;
+  int index;
+  Value val;
+  // True if the text inside the container has been edited.
+  bool dirty;
+  // The nesting depth of the container, and the number of values and string
+  // bytes inside it, as counted for the limits in DecoderOptions.
+  size_t depth, nodeCount, stringBytes;
 };
 
 
@@ -47,7 +95,30 @@ public:
   bool withoutBraces;
   DecoderOptions opt;
   std::vector<ParseState> vState;
-  std::vector<DecodeParent> vParent;
+  // Limits from DecoderOptions, with 0 replaced by the max value so that a
+  // single comparison is enough.
+  size_t maxDepth, maxNodes, maxStringBytes, maxStringLength;
+  size_t nodeCount, stringBytes;
+  // Added to the depth, when only a part of the text is parsed.
+  size_t depthBase;
+  bool hasDeadline;
+  std::chrono::steady_clock::time_point deadline;
+  // In lint mode _errAt() only stores the position and message of the error,
+  // line numbers are computed afterwards for all errors in a single pass.
+  bool lint;
+  size_t errIndex;
+  std::string errMessage;
+  // If not null, the spans of all vectors and maps are stored here.
+  std::vector<ContainerSpan> *pSpans;
+};
+
+
+template<class P>
+class PolicyParser : public Parser {
+public:
+  typedef CommentInfo<P::comments> CI;
+
+  std::vector<DecodeParent<P> > vParent;
 };
 
 
@@ -55,7 +126,7 @@ bool tryParseNumber(Value *pNumber, const char *text, size_t textSize, bool stop
 
 
 static inline void _setComment(Value& val, void (Value::*fp)(const std::string&),
-  Parser *p, const CommentInfo& ci)
+  Parser *p, const CommentInfo<true>& ci)
 {
   if (ci.hasComment) {
     (val.*fp)(std::string(p->data + ci.cmStart, p->data + ci.cmEnd));
@@ -64,7 +135,7 @@ static inline void _setComment(Value& val, void (Value::*fp)(const std::string&)
 
 
 static inline void _setComment(Value& val, void (Value::*fp)(const std::string&),
-  Parser *p, const CommentInfo& ciA, const CommentInfo& ciB)
+  Parser *p, const CommentInfo<true>& ciA, const CommentInfo<true>& ciB)
 {
   if (ciA.hasComment && ciB.hasComment) {
     (val.*fp)(std::string(p->data + ciA.cmStart, p->data + ciA.cmEnd) +
@@ -78,6 +149,65 @@ static inline void _setComment(Value& val, void (Value::*fp)(const std::string&)
 }
 
 
+static inline void _setComment(Value&, void (Value::*)(const std::string&),
+  Parser*, const CommentInfo<false>&)
+{
+}
+
+
+static inline void _setComment(Value&, void (Value::*)(const std::string&),
+  Parser*, const CommentInfo<false>&, const CommentInfo<false>&)
+{
+}
+
+
+static inline void _commentBegin(Parser *p, CommentInfo<true> *ci) {
+  ci->cmStart = p->indexNext - 1;
+}
+
+
+static inline void _commentBegin(Parser*, CommentInfo<false>*) {
+}
+
+
+static inline void _commentFound(CommentInfo<true> *ci) {
+  ci->hasComment = true;
+}
+
+
+static inline void _commentFound(CommentInfo<false>*) {
+}
+
+
+static inline void _commentEnd(Parser *p, CommentInfo<true> *ci) {
+  // cmEnd is the first char after the comment (i.e. not included in the comment).
+  ci->cmEnd = p->indexNext - 1;
+}
+
+
+static inline void _commentEnd(Parser*, CommentInfo<false>*) {
+}
+
+
+static inline bool _commentNonEmpty(const CommentInfo<true>& ci) {
+  return ci.cmEnd > ci.cmStart;
+}
+
+
+static inline bool _commentNonEmpty(const CommentInfo<false>&) {
+  return false;
+}
+
+
+static inline void _commentSetHas(CommentInfo<true> *ci, bool hasComment) {
+  ci->hasComment = hasComment;
+}
+
+
+static inline void _commentSetHas(CommentInfo<false>*, bool) {
+}
+
+
 static bool _next(Parser *p) {
   // get the next character.
   if (p->indexNext < p->dataSize) {
@@ -115,6 +245,13 @@ static bool _isPunctuatorChar(char c) {
 
 
 static std::string _errAt(Parser *p, const std::string& message) {
+  if (p->lint) {
+    p->errIndex = std::max(static_cast<size_t>(1), std::min(p->dataSize,
+      static_cast<size_t>(p->indexNext))) - 1;
+    p->errMessage = message;
+    return message;
+  }
+
   if (p->dataSize && p->indexNext <= p->dataSize) {
     size_t decoderIndex = std::max(static_cast<size_t>(1), std::min(p->dataSize,
       static_cast<size_t>(p->indexNext))) - 1;
@@ -140,6 +277,79 @@ static std::string _errAt(Parser *p, const std::string& message) {
 }
 
 
+static size_t _limit(size_t value) {
+  return value ? value : std::numeric_limits<size_t>::max();
+}
+
+
+static void _initLimits(Parser *p) {
+  p->maxDepth = _limit(p->opt.maxDepth);
+  p->maxNodes = _limit(p->opt.maxNodes);
+  p->maxStringBytes = _limit(p->opt.maxStringBytes);
+  p->maxStringLength = _limit(p->opt.maxStringLength);
+  p->nodeCount = 0;
+  p->stringBytes = 0;
+  p->depthBase = 0;
+  p->hasDeadline = (p->opt.maxDuration > std::chrono::steady_clock::duration::zero());
+  if (p->hasDeadline) {
+    p->deadline = std::chrono::steady_clock::now() + p->opt.maxDuration;
+  }
+}
+
+
+static void _checkDepth(Parser *p, size_t depth) {
+  if (depth + p->depthBase > p->maxDepth) {
+    throw limit_error(_errAt(p, "Maximum nesting depth exceeded"));
+  }
+}
+
+
+static void _countNode(Parser *p) {
+  if (++p->nodeCount > p->maxNodes) {
+    throw limit_error(_errAt(p, "Maximum number of values exceeded"));
+  }
+  // Reading the clock is comparatively slow, only do it now and then.
+  if (p->hasDeadline && !(p->nodeCount & 0x3ff) &&
+    std::chrono::steady_clock::now() > p->deadline)
+  {
+    throw limit_error(_errAt(p, "Maximum decoding time exceeded"));
+  }
+}
+
+
+static void _countString(Parser *p, size_t len) {
+  if (len > p->maxStringLength) {
+    throw limit_error(_errAt(p, "Maximum string length exceeded"));
+  }
+  p->stringBytes += len;
+  if (p->stringBytes > p->maxStringBytes) {
+    throw limit_error(_errAt(p, "Maximum total string size exceeded"));
+  }
+}
+
+
+// Called for each char of a long value while it is read, since _countNode()
+// is not called until the value has been read.
+static inline void _checkScanDeadline(Parser *p) {
+  if (p->hasDeadline && !(p->indexNext & 0xffff) &&
+    std::chrono::steady_clock::now() > p->deadline)
+  {
+    throw limit_error(_errAt(p, "Maximum decoding time exceeded"));
+  }
+}
+
+
+// Called for each char of a quoted string while it is read, so that a huge
+// string is rejected before all of it has been stored. len is the number of
+// bytes that the string has at least.
+static inline void _checkStringGrowth(Parser *p, size_t len) {
+  if (len > p->maxStringLength) {
+    throw limit_error(_errAt(p, "Maximum string length exceeded"));
+  }
+  _checkScanDeadline(p);
+}
+
+
 static unsigned char _peek(Parser *p, int offs) {
   int pos = p->indexNext + offs;
 
@@ -213,6 +423,8 @@ static std::string _readMLString(Parser *p) {
   // When parsing multiline string values, we must look for ' characters.
   bool lastLf = false;
   for (;;) {
+    // The last EOL is removed at the end.
+    _checkStringGrowth(p, res.size() - (lastLf ? 1 : 0));
     if (p->ch == 0) {
       throw syntax_error(_errAt(p, "Bad multiline string"));
     } else if (p->ch == '\'') {
@@ -221,8 +433,9 @@ static std::string _readMLString(Parser *p) {
       if (triple == 3) {
         auto sres = res.data();
         if (lastLf) {
-          return std::string(sres, res.size() - 1); // remove last EOL
+          res.pop_back(); // remove last EOL
         }
+        _countString(p, res.size());
         return std::string(sres, res.size());
       }
       continue;
@@ -280,6 +493,7 @@ static std::string _readString(Parser *p, bool allowML) {
 
   char exitCh = p->ch;
   while (_next(p)) {
+    _checkStringGrowth(p, res.size());
     if (p->ch == exitCh) {
       _next(p);
       if (allowML && exitCh == '\'' && p->ch == '\'' && res.size() == 0) {
@@ -287,6 +501,7 @@ static std::string _readString(Parser *p, bool allowML) {
         _next(p);
         return _readMLString(p);
       } else {
+        _countString(p, res.size());
         return std::string(res.data(), res.size());
       }
     }
@@ -346,6 +561,7 @@ static std::string _readKeyname(Parser *p) {
         p->indexNext = firstSpace + 1;
         throw syntax_error(_errAt(p, "Found whitespace in your key name (use quotes to include)"));
       }
+      _countString(p, keyEnd - keyStart);
       return std::string(reinterpret_cast<const char*>(p->data) + keyStart, keyEnd - keyStart);
     } else if (p->ch <= ' ') {
       if (p->ch == 0) {
@@ -366,9 +582,10 @@ static std::string _readKeyname(Parser *p) {
 }
 
 
-static CommentInfo _white(Parser *p) {
-  CommentInfo ci;
-  ci.cmStart = p->indexNext - 1;
+template<class P>
+static CommentInfo<P::comments> _white(Parser *p) {
+  CommentInfo<P::comments> ci;
+  _commentBegin(p, &ci);
 
   while (p->ch > 0) {
     // Skip whitespace.
@@ -377,16 +594,12 @@ static CommentInfo _white(Parser *p) {
     }
     // Hjson allows comments
     if (p->ch == '#' || (p->ch == '/' && _peek(p, 0) == '/')) {
-      if (p->opt.comments) {
-        ci.hasComment = true;
-      }
+      _commentFound(&ci);
       while (p->ch > 0 && p->ch != '\n') {
         _next(p);
       }
     } else if (p->ch == '/' && _peek(p, 0) == '*') {
-      if (p->opt.comments) {
-        ci.hasComment = true;
-      }
+      _commentFound(&ci);
       _next(p);
       _next(p);
       while (p->ch > 0 && !(p->ch == '*' && _peek(p, 0) == '/')) {
@@ -401,20 +614,21 @@ static CommentInfo _white(Parser *p) {
     }
   }
 
-  // cmEnd is the first char after the comment (i.e. not included in the comment).
-  ci.cmEnd = p->indexNext - 1;
+  _commentEnd(p, &ci);
 
-  ci.hasComment = (ci.hasComment || (p->opt.whitespaceAsComments &&
-    (ci.cmEnd > ci.cmStart)));
+  if (P::whitespaceAsComments && _commentNonEmpty(ci)) {
+    _commentSetHas(&ci, true);
+  }
 
   return ci;
 }
 
 
-static CommentInfo _getCommentAfter(Parser *p) {
-  CommentInfo ci;
-  ci.hasComment = p->opt.whitespaceAsComments;
-  ci.cmStart = p->indexNext - 1;
+template<class P>
+static CommentInfo<P::comments> _getCommentAfter(Parser *p) {
+  CommentInfo<P::comments> ci;
+  _commentSetHas(&ci, P::whitespaceAsComments);
+  _commentBegin(p, &ci);
 
   while (p->ch > 0) {
     // Skip whitespace, but only until EOL.
@@ -423,16 +637,12 @@ static CommentInfo _getCommentAfter(Parser *p) {
     }
     // Hjson allows comments
     if (p->ch == '#' || (p->ch == '/' && _peek(p, 0) == '/')) {
-      if (p->opt.comments) {
-        ci.hasComment = true;
-      }
+      _commentFound(&ci);
       while (p->ch > 0 && p->ch != '\n') {
         _next(p);
       }
     } else if (p->ch == '/' && _peek(p, 0) == '*') {
-      if (p->opt.comments) {
-        ci.hasComment = true;
-      }
+      _commentFound(&ci);
       _next(p);
       _next(p);
       while (p->ch > 0 && !(p->ch == '*' && _peek(p, 0) == '/')) {
@@ -447,8 +657,7 @@ static CommentInfo _getCommentAfter(Parser *p) {
     }
   }
 
-  // cmEnd is the first char after the comment (i.e. not included in the comment).
-  ci.cmEnd = p->indexNext - 1;
+  _commentEnd(p, &ci);
 
   return ci;
 }
@@ -507,6 +716,7 @@ static Value _readTfnns2(Parser *p, size_t &valEnd) {
         }
       }
       if (isEol) {
+        _countString(p, valLen);
         return std::string(pVal, valLen);
       }
     }
@@ -518,6 +728,7 @@ static Value _readTfnns2(Parser *p, size_t &valEnd) {
       // valEnd is the first char after the value.
       valEnd = p->indexNext;
     }
+    _checkScanDeadline(p);
   }
 }
 
@@ -532,19 +743,69 @@ static Value _readTfnns(Parser *p) {
 }
 
 
+// Records the start of a vector or map, assuming ch == '[' or ch == '{'.
+template<class P>
+static void _spanBegin(PolicyParser<P> *p) {
+  if (!p->pSpans) {
+    return;
+  }
+
+  ContainerSpan span;
+  span.begin = p->indexNext - 1;
+  span.end = 0;
+  span.index = -1;
+  span.dirty = false;
+  span.depth = p->vParent.size() + p->depthBase;
+  // Replaced by the difference in _spanEnd().
+  span.nodeCount = p->nodeCount;
+  span.stringBytes = p->stringBytes;
+  if (p->vParent.size() > 1) {
+    auto &parent = p->vParent[p->vParent.size() - 2];
+    if (parent.val.type() == Type::Vector) {
+      span.index = static_cast<int>(parent.val.size());
+    } else {
+      span.key = parent.key;
+    }
+  }
+  p->vParent.back().spanIndex = static_cast<int>(p->pSpans->size());
+  p->pSpans->push_back(span);
+}
+
+
+// Records the end of a vector or map, must be called right after the closing
+// char has been consumed.
+template<class P>
+static void _spanEnd(PolicyParser<P> *p) {
+  if (p->pSpans && p->vParent.back().spanIndex >= 0) {
+    auto &span = (*p->pSpans)[p->vParent.back().spanIndex];
+    span.end = p->indexNext - 1;
+    span.val = p->vParent.back().val;
+    span.nodeCount = p->nodeCount - span.nodeCount;
+    span.stringBytes = p->stringBytes - span.stringBytes;
+  }
+}
+
+
 // Parse an array value.
 // assuming ch == '['
-static void _readArrayBegin(Parser* p) {
+template<class P>
+static void _readArrayBegin(PolicyParser<P> *p) {
+  typedef typename PolicyParser<P>::CI CI;
+
+  _checkDepth(p, p->vParent.size());
+  _spanBegin(p);
+
   // Skip '['.
   _next(p);
 
   p->vParent.back().val = Value(Type::Vector);
-  p->vParent.back().ciElemBefore = _white(p);
-  p->vParent.back().ciElemExtra = CommentInfo();
+  p->vParent.back().ciElemBefore = _white<P>(p);
+  p->vParent.back().ciElemExtra = CI();
 
   if (p->ch == ']') {
     _setComment(p->vParent.back().val, &Value::set_comment_inside, p, p->vParent.back().ciElemBefore);
     _next(p);
+    _spanEnd(p);
     p->vState.back() = ParseState::ValueEnd;
   } else {
     p->vState.back() = ParseState::VectorElemEnd;
@@ -553,28 +814,34 @@ static void _readArrayBegin(Parser* p) {
 }
 
 
-static void _readArrayElemEnd(Parser* p) {
-  Value elem = p->vParent.back().val;
+template<class P>
+static void _readArrayElemEnd(PolicyParser<P> *p) {
+  typedef typename PolicyParser<P>::CI CI;
+
+  Value elem(std::move(p->vParent.back().val));
   p->vParent.pop_back();
 
   _setComment(elem, &Value::set_comment_before, p, p->vParent.back().ciElemBefore, p->vParent.back().ciElemExtra);
-  auto ciAfter = _white(p);
+  auto ciAfter = _white<P>(p);
   // in Hjson the comma is optional and trailing commas are allowed
   if (p->ch == ',') {
     _next(p);
     // It is unlikely that someone writes a comment after the value but
     // before the comma, so we include any such comment in "comment_after".
-    p->vParent.back().ciElemExtra = _white(p);
+    p->vParent.back().ciElemExtra = _white<P>(p);
   } else {
-    p->vParent.back().ciElemExtra = CommentInfo();
+    p->vParent.back().ciElemExtra = CI();
   }
   if (p->ch == ']') {
-    auto existingAfter = elem.get_comment_after();
-    _setComment(elem, &Value::set_comment_after, p, ciAfter, p->vParent.back().ciElemExtra);
-    if (!existingAfter.empty()) {
-      elem.set_comment_after(existingAfter + elem.get_comment_after());
+    if (P::comments) {
+      auto existingAfter = elem.get_comment_after();
+      _setComment(elem, &Value::set_comment_after, p, ciAfter, p->vParent.back().ciElemExtra);
+      if (!existingAfter.empty()) {
+        elem.set_comment_after(existingAfter + elem.get_comment_after());
+      }
     }
     _next(p);
+    _spanEnd(p);
     p->vState.back() = ParseState::ValueEnd;
   } else {
     if (p->ch == 0) {
@@ -583,25 +850,32 @@ static void _readArrayElemEnd(Parser* p) {
     p->vParent.back().ciElemBefore = ciAfter;
     p->vState.push_back(ParseState::ValueBegin);
   }
-  p->vParent.back().val.push_back(elem);
+  p->vParent.back().val.push_back(std::move(elem));
 }
 
 
-static void _readObjectBegin(Parser *p) {
+template<class P>
+static void _readObjectBegin(PolicyParser<P> *p) {
+  typedef typename PolicyParser<P>::CI CI;
+
+  _checkDepth(p, p->vParent.size());
+
   p->vParent.back().val = Value(Type::Map);
 
   if (p->ch == '{') {
+    _spanBegin(p);
     _next(p);
-    p->vParent.back().ciElemBefore = _white(p);
+    p->vParent.back().ciElemBefore = _white<P>(p);
   } else {
     p->vParent.back().ciElemBefore = p->vParent.back().ciBefore;
-    p->vParent.back().ciBefore = CommentInfo();
+    p->vParent.back().ciBefore = CI();
   }
 
 
   if (p->ch == '}' && !(p->vParent.empty() && p->withoutBraces)) {
     _setComment(p->vParent.back().val, &Value::set_comment_inside, p, p->vParent.back().ciElemBefore);
     _next(p);
+    _spanEnd(p);
     p->vState.back() = ParseState::ValueEnd;
   } else {
     p->vState.back() = ParseState::MapElemBegin;
@@ -609,7 +883,8 @@ static void _readObjectBegin(Parser *p) {
 }
 
 
-static void _readObjectElemBegin(Parser* p) {
+template<class P>
+static void _readObjectElemBegin(PolicyParser<P> *p) {
   Value &object = p->vParent.back().val;
 
   if (p->ch == 0) {
@@ -628,10 +903,10 @@ static void _readObjectElemBegin(Parser* p) {
   }
 
   p->vParent.back().key = _readKeyname(p);
-  if (p->opt.duplicateKeyException && object[p->vParent.back().key].defined()) {
+  if (P::duplicateKeyException && object[p->vParent.back().key].defined()) {
     throw syntax_error(_errAt(p, "Found duplicate of key '" + p->vParent.back().key + "'"));
   }
-  p->vParent.back().ciKey = _white(p);
+  p->vParent.back().ciKey = _white<P>(p);
   if (p->ch != ':') {
     throw syntax_error(_errAt(p, std::string(
       "Expected ':' instead of '") + (char)(p->ch) + "'"));
@@ -642,36 +917,42 @@ static void _readObjectElemBegin(Parser* p) {
 }
 
 
-static void _readObjectElemEnd(Parser *p) {
-  Value elem = p->vParent.back().val;
+template<class P>
+static void _readObjectElemEnd(PolicyParser<P> *p) {
+  typedef typename PolicyParser<P>::CI CI;
+
+  Value elem(std::move(p->vParent.back().val));
   p->vParent.pop_back();
   _setComment(elem, &Value::set_comment_key, p, p->vParent.back().ciKey);
-  if (!elem.get_comment_before().empty()) {
+  if (P::comments && !elem.get_comment_before().empty()) {
     elem.set_comment_key(elem.get_comment_key() +
       elem.get_comment_before());
     elem.set_comment_before("");
   }
   _setComment(elem, &Value::set_comment_before, p, p->vParent.back().ciElemBefore, p->vParent.back().ciElemExtra);
-  auto ciAfter = _white(p);
+  auto ciAfter = _white<P>(p);
 
   // in Hjson the comma is optional and trailing commas are allowed
   if (p->ch == ',') {
     _next(p);
     // It is unlikely that someone writes a comment after the value but
     // before the comma, so we include any such comment in "comment_after".
-    p->vParent.back().ciElemExtra = _white(p);
+    p->vParent.back().ciElemExtra = _white<P>(p);
   } else {
-    p->vParent.back().ciElemExtra = {};
+    p->vParent.back().ciElemExtra = CI();
   }
 
   if (p->ch == '}' && !(p->vParent.size() == 1 && p->withoutBraces)) {
-    auto existingAfter = elem.get_comment_after();
-    _setComment(elem, &Value::set_comment_after, p, ciAfter, p->vParent.back().ciElemExtra);
-    if (!existingAfter.empty()) {
-      elem.set_comment_after(existingAfter + elem.get_comment_after());
+    if (P::comments) {
+      auto existingAfter = elem.get_comment_after();
+      _setComment(elem, &Value::set_comment_after, p, ciAfter, p->vParent.back().ciElemExtra);
+      if (!existingAfter.empty()) {
+        elem.set_comment_after(existingAfter + elem.get_comment_after());
+      }
     }
     p->vParent.back().val[p->vParent.back().key].assign_with_comments(std::move(elem));
     _next(p);
+    _spanEnd(p);
     p->vState.back() = ParseState::ValueEnd;
   } else {
     p->vParent.back().val[p->vParent.back().key].assign_with_comments(std::move(elem));
@@ -682,9 +963,11 @@ static void _readObjectElemEnd(Parser *p) {
 
 
 // Parse a Hjson value. It could be an object, an array, a string, a number or a word.
-static void _readValueBegin(Parser *p) {
-  p->vParent.push_back(DecodeParent());
-  p->vParent.back().ciBefore = _white(p);
+template<class P>
+static void _readValueBegin(PolicyParser<P> *p) {
+  _countNode(p);
+  p->vParent.push_back(DecodeParent<P>());
+  p->vParent.back().ciBefore = _white<P>(p);
 
   switch (p->ch) {
   case '{':
@@ -706,8 +989,9 @@ static void _readValueBegin(Parser *p) {
 }
 
 
-static void _readValueEnd(Parser *p) {
-  auto ciAfter = _getCommentAfter(p);
+template<class P>
+static void _readValueEnd(PolicyParser<P> *p) {
+  auto ciAfter = _getCommentAfter<P>(p);
 
   _setComment(p->vParent.back().val, &Value::set_comment_before, p, p->vParent.back().ciBefore);
   _setComment(p->vParent.back().val, &Value::set_comment_after, p, ciAfter);
@@ -716,13 +1000,15 @@ static void _readValueEnd(Parser *p) {
 }
 
 
-static Value _hasTrailing(Parser *p, CommentInfo *ci) {
-  *ci = _white(p);
+template<class P>
+static bool _hasTrailing(PolicyParser<P> *p, typename PolicyParser<P>::CI *ci) {
+  *ci = _white<P>(p);
   return p->ch > 0;
 }
 
 
-static void _parseLoop(Parser* p) {
+template<class P>
+static void _parseLoop(PolicyParser<P> *p) {
   while (!p->vState.empty()) {
     switch (p->vState.back()) {
     case ParseState::ValueBegin:
@@ -752,11 +1038,13 @@ static void _parseLoop(Parser* p) {
 
 
 // Braces for the root object are optional
-static Value _rootValue(Parser *p) {
-  CommentInfo ciExtra;
+template<class P>
+static Value _rootValue(PolicyParser<P> *p) {
+  typename PolicyParser<P>::CI ciExtra;
 
-  p->vParent.push_back(DecodeParent());
-  p->vParent.back().ciBefore = _white(p);
+  _countNode(p);
+  p->vParent.push_back(DecodeParent<P>());
+  p->vParent.back().ciBefore = _white<P>(p);
 
   if (p->ch == '[') {
     p->vState.push_back(ParseState::VectorBegin);
@@ -779,6 +1067,8 @@ static Value _rootValue(Parser *p) {
       _resetAt(p);
       p->vParent.clear();
       p->vState.clear();
+      p->nodeCount = 0;
+      p->stringBytes = 0;
       p->vState.push_back(ParseState::ValueBegin);
       try {
         _parseLoop(p);
@@ -806,26 +1096,235 @@ static Value _rootValue(Parser *p) {
 }
 
 
+template<class P>
+static void _initParser(PolicyParser<P> *p, const char *data, size_t dataSize,
+  const DecoderOptions& options)
+{
+  p->data = (const unsigned char*) data;
+  p->dataSize = dataSize;
+  p->indexNext = 0;
+  p->ch = ' ';
+  p->withoutBraces = false;
+  p->opt = options;
+  p->lint = false;
+  p->pSpans = 0;
+  _initLimits(p);
+
+  _resetAt(p);
+}
+
+
+template<class P>
+static Value _unmarshal(const char *data, size_t dataSize, const DecoderOptions& options) {
+  PolicyParser<P> parser;
+  _initParser(&parser, data, dataSize, options);
+
+  Value ret = _rootValue(&parser);
+  if (options.dedupe) {
+    ret.dedupe();
+  }
+
+  return ret;
+}
+
+
+// Skips ahead after a syntax error and adjusts the parse state so that the
+// innermost open vector or map can continue with its next element. Returns
+// false if parsing cannot continue.
+template<class P>
+static bool _recover(PolicyParser<P> *p, int *pLastRecover) {
+  typedef typename PolicyParser<P>::CI CI;
+
+  // Make sure that every recovery moves forward, otherwise the same error
+  // could be found over and over again.
+  if (p->indexNext - 1 <= *pLastRecover) {
+    _next(p);
+  }
+  while (p->ch > 0 && p->ch != '\n' && p->ch != ',' && p->ch != '}' &&
+    p->ch != ']')
+  {
+    _next(p);
+  }
+
+  // Drop the values that were being parsed, keep the open containers.
+  while (!p->vState.empty() && p->vState.back() != ParseState::MapElemBegin &&
+    p->vState.back() != ParseState::MapElemEnd &&
+    p->vState.back() != ParseState::VectorElemEnd)
+  {
+    p->vState.pop_back();
+  }
+  if (p->vState.empty()) {
+    return false;
+  }
+  p->vParent.resize(p->vState.size());
+
+  _white<P>(p);
+  if (p->ch == ',') {
+    _next(p);
+    _white<P>(p);
+  }
+  *pLastRecover = p->indexNext - 1;
+
+  bool isMap = (p->vState.back() != ParseState::VectorElemEnd);
+  bool isRootWithoutBraces = (isMap && p->vParent.size() == 1 && p->withoutBraces);
+
+  if (p->ch == 0 && !isRootWithoutBraces) {
+    return false;
+  }
+
+  auto &parent = p->vParent.back();
+  parent.ciElemBefore = CI();
+  parent.ciElemExtra = CI();
+
+  if ((p->ch == '}' || p->ch == ']') && !isRootWithoutBraces) {
+    // Close the innermost container. A closing char that does not match is
+    // left for the outer container.
+    if (p->ch == (isMap ? '}' : ']')) {
+      _next(p);
+    }
+    p->vState.back() = ParseState::ValueEnd;
+  } else if (isMap) {
+    p->vState.back() = ParseState::MapElemBegin;
+  } else {
+    p->vState.push_back(ParseState::ValueBegin);
+  }
+
+  return true;
+}
+
+
+template<class P>
+static std::vector<Diagnostic> _lint(const char *data, size_t dataSize,
+  const DecoderOptions& options)
+{
+  std::vector<Diagnostic> ret;
+  PolicyParser<P> parser;
+  PolicyParser<P> *p = &parser;
+  int lastRecover = -1;
+
+  _initParser(p, data, dataSize, options);
+  p->lint = true;
+
+  p->vParent.push_back(DecodeParent<P>());
+  _white<P>(p);
+
+  if (p->ch == '[') {
+    p->vState.push_back(ParseState::VectorBegin);
+  } else {
+    if (p->ch != '{') {
+      // Assume root object without braces
+      p->withoutBraces = true;
+    }
+    p->vState.push_back(ParseState::MapBegin);
+  }
+
+  for (;;) {
+    try {
+      _parseLoop(p);
+      typename PolicyParser<P>::CI ciExtra;
+      if (_hasTrailing(p, &ciExtra)) {
+        throw syntax_error(_errAt(p, "Syntax error, found trailing characters"));
+      }
+      break;
+    } catch (const syntax_error&) {
+      Diagnostic diag;
+      diag.offset = p->errIndex;
+      diag.message = p->errMessage;
+      ret.push_back(diag);
+      if (!_recover(p, &lastRecover)) {
+        break;
+      }
+    }
+  }
+
+  if (!ret.empty() && p->withoutBraces) {
+    // Test if we are dealing with a single JSON value instead
+    // (true/false/null/num/"").
+    PolicyParser<P> single;
+    _initParser(&single, data, dataSize, options);
+    single.vState.push_back(ParseState::ValueBegin);
+    try {
+      _parseLoop(&single);
+      typename PolicyParser<P>::CI ciExtra;
+      if (!_hasTrailing(&single, &ciExtra)) {
+        ret.clear();
+      }
+    } catch (const syntax_error&) {}
+  }
+
+  // The errors are found in (almost) increasing order, so the line numbers
+  // can be counted in a single pass through the data.
+  std::stable_sort(ret.begin(), ret.end(), [](const Diagnostic& a,
+    const Diagnostic& b)
+  {
+    return a.offset < b.offset;
+  });
+
+  size_t index = 0, line = 1, lineStart = 0;
+  for (auto &diag : ret) {
+    for (; index < diag.offset; ++index) {
+      if (p->data[index] == '\n') {
+        ++line;
+        lineStart = index + 1;
+      }
+    }
+    diag.line = line;
+    diag.column = diag.offset - lineStart + 1;
+  }
+
+  return ret;
+}
+
+
+template<bool bComments, bool bWhitespaceAsComments>
+static Value _unmarshal(const char *data, size_t dataSize, const DecoderOptions& options) {
+  if (options.duplicateKeyException) {
+    return _unmarshal<ParsePolicy<bComments, bWhitespaceAsComments, true> >(
+      data, dataSize, options);
+  }
+
+  return _unmarshal<ParsePolicy<bComments, bWhitespaceAsComments, false> >(
+    data, dataSize, options);
+}
+
+
 // Unmarshal parses the Hjson-encoded data and returns a tree of Values.
 //
 // Unmarshal uses the inverse of the encodings that Marshal uses.
 //
 Value Unmarshal(const char *data, size_t dataSize, const DecoderOptions& options) {
-  Parser parser = {
-    (const unsigned char*) data,
-    dataSize,
-    0,
-    ' ',
-    false,
-    options
-  };
+  MemoryResourceScope scope(options.memoryResource ?
+    options.memoryResource : MemoryResourceScope::current());
+
+  // Pick the parser instantiation matching the options, so that the options
+  // do not need to be checked inside the parse loop.
+  if (options.whitespaceAsComments) {
+    return _unmarshal<true, true>(data, dataSize, options);
+  } else if (options.comments) {
+    return _unmarshal<true, false>(data, dataSize, options);
+  }
+
+  return _unmarshal<false, false>(data, dataSize, options);
+}
 
-  if (parser.opt.whitespaceAsComments) {
-    parser.opt.comments = true;
+
+// Lint parses the Hjson-encoded data and returns a Diagnostic for every
+// syntax error found. After an error the parsing continues from the next
+// line or separator.
+std::vector<Diagnostic> Lint(const char *data, size_t dataSize,
+  const DecoderOptions& options)
+{
+  // Comments are not needed since no Value tree is returned.
+  if (options.duplicateKeyException) {
+    return _lint<ParsePolicy<false, false, true> >(data, dataSize, options);
   }
 
-  _resetAt(&parser);
-  return _rootValue(&parser);
+  return _lint<ParsePolicy<false, false, false> >(data, dataSize, options);
+}
+
+
+std::vector<Diagnostic> Lint(const std::string &data, const DecoderOptions& options) {
+  return Lint(data.c_str(), data.size(), options);
 }
 
 
@@ -843,6 +1342,269 @@ Value Unmarshal(const std::string &data, const DecoderOptions& options) {
 }
 
 
+class IncrementalDecoder::Impl {
+public:
+  std::string text;
+  DecoderOptions opt;
+  Value root;
+  std::vector<ContainerSpan> spans;
+  // Totals for the entire text, as counted for the limits in DecoderOptions.
+  size_t nodeCount, stringBytes;
+  bool needsFullParse;
+  void (*fullParse)(Impl*);
+  bool (*reparseSpan)(Impl*, size_t);
+};
+
+
+template<class P>
+static void _incrementalFullParse(IncrementalDecoder::Impl *im) {
+  std::vector<ContainerSpan> spans;
+  PolicyParser<P> parser;
+  _initParser(&parser, im->text.data(), im->text.size(), im->opt);
+  parser.pSpans = &spans;
+
+  // Replace also the comments before and after the root.
+  im->root.assign_with_comments(_rootValue(&parser));
+  im->spans.swap(spans);
+  im->nodeCount = parser.nodeCount;
+  im->stringBytes = parser.stringBytes;
+  im->needsFullParse = false;
+}
+
+
+// Parses the text of the container at spans[spanIndex] again and replaces the
+// old container in the tree. Returns false if the container could not be
+// parsed on its own, so that its parent must be parsed instead.
+template<class P>
+static bool _incrementalReparseSpan(IncrementalDecoder::Impl *im, size_t spanIndex) {
+  auto &spans = im->spans;
+  const ContainerSpan &old = spans[spanIndex];
+
+  // The parent is the closest preceding span that encloses this one.
+  int parentIndex = static_cast<int>(spanIndex) - 1;
+  while (parentIndex >= 0 && spans[parentIndex].end < old.end) {
+    --parentIndex;
+  }
+  if (parentIndex < 0) {
+    return false;
+  }
+
+  Value &parentVal = spans[parentIndex].val;
+  Value *pSlot = 0;
+  if (old.index >= 0) {
+    if (parentVal.type() == Type::Vector && old.index < int(parentVal.size())) {
+      pSlot = &parentVal[old.index];
+    }
+  } else if (parentVal.type() == Type::Map) {
+    try {
+      pSlot = &parentVal.at(old.key);
+    } catch (const index_out_of_bounds&) {}
+  }
+  // Make sure that the slot still contains the container, it could have been
+  // replaced by a duplicate key.
+  if (!pSlot || *pSlot != old.val) {
+    return false;
+  }
+
+  std::vector<ContainerSpan> fresh;
+  PolicyParser<P> parser;
+  PolicyParser<P> *p = &parser;
+  _initParser(p, im->text.data(), im->text.size(), im->opt);
+  p->pSpans = &fresh;
+  // The limits apply to the entire text, not only to this container.
+  p->depthBase = old.depth - 1;
+  p->nodeCount = im->nodeCount - old.nodeCount;
+  p->stringBytes = im->stringBytes - old.stringBytes;
+  // Start at the container but keep the preceding text, it is needed for the
+  // indentation of multiline strings.
+  p->indexNext = static_cast<int>(old.begin);
+  _next(p);
+  if (p->ch != '{' && p->ch != '[') {
+    return false;
+  }
+  p->vParent.push_back(DecodeParent<P>());
+  p->vState.push_back(p->ch == '{' ? ParseState::MapBegin : ParseState::VectorBegin);
+
+  try {
+    _parseLoop(p);
+  } catch (const syntax_error&) {
+    return false;
+  } catch (const limit_error&) {
+    // The full parse throws the same error, with the correct position.
+    return false;
+  }
+
+  // The container must end exactly where it did before the edit, otherwise
+  // the edit has changed the structure of the parent.
+  if (fresh.empty() || fresh[0].end != old.end) {
+    return false;
+  }
+
+  Value val = p->vParent.back().val;
+  // Keep the comments before and after the container, they are not part of
+  // the parsed text.
+  *pSlot = val;
+  pSlot->set_comment_inside(val.get_comment_inside());
+
+  fresh[0].key = old.key;
+  fresh[0].index = old.index;
+
+  im->nodeCount = p->nodeCount;
+  im->stringBytes = p->stringBytes;
+  for (size_t a = 0; a < spanIndex; ++a) {
+    auto &ancestor = spans[a];
+    if (ancestor.begin < old.begin && ancestor.end > old.end) {
+      // Unsigned arithmetic, the results are never negative.
+      ancestor.nodeCount += fresh[0].nodeCount - old.nodeCount;
+      ancestor.stringBytes += fresh[0].stringBytes - old.stringBytes;
+    }
+  }
+
+  size_t last = spanIndex + 1;
+  while (last < spans.size() && spans[last].begin < old.end) {
+    ++last;
+  }
+  spans.erase(spans.begin() + spanIndex, spans.begin() + last);
+  spans.insert(spans.begin() + spanIndex, fresh.begin(), fresh.end());
+
+  return true;
+}
+
+
+template<class P>
+static void _incrementalSetPolicy(IncrementalDecoder::Impl *im) {
+  im->fullParse = _incrementalFullParse<P>;
+  im->reparseSpan = _incrementalReparseSpan<P>;
+}
+
+
+template<bool bComments, bool bWhitespaceAsComments>
+static void _incrementalSetPolicy(IncrementalDecoder::Impl *im) {
+  if (im->opt.duplicateKeyException) {
+    _incrementalSetPolicy<ParsePolicy<bComments, bWhitespaceAsComments, true> >(im);
+  } else {
+    _incrementalSetPolicy<ParsePolicy<bComments, bWhitespaceAsComments, false> >(im);
+  }
+}
+
+
+IncrementalDecoder::IncrementalDecoder(const std::string& data,
+  const DecoderOptions& options)
+  : prv(new Impl())
+{
+  prv->text = data;
+  prv->opt = options;
+
+  MemoryResourceScope scope(options.memoryResource ?
+    options.memoryResource : MemoryResourceScope::current());
+  if (options.whitespaceAsComments) {
+    _incrementalSetPolicy<true, true>(prv.get());
+  } else if (options.comments) {
+    _incrementalSetPolicy<true, false>(prv.get());
+  } else {
+    _incrementalSetPolicy<false, false>(prv.get());
+  }
+
+  prv->fullParse(prv.get());
+}
+
+
+IncrementalDecoder::~IncrementalDecoder() {
+}
+
+
+void IncrementalDecoder::apply(const TextEdit& edit) {
+  apply(std::vector<TextEdit>(1, edit));
+}
+
+
+void IncrementalDecoder::apply(const std::vector<TextEdit>& edits) {
+  auto &spans = prv->spans;
+  MemoryResourceScope scope(prv->opt.memoryResource ?
+    prv->opt.memoryResource : MemoryResourceScope::current());
+
+  for (const auto &edit : edits) {
+    if (edit.offset > prv->text.size() ||
+      edit.removed > prv->text.size() - edit.offset)
+    {
+      throw index_out_of_bounds("Edit is outside of the text.");
+    }
+
+    prv->text.replace(edit.offset, edit.removed, edit.inserted);
+
+    if (prv->needsFullParse) {
+      continue;
+    }
+
+    size_t editEnd = edit.offset + edit.removed;
+    long long delta = static_cast<long long>(edit.inserted.size()) -
+      static_cast<long long>(edit.removed);
+    int innermost = -1;
+
+    for (size_t a = 0; a < spans.size(); ++a) {
+      auto &span = spans[a];
+      // The edit must be between the brackets, not touching them.
+      if (span.begin < edit.offset && editEnd < span.end) {
+        innermost = static_cast<int>(a);
+      }
+      if (span.begin >= editEnd) {
+        span.begin += delta;
+        span.end += delta;
+      } else if (span.end >= editEnd) {
+        span.end += delta;
+      }
+    }
+
+    if (innermost < 0) {
+      prv->needsFullParse = true;
+    } else {
+      spans[innermost].dirty = true;
+    }
+  }
+
+  if (!prv->needsFullParse) {
+    size_t a = 0;
+    while (a < spans.size()) {
+      if (!spans[a].dirty) {
+        ++a;
+      } else if (prv->reparseSpan(prv.get(), a)) {
+        // Skip the new descendants, they are up to date.
+        size_t end = spans[a].end;
+        while (a < spans.size() && spans[a].begin < end) {
+          ++a;
+        }
+      } else {
+        // Parse the parent instead.
+        int parentIndex = static_cast<int>(a) - 1;
+        while (parentIndex >= 0 && spans[parentIndex].end < spans[a].end) {
+          --parentIndex;
+        }
+        if (parentIndex < 0) {
+          prv->needsFullParse = true;
+          break;
+        }
+        spans[parentIndex].dirty = true;
+        a = parentIndex;
+      }
+    }
+  }
+
+  if (prv->needsFullParse) {
+    prv->fullParse(prv.get());
+  }
+}
+
+
+const Value& IncrementalDecoder::root() const {
+  return prv->root;
+}
+
+
+const std::string& IncrementalDecoder::text() const {
+  return prv->text;
+}
+
+
 Value UnmarshalFromFile(const std::string &path, const DecoderOptions& options) {
   std::ifstream infile(path, std::ifstream::ate | std::ifstream::binary);
   if (!infile.is_open()) {
@@ -26,7 +26,7 @@ public:
   int index;
   bool isEmpty;
   std::string commentAfter;
-  std::map<std::string, Value>::const_iterator it;
+  Value::const_iterator it, itEnd;
 };
 
 
@@ -39,10 +39,15 @@ struct Encoder {
     needsEscapeName, lineBreak;
   std::vector<EncodeState> vState;
   std::vector<EncodeParent> vParent;
+  // Holds the current element of a packed Vector, so that the Vector does not
+  // need to create Value objects for all its elements.
+  Value packedElem;
 };
 
 
 bool startsWithNumber(const char *text, size_t textSize);
+size_t formatDouble(char *buf, double d);
+size_t formatInt64(char *buf, std::int64_t i);
 
 
 // table of character substitutions
@@ -352,12 +357,25 @@ static void _writeValueBegin(Encoder *e) {
 
   switch (value.type()) {
   case Type::Double:
-    if (std::isnan(static_cast<double>(value)) || std::isinf(static_cast<double>(value))) {
-      *e->os << Value(Type::Null).to_string();
-    } else if (!e->opt.allowMinusZero && value == 0 && std::signbit(static_cast<double>(value))) {
-      *e->os << Value(0).to_string();
-    } else {
-      *e->os << value.to_string();
+    {
+      // Comparing with temporary Value objects would allocate a node for
+      // each number.
+      double d = value.to_double();
+      if (std::isnan(d) || std::isinf(d)) {
+        *e->os << "null";
+      } else if (!e->opt.allowMinusZero && d == 0 && std::signbit(d)) {
+        *e->os << "0";
+      } else {
+        char buf[32];
+        e->os->write(buf, formatDouble(buf, d));
+      }
+    }
+    break;
+
+  case Type::Int64:
+    {
+      char buf[32];
+      e->os->write(buf, formatInt64(buf, value.to_int64()));
     }
     break;
 
@@ -378,7 +396,13 @@ static void _writeValueBegin(Encoder *e) {
       e->indent++;
     }
     e->vParent.back().commentAfter = value.get_comment_inside();
-    e->vParent.back().it = value.begin();
+    if (e->opt.preserveInsertionOrder) {
+      e->vParent.back().it = value.insertion_begin();
+      e->vParent.back().itEnd = value.insertion_end();
+    } else {
+      e->vParent.back().it = value.begin();
+      e->vParent.back().itEnd = value.end();
+    }
     e->vState.back() = EncodeState::MapElemBegin;
     return;
 
@@ -401,7 +425,18 @@ static void _writeVectorElemBegin(Encoder *e) {
   const Value &value = *ep.pVal;
 
   for (; ep.index < value.size(); ep.index++) {
-    const Value &elem= value[ep.index];
+    switch (value.packed_type()) {
+    case Type::Int64:
+      e->packedElem = Value(value.int64_span()[ep.index]);
+      break;
+    case Type::Double:
+      e->packedElem = Value(value.double_span()[ep.index]);
+      break;
+    default:
+      break;
+    }
+    const Value &elem = (value.packed_type() == Type::Undefined ?
+      value[ep.index] : e->packedElem);
     if (elem.defined()) {
       bool shouldIndent = (!e->opt.comments || elem.get_comment_key().empty());
 
@@ -530,33 +565,17 @@ static void _writeMapElemBegin(Encoder *e) {
   EncodeParent &ep = e->vParent.back();
   const Value &value = *ep.pVal;
 
-  if (e->opt.preserveInsertionOrder) {
-    for (; ep.index < value.size(); ++ep.index) {
-      const Value &elem = value[ep.index];
-      if (elem.defined()) {
-        int oldParentIndex = e->vParent.size() - 1;
+  for (; ep.it != ep.itEnd; ++ep.it) {
+    if (ep.it->second.defined()) {
+      int oldParentIndex = e->vParent.size() - 1;
+      auto oldIt = ep.it;
 
-        // Invalidates ep
-        _objElem(e, value.key(ep.index), elem, &ep.isEmpty, ep.commentAfter);
-
-        e->vParent[oldParentIndex].commentAfter = elem.get_comment_after();
-        ++e->vParent[oldParentIndex].index;
-        return;
-      }
-    }
-  } else {
-    for (; ep.it != value.end(); ++ep.it) {
-      if (ep.it->second.defined()) {
-        int oldParentIndex = e->vParent.size() - 1;
-        auto oldIt = ep.it;
-
-        // Invalidates ep
-        _objElem(e, oldIt->first, oldIt->second, &ep.isEmpty, ep.commentAfter);
+      // Invalidates ep
+      _objElem(e, oldIt->first, oldIt->second, &ep.isEmpty, ep.commentAfter);
 
-        e->vParent[oldParentIndex].commentAfter = oldIt->second.get_comment_after();
-        ++e->vParent[oldParentIndex].it;
-        return;
-      }
+      e->vParent[oldParentIndex].commentAfter = oldIt->second.get_comment_after();
+      ++e->vParent[oldParentIndex].it;
+      return;
     }
   }
 
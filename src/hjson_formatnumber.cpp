@@ -0,0 +1,365 @@
+#include "hjson.h"
+#include <cmath>
+#include <cstring>
+#if HJSON_USE_CHARCONV
+# include <charconv>
+#endif
+
+
+namespace Hjson {
+
+
+#if !HJSON_USE_CHARCONV
+// A floating point number with a 64 bit significand, f * 2^e. Used by the
+// Grisu2 algorithm (Florian Loitsch, "Printing Floating-Point Numbers Quickly
+// and Accurately with Integers", 2010), which finds the shortest digits that
+// are parsed back to the same double in nearly all cases. The digits are
+// always parsed back to the same double.
+struct DiyFp {
+  std::uint64_t f;
+  int e;
+};
+
+
+static const std::uint64_t hiddenBit = 0x0010000000000000ull;
+
+
+// Normalized significands and binary exponents of 10^-348, 10^-340, ...,
+// 10^340.
+static const std::uint64_t cachedPowersF[] = {
+  0xfa8fd5a0081c0288ull, 0xbaaee17fa23ebf76ull, 0x8b16fb203055ac76ull,
+  0xcf42894a5dce35eaull, 0x9a6bb0aa55653b2dull, 0xe61acf033d1a45dfull,
+  0xab70fe17c79ac6caull, 0xff77b1fcbebcdc4full, 0xbe5691ef416bd60cull,
+  0x8dd01fad907ffc3cull, 0xd3515c2831559a83ull, 0x9d71ac8fada6c9b5ull,
+  0xea9c227723ee8bcbull, 0xaecc49914078536dull, 0x823c12795db6ce57ull,
+  0xc21094364dfb5637ull, 0x9096ea6f3848984full, 0xd77485cb25823ac7ull,
+  0xa086cfcd97bf97f4ull, 0xef340a98172aace5ull, 0xb23867fb2a35b28eull,
+  0x84c8d4dfd2c63f3bull, 0xc5dd44271ad3cdbaull, 0x936b9fcebb25c996ull,
+  0xdbac6c247d62a584ull, 0xa3ab66580d5fdaf6ull, 0xf3e2f893dec3f126ull,
+  0xb5b5ada8aaff80b8ull, 0x87625f056c7c4a8bull, 0xc9bcff6034c13053ull,
+  0x964e858c91ba2655ull, 0xdff9772470297ebdull, 0xa6dfbd9fb8e5b88full,
+  0xf8a95fcf88747d94ull, 0xb94470938fa89bcfull, 0x8a08f0f8bf0f156bull,
+  0xcdb02555653131b6ull, 0x993fe2c6d07b7facull, 0xe45c10c42a2b3b06ull,
+  0xaa242499697392d3ull, 0xfd87b5f28300ca0eull, 0xbce5086492111aebull,
+  0x8cbccc096f5088ccull, 0xd1b71758e219652cull, 0x9c40000000000000ull,
+  0xe8d4a51000000000ull, 0xad78ebc5ac620000ull, 0x813f3978f8940984ull,
+  0xc097ce7bc90715b3ull, 0x8f7e32ce7bea5c70ull, 0xd5d238a4abe98068ull,
+  0x9f4f2726179a2245ull, 0xed63a231d4c4fb27ull, 0xb0de65388cc8ada8ull,
+  0x83c7088e1aab65dbull, 0xc45d1df942711d9aull, 0x924d692ca61be758ull,
+  0xda01ee641a708deaull, 0xa26da3999aef774aull, 0xf209787bb47d6b85ull,
+  0xb454e4a179dd1877ull, 0x865b86925b9bc5c2ull, 0xc83553c5c8965d3dull,
+  0x952ab45cfa97a0b3ull, 0xde469fbd99a05fe3ull, 0xa59bc234db398c25ull,
+  0xf6c69a72a3989f5cull, 0xb7dcbf5354e9beceull, 0x88fcf317f22241e2ull,
+  0xcc20ce9bd35c78a5ull, 0x98165af37b2153dfull, 0xe2a0b5dc971f303aull,
+  0xa8d9d1535ce3b396ull, 0xfb9b7cd9a4a7443cull, 0xbb764c4ca7a44410ull,
+  0x8bab8eefb6409c1aull, 0xd01fef10a657842cull, 0x9b10a4e5e9913129ull,
+  0xe7109bfba19c0c9dull, 0xac2820d9623bf429ull, 0x80444b5e7aa7cf85ull,
+  0xbf21e44003acdd2dull, 0x8e679c2f5e44ff8full, 0xd433179d9c8cb841ull,
+  0x9e19db92b4e31ba9ull, 0xeb96bf6ebadf77d9ull, 0xaf87023b9bf0ee6bull,
+};
+
+static const std::int16_t cachedPowersE[] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954,
+  -927, -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635,
+  -608, -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316,
+  -289, -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30, 56,
+  83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348, 375, 402, 428, 455,
+  481, 508, 534, 561, 588, 614, 641, 667, 694, 720, 747, 774, 800, 827, 853,
+  880, 907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+
+static const std::uint64_t pow10[] = {
+  1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+  100000000ull, 1000000000ull, 10000000000ull, 100000000000ull,
+  1000000000000ull, 10000000000000ull, 100000000000000ull,
+  1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+  1000000000000000000ull, 10000000000000000000ull,
+};
+
+
+// The upper 64 bits of the 128 bit product, rounded.
+static DiyFp _multiply(const DiyFp& x, const DiyFp& y) {
+  const std::uint64_t m32 = 0xffffffffull;
+  std::uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+  std::uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  std::uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32) + (1ull << 31);
+
+  return DiyFp{ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64};
+}
+
+
+static DiyFp _normalize(DiyFp x) {
+  while (!(x.f & 0xffc0000000000000ull)) {
+    x.f <<= 10;
+    x.e -= 10;
+  }
+  while (!(x.f & 0x8000000000000000ull)) {
+    x.f <<= 1;
+    x.e--;
+  }
+
+  return x;
+}
+
+
+// Returns a cached power of ten, c = 10^-k, such that the binary exponent of
+// the product of c and a number with the binary exponent e is in the range
+// [-60, -32]. Sets *pK to k.
+static DiyFp _cachedPower(int e, int *pK) {
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int k = static_cast<int>(dk);
+  if (dk - k > 0.0) {
+    k++;
+  }
+
+  unsigned index = static_cast<unsigned>((k >> 3) + 1);
+  *pK = -(-348 + static_cast<int>(index << 3));
+
+  return DiyFp{cachedPowersF[index], cachedPowersE[index]};
+}
+
+
+static int _countDigits(std::uint32_t n) {
+  int count = 1;
+  while (count < 9 && n >= pow10[count]) {
+    count++;
+  }
+
+  return count;
+}
+
+
+// Moves the last digit closer to w while it stays within the boundaries.
+static void _round(char *digits, int len, std::uint64_t delta,
+  std::uint64_t rest, std::uint64_t tenKappa, std::uint64_t wpw)
+{
+  while (rest < wpw && delta - rest >= tenKappa &&
+    (rest + tenKappa < wpw || wpw - rest > rest + tenKappa - wpw))
+  {
+    digits[len - 1]--;
+    rest += tenKappa;
+  }
+}
+
+
+static void _digitGen(const DiyFp& w, const DiyFp& mp, std::uint64_t delta,
+  char *digits, int *pLen, int *pK)
+{
+  const DiyFp one = {1ull << -mp.e, mp.e};
+  const std::uint64_t wpw = mp.f - w.f;
+  std::uint32_t p1 = static_cast<std::uint32_t>(mp.f >> -one.e);
+  std::uint64_t p2 = mp.f & (one.f - 1);
+  int kappa = _countDigits(p1);
+  *pLen = 0;
+
+  while (kappa > 0) {
+    std::uint32_t div = static_cast<std::uint32_t>(pow10[kappa - 1]);
+    std::uint32_t d = p1 / div;
+    p1 %= div;
+    if (d || *pLen) {
+      digits[(*pLen)++] = static_cast<char>('0' + d);
+    }
+    kappa--;
+    std::uint64_t tmp = (static_cast<std::uint64_t>(p1) << -one.e) + p2;
+    if (tmp <= delta) {
+      *pK += kappa;
+      _round(digits, *pLen, delta, tmp, pow10[kappa] << -one.e, wpw);
+      return;
+    }
+  }
+
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    char d = static_cast<char>(p2 >> -one.e);
+    if (d || *pLen) {
+      digits[(*pLen)++] = static_cast<char>('0' + d);
+    }
+    p2 &= one.f - 1;
+    kappa--;
+    if (p2 < delta) {
+      *pK += kappa;
+      int index = -kappa;
+      _round(digits, *pLen, delta, p2, one.f, wpw * (index < 20 ? pow10[index] : 0));
+      return;
+    }
+  }
+}
+
+
+// Writes at most 17 digits. The value of "d" is digits * 10^(*pK). "d" must
+// be finite and larger than zero.
+static void _grisu2(double d, char *digits, int *pLen, int *pK) {
+  std::uint64_t bits;
+  std::memcpy(&bits, &d, sizeof(bits));
+  int biasedE = static_cast<int>(bits >> 52);
+  std::uint64_t significand = bits & (hiddenBit - 1);
+
+  DiyFp v;
+  if (biasedE) {
+    v = DiyFp{significand + hiddenBit, biasedE - 1075};
+  } else {
+    v = DiyFp{significand, -1074};
+  }
+
+  // The boundaries are halfway to the neighbouring doubles. The lower
+  // neighbour is closer if v is a power of two (and not the smallest normal).
+  DiyFp mp = _normalize(DiyFp{(v.f << 1) + 1, v.e - 1});
+  DiyFp mm = (v.f == hiddenBit && biasedE > 1 ? DiyFp{(v.f << 2) - 1, v.e - 2} :
+    DiyFp{(v.f << 1) - 1, v.e - 1});
+  mm.f <<= mm.e - mp.e;
+  mm.e = mp.e;
+
+  DiyFp c = _cachedPower(mp.e, pK);
+  DiyFp w = _multiply(_normalize(v), c);
+  DiyFp wp = _multiply(mp, c);
+  DiyFp wm = _multiply(mm, c);
+  wm.f++;
+  wp.f--;
+
+  _digitGen(w, wp, wp.f - wm.f, digits, pLen, pK);
+}
+#endif
+
+
+static const char digitPairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+
+// Writes the digits of "u" so that they end at "end". Returns a pointer to
+// the first digit.
+static char* _writeDigits(char *end, std::uint64_t u) {
+  while (u >= 100) {
+    unsigned r = static_cast<unsigned>(u % 100);
+    u /= 100;
+    end -= 2;
+    std::memcpy(end, digitPairs + 2 * r, 2);
+  }
+
+  if (u >= 10) {
+    end -= 2;
+    std::memcpy(end, digitPairs + 2 * u, 2);
+  } else {
+    *--end = static_cast<char>('0' + u);
+  }
+
+  return end;
+}
+
+
+// Writes the shortest representation of "d" that is parsed back to exactly
+// the same double, in the format of std::to_chars(): fixed or scientific
+// notation, whichever is shorter. A decimal point and a zero are added if the
+// output would otherwise look like an integer. "buf" must have room for 32
+// characters. Returns the number of characters written.
+size_t formatDouble(char *buf, double d) {
+  char *p = buf;
+
+  if (std::isnan(d)) {
+    std::memcpy(p, "nan", 3);
+    return 3;
+  }
+  if (std::signbit(d)) {
+    *p++ = '-';
+    d = -d;
+  }
+  if (std::isinf(d)) {
+    std::memcpy(p, "inf", 3);
+    return p + 3 - buf;
+  }
+  if (d == 0) {
+    std::memcpy(p, "0.0", 3);
+    return p + 3 - buf;
+  }
+
+#if HJSON_USE_CHARCONV
+  auto res = std::to_chars(p, buf + 30, d);
+  if (res.ec != std::errc()) {
+    return 0;
+  }
+  p = res.ptr;
+  if (!std::memchr(buf, '.', p - buf) && !std::memchr(buf, 'e', p - buf)) {
+    *p++ = '.';
+    *p++ = '0';
+  }
+#else
+  char digits[18];
+  int len, k;
+  _grisu2(d, digits, &len, &k);
+
+  // The decimal point is after the first "point" digits.
+  int point = len + k;
+  int exp10 = point - 1;
+  int absExp = (exp10 < 0 ? -exp10 : exp10);
+  int sciSize = len + (len > 1) + 2 + (absExp >= 100 ? 3 : 2);
+  int fixedSize = (k >= 0 ? point : point > 0 ? len + 1 : 2 - point + len);
+
+  if (fixedSize <= sciSize) {
+    if (k >= 0) {
+      std::memcpy(p, digits, len);
+      std::memset(p + len, '0', k);
+      p += point;
+      *p++ = '.';
+      *p++ = '0';
+    } else if (point > 0) {
+      std::memcpy(p, digits, point);
+      p += point;
+      *p++ = '.';
+      std::memcpy(p, digits + point, len - point);
+      p += len - point;
+    } else {
+      *p++ = '0';
+      *p++ = '.';
+      std::memset(p, '0', -point);
+      p += -point;
+      std::memcpy(p, digits, len);
+      p += len;
+    }
+  } else {
+    *p++ = digits[0];
+    if (len > 1) {
+      *p++ = '.';
+      std::memcpy(p, digits + 1, len - 1);
+      p += len - 1;
+    }
+    *p++ = 'e';
+    *p++ = (exp10 < 0 ? '-' : '+');
+    if (absExp >= 100) {
+      *p++ = static_cast<char>('0' + absExp / 100);
+      absExp %= 100;
+    }
+    std::memcpy(p, digitPairs + 2 * absExp, 2);
+    p += 2;
+  }
+#endif
+
+  return p - buf;
+}
+
+
+// Writes "i" in decimal form. "buf" must have room for 32 characters. Returns
+// the number of characters written.
+size_t formatInt64(char *buf, std::int64_t i) {
+  char tmp[20];
+  char *end = tmp + sizeof(tmp);
+  std::uint64_t u = static_cast<std::uint64_t>(i);
+  size_t n = 0;
+
+  if (i < 0) {
+    buf[n++] = '-';
+    u = 0 - u;
+  }
+
+  char *first = _writeDigits(end, u);
+  std::memcpy(buf + n, first, end - first);
+
+  return n + (end - first);
+}
+
+
+}
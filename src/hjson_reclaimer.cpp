@@ -0,0 +1,96 @@
+#include "hjson.h"
+#include <vector>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+namespace Hjson {
+
+
+class Reclaimer::Impl {
+public:
+  mutable std::mutex mtx;
+  // Signals the background thread that there are trees to destroy, or that
+  // it should stop.
+  std::condition_variable cvWork;
+  // Signals flush() that the queue has been emptied.
+  std::condition_variable cvIdle;
+  std::vector<Value> queue;
+  // Number of trees that the background thread is destroying right now.
+  size_t busy;
+  bool stop;
+  std::thread thread;
+
+  Impl() : busy(0), stop(false) {}
+
+  void run() {
+    std::vector<Value> batch;
+    std::unique_lock<std::mutex> lock(mtx);
+
+    for (;;) {
+      cvWork.wait(lock, [this] { return stop || !queue.empty(); });
+      if (queue.empty()) {
+        // Only stops when everything has been destroyed.
+        return;
+      }
+
+      batch.swap(queue);
+      busy = batch.size();
+      lock.unlock();
+      // Destroys the trees without holding the lock.
+      batch.clear();
+      lock.lock();
+      busy = 0;
+      if (queue.empty()) {
+        cvIdle.notify_all();
+      }
+    }
+  }
+};
+
+
+Reclaimer::Reclaimer()
+  : prv(new Impl())
+{
+  prv->thread = std::thread(&Impl::run, prv.get());
+}
+
+
+Reclaimer::~Reclaimer() {
+  {
+    std::lock_guard<std::mutex> lock(prv->mtx);
+    prv->stop = true;
+  }
+  prv->cvWork.notify_one();
+  prv->thread.join();
+}
+
+
+void Reclaimer::reclaim(Value& tree) {
+  {
+    std::lock_guard<std::mutex> lock(prv->mtx);
+    // Value(Value&&) would share the tree instead of taking the reference
+    // away from "tree", so the handles are swapped instead. The new element
+    // is Undefined, and that is what "tree" gets in return.
+    prv->queue.emplace_back();
+    std::swap(prv->queue.back().ptr, tree.ptr);
+  }
+  prv->cvWork.notify_one();
+}
+
+
+void Reclaimer::flush() {
+  std::unique_lock<std::mutex> lock(prv->mtx);
+  prv->cvIdle.wait(lock, [this] { return prv->queue.empty() && !prv->busy; });
+}
+
+
+size_t Reclaimer::pending() const {
+  std::lock_guard<std::mutex> lock(prv->mtx);
+  return prv->queue.size() + prv->busy;
+}
+
+
+}
@@ -1,15 +1,24 @@
 #include "hjson.h"
 #include <vector>
+#include <deque>
+#include <unordered_set>
+#include <unordered_map>
+#include <functional>
+#include <type_traits>
+#if !HJSON_SINGLE_THREADED
+# include <atomic>
+#endif
 #include <assert.h>
 #include <cstring>
 #include <algorithm>
+#if HJSON_NODE_POOL
+# include <mutex>
+#endif
 #if HJSON_USE_CHARCONV
 # include <charconv>
-# include <array>
 #elif HJSON_USE_STRTOD
 # include <cstdlib>
 # include <cerrno>
-# include <cstdio>
 #else
 # include <sstream>
 #endif
@@ -18,412 +27,2195 @@
 namespace Hjson {
 
 
-typedef std::vector<std::string> KeyVec;
-typedef std::vector<Value> ValueVec;
-typedef std::map<std::string, Value> ValueMap;
+typedef std::pair<const std::string, Value> MapElem;
 
 
-class ValueVecMap {
-public:
-  KeyVec v;
-  ValueMap m;
-};
-
+size_t formatDouble(char *buf, double d);
+size_t formatInt64(char *buf, std::int64_t i);
 
-class Value::ValueImpl {
-public:
-  Type type;
-  union {
-    bool b;
-    double d;
-    std::int64_t i;
-    std::string *s;
-    ValueVec *v;
-    ValueVecMap *m;
-  };
 
-  ValueImpl();
-  ValueImpl(bool);
-  ValueImpl(double);
-  explicit ValueImpl(std::int64_t);
-  ValueImpl(const std::string&);
-  ValueImpl(Type);
-  ~ValueImpl();
-  static void DeepClear(Value &val);
-};
+// Parses the whole string, which must be null terminated, as a double.
+static bool _parseDouble(double *pRet, const char *pCh, size_t size) {
+#if HJSON_USE_CHARCONV
+  const char *pEnd = pCh + size;
 
+  auto res = std::from_chars(pCh, pEnd, *pRet);
 
-class Value::Comments {
-public:
-  std::string m_commentBefore, m_commentKey, m_commentInside, m_commentAfter;
-};
+  if (res.ec == std::errc::result_out_of_range) {
+    // *pRet is not set. Rejected, same as for strtod.
+    return false;
+  }
 
+  // Also fails for an empty string, then ptr is pEnd but *pRet is not set.
+  return res.ec == std::errc() && res.ptr == pEnd;
+#elif HJSON_USE_STRTOD
+  char *endptr;
+  errno = 0;
 
-Value::ValueImpl::ValueImpl()
-  : type(Type::Undefined)
-{
-}
+  *pRet = std::strtod(pCh, &endptr);
 
+  return !errno && endptr - pCh == size;
+#else
+  std::stringstream ss(std::string(pCh, size));
 
-Value::ValueImpl::ValueImpl(bool input)
-  : type(Type::Bool),
-  b(input)
-{
-}
+  // Make sure we expect dot (not comma) as decimal point.
+  ss.imbue(std::locale::classic());
 
+  ss >> *pRet;
 
-Value::ValueImpl::ValueImpl(double input)
-  : type(Type::Double),
-  d(input)
-{
+  return ss.eof() && !ss.fail();
+#endif
 }
 
 
-Value::ValueImpl::ValueImpl(std::int64_t input)
-  : type(Type::Int64),
-  i(input)
-{
-}
+#if HJSON_NODE_POOL
+// Free lists for the small objects that make up a tree (ValueImpl, Comments,
+// ValueVecMap and PackedVec), one set of lists per thread so that no lock is
+// needed for most allocations. A block is always returned to the free list of
+// the thread that frees it. When a thread has too many free blocks of one
+// size, a batch of them is moved to the shared pool, from where any thread
+// can take the whole batch when its own list is empty.
+static const size_t poolGranularity = 16;
+static const size_t poolClassCount = 16;
+// Number of blocks moved to or from the shared pool at a time.
+static const size_t poolBatch = 128;
 
 
-Value::ValueImpl::ValueImpl(const std::string &input)
-  : type(Type::String),
-  s(new std::string(input))
-{
-}
+struct FreeBlock {
+  FreeBlock *next;
+};
 
 
-Value::ValueImpl::ValueImpl(Type _type)
-  : type(_type)
-{
-  switch (_type)
-  {
-  case Type::String:
-    s = new std::string();
-    break;
-  case Type::Vector:
-    v = new ValueVec();
-    break;
-  case Type::Map:
-    m = new ValueVecMap();
-    break;
-  default:
-    break;
-  }
-}
+struct FreeChain {
+  FreeChain() : head(0), count(0) {}
+  FreeChain(FreeBlock *_head, size_t _count) : head(_head), count(_count) {}
 
+  FreeBlock *head;
+  size_t count;
+};
 
-// Bottom-up destruction in order to avoid stack overflow due to recursive destructor calls.
-void Value::ValueImpl::DeepClear(Value &val) {
-  // The map/vector will only be destroyed if use_count == 1
-  if (val.size() && val.prv.use_count() == 1) {
-    std::vector<std::pair<Value, int> > v;
 
-    v.emplace_back(val, 0);
+class SharedPool {
+public:
+  SharedPool() : bytes(0) {}
 
-    while (!v.empty()) {
-      if (v.back().second >= v.back().first.size()) {
-        v.back().first.clear();
-        v.pop_back();
-      } else {
-        Value &n = v.back().first[v.back().second];
-        v.back().second++;
-        // The map/vector will only be destroyed if use_count == 1
-        if (n.size() && n.prv.use_count() == 1) {
-          v.emplace_back(v.back().first[v.back().second - 1], 0);
-        }
-      }
-    }
-  }
-}
+  std::mutex mtx;
+  std::vector<FreeChain> chains[poolClassCount];
+  size_t bytes;
+};
 
 
-Value::ValueImpl::~ValueImpl() {
-  switch (type)
-  {
-  case Type::String:
-    delete s;
-    break;
-  case Type::Vector:
-    for (auto e = v->begin(); e != v->end(); ++e) {
-      DeepClear(*e);
-    }
-    delete v;
-    break;
-  case Type::Map:
-    for (auto e = m->m.begin(); e != m->m.end(); ++e) {
-      DeepClear(e->second);
-    }
-    delete m;
-    break;
-  default:
-    break;
-  }
+// Never destroyed, since trees in static Value objects can be destroyed after
+// any other static object.
+static SharedPool& _sharedPool() {
+  static SharedPool *pool = new SharedPool();
+  return *pool;
 }
 
 
-// Sacrifice efficiency for predictability: It is allowed to do bracket
-// assignment on an Undefined Value, and thereby turn it into a Map Value.
-// A Map Value is passed by reference, therefore an Undefined Value should also
-// be passed by reference, to avoid surprises when doing bracket assignment
-// on a Value that has been passed around but is still of type Undefined.
-Value::Value()
-  : prv(std::make_shared<ValueImpl>(Type::Undefined))
-{
+static void _freeChain(FreeChain chain) {
+  while (chain.head) {
+    FreeBlock *next = chain.head->next;
+    ::operator delete(chain.head);
+    chain.head = next;
+  }
 }
 
 
-Value::Value(bool input)
-  : prv(std::make_shared<ValueImpl>(input))
-{
-}
+// Set when the LocalPool of this thread has been destroyed. Blocks freed
+// after that (by the destructors of other thread_local or static objects) go
+// directly to the global operator delete.
+static thread_local bool tlsPoolDestroyed = false;
 
 
-Value::Value(float input)
-  : prv(std::make_shared<ValueImpl>(static_cast<double>(input)))
-{
-}
+class LocalPool {
+public:
+  FreeChain lists[poolClassCount];
+  std::uint64_t allocations, hits;
+
+  LocalPool() : allocations(0), hits(0) {}
+
+  ~LocalPool() {
+    tlsPoolDestroyed = true;
+    SharedPool &shared = _sharedPool();
+    std::lock_guard<std::mutex> lock(shared.mtx);
+    for (size_t cls = 0; cls < poolClassCount; ++cls) {
+      if (lists[cls].head) {
+        shared.chains[cls].push_back(lists[cls]);
+        shared.bytes += lists[cls].count * (cls + 1) * poolGranularity;
+      }
+    }
+  }
+};
 
 
-Value::Value(double input)
-  : prv(std::make_shared<ValueImpl>(input))
-{
-}
+static thread_local LocalPool tlsPool;
 
 
-Value::Value(long double input)
-  : prv(std::make_shared<ValueImpl>(static_cast<double>(input)))
-{
-}
+static void *_poolAlloc(size_t size) {
+  size_t cls = (size + poolGranularity - 1) / poolGranularity - 1;
+  if (cls >= poolClassCount) {
+    return ::operator new(size);
+  }
+  if (tlsPoolDestroyed) {
+    return ::operator new((cls + 1) * poolGranularity);
+  }
 
+  LocalPool &local = tlsPool;
+  FreeChain &list = local.lists[cls];
+  ++local.allocations;
+
+  if (!list.head) {
+    SharedPool &shared = _sharedPool();
+    std::lock_guard<std::mutex> lock(shared.mtx);
+    if (!shared.chains[cls].empty()) {
+      list = shared.chains[cls].back();
+      shared.chains[cls].pop_back();
+      shared.bytes -= list.count * (cls + 1) * poolGranularity;
+    }
+  }
 
-Value::Value(char input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
-{
-}
+  if (!list.head) {
+    return ::operator new((cls + 1) * poolGranularity);
+  }
 
+  ++local.hits;
+  FreeBlock *block = list.head;
+  list.head = block->next;
+  --list.count;
 
-Value::Value(unsigned char input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
-{
+  return block;
 }
 
 
-Value::Value(short input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
-{
-}
-
+static void _poolFree(void *p, size_t size) {
+  size_t cls = (size + poolGranularity - 1) / poolGranularity - 1;
+  if (cls >= poolClassCount || tlsPoolDestroyed) {
+    ::operator delete(p);
+    return;
+  }
 
-Value::Value(unsigned short input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
-{
+  FreeChain &list = tlsPool.lists[cls];
+  FreeBlock *block = static_cast<FreeBlock*>(p);
+  block->next = list.head;
+  list.head = block;
+  ++list.count;
+
+  if (list.count >= 2 * poolBatch) {
+    // Keep the most recently freed blocks, since they are the most likely to
+    // still be in the cache of this thread, and move the rest.
+    FreeBlock *last = list.head;
+    for (size_t a = 1; a < list.count - poolBatch; ++a) {
+      last = last->next;
+    }
+    FreeChain batch(last->next, poolBatch);
+    last->next = 0;
+    list.count -= poolBatch;
+
+    SharedPool &shared = _sharedPool();
+    std::lock_guard<std::mutex> lock(shared.mtx);
+    shared.chains[cls].push_back(batch);
+    shared.bytes += poolBatch * (cls + 1) * poolGranularity;
+  }
 }
 
 
-Value::Value(int input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
-{
-}
-
+PoolStats GetPoolStats() {
+  PoolStats ret;
 
-Value::Value(unsigned int input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
-{
-}
+  if (!tlsPoolDestroyed) {
+    ret.allocations = tlsPool.allocations;
+    ret.hits = tlsPool.hits;
+    for (size_t cls = 0; cls < poolClassCount; ++cls) {
+      ret.localBytes += tlsPool.lists[cls].count * (cls + 1) * poolGranularity;
+    }
+  }
 
+  SharedPool &shared = _sharedPool();
+  std::lock_guard<std::mutex> lock(shared.mtx);
+  ret.sharedBytes = shared.bytes;
 
-Value::Value(long input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
-{
+  return ret;
 }
 
 
-Value::Value(unsigned long input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
-{
-}
-
+void TrimPools() {
+  if (!tlsPoolDestroyed) {
+    for (size_t cls = 0; cls < poolClassCount; ++cls) {
+      _freeChain(tlsPool.lists[cls]);
+      tlsPool.lists[cls] = FreeChain();
+    }
+  }
 
-Value::Value(long long input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
-{
+  SharedPool &shared = _sharedPool();
+  std::lock_guard<std::mutex> lock(shared.mtx);
+  for (size_t cls = 0; cls < poolClassCount; ++cls) {
+    for (auto chain : shared.chains[cls]) {
+      _freeChain(chain);
+    }
+    shared.chains[cls].clear();
+  }
+  shared.bytes = 0;
 }
 
-
-Value::Value(unsigned long long input)
-  : prv(std::make_shared<ValueImpl>(static_cast<std::int64_t>(input)))
-{
+#else
+static void *_poolAlloc(size_t size) {
+  return ::operator new(size);
 }
 
 
-Value::Value(const char *input)
-  : prv(std::make_shared<ValueImpl>(std::string(input)))
-{
+static void _poolFree(void *p, size_t) {
+  ::operator delete(p);
 }
 
 
-Value::Value(const std::string& input)
-  : prv(std::make_shared<ValueImpl>(input))
-{
+PoolStats GetPoolStats() {
+  return PoolStats();
 }
 
 
-Value::Value(Type _type)
-  : prv(std::make_shared<ValueImpl>(_type))
-{
+void TrimPools() {
 }
+#endif
 
 
-Value::Value(const Value& other)
-  : prv(other.prv)
-{
-  if (other.cm) {
-    // Clone the comments instead of sharing the reference. This way a change
-    // in the other Value does not affect the comments in this Value.
-    cm.reset(new Comments(*other.cm));
-  }
-}
+// The resource set by the innermost MemoryResourceScope of this thread.
+static thread_local MemoryResource *tlsResource = 0;
+// Each block allocated from a MemoryResource starts with a pointer to the
+// resource, so that the block can be returned to it.
+static const size_t resourceHeader = alignof(std::max_align_t);
 
 
-Value::Value(Value&& other)
-  : prv(other.prv),
-    cm(other.cm)
-{
+// Round up so that every block is aligned for any type.
+static size_t _arenaSize(size_t bytes) {
+  return (bytes + resourceHeader - 1) / resourceHeader * resourceHeader;
 }
 
 
-// Even though the MapProxy is temporary, it contains references that are owned
-// by a non-temporary object. Make sure the lvalue constructor is called.
-Value::Value(MapProxy&& other)
-  : Value(other)
+MemoryResourceScope::MemoryResourceScope(MemoryResource *resource)
+  : previous(tlsResource)
 {
+  tlsResource = resource;
 }
 
 
-Value::Value(std::shared_ptr<ValueImpl> _prv, std::shared_ptr<Comments> _cm)
-  : prv(_prv),
-    cm(_cm)
-{
+MemoryResourceScope::~MemoryResourceScope() {
+  tlsResource = previous;
 }
 
 
-Value::~Value() {
+MemoryResource *MemoryResourceScope::current() {
+  return tlsResource;
 }
 
 
-Value& Value::operator=(const Value& other) {
-  // So that comments are kept when assigning a Value to a new key in a map,
-  // or to a variable that has not been assigned any other value yet.
-  if (!this->defined()) {
-    this->set_comments(other);
+static void *_nodeAlloc(size_t size, MemoryResource *res) {
+  if (!res) {
+    return _poolAlloc(size);
   }
 
-  this->prv = other.prv;
+  char *p = static_cast<char*>(res->allocate(size + resourceHeader,
+    resourceHeader));
+  memcpy(p, &res, sizeof(res));
 
-  return *this;
+  return p + resourceHeader;
 }
 
 
-Value& Value::operator=(Value&& other) {
-  // So that comments are kept when assigning a Value to a new key in a map,
-  // or to a variable that has not been assigned any other value yet.
-  if (!this->defined()) {
-    this->cm = other.cm;
+static void _nodeFree(void *p, size_t size, MemoryResource *res) {
+  if (!res) {
+    _poolFree(p, size);
+    return;
   }
 
-  this->prv = other.prv;
-
-  return *this;
+  res->deallocate(static_cast<char*>(p) - resourceHeader,
+    size + resourceHeader, resourceHeader);
 }
 
 
-const Value& Value::at(const std::string& name) const {
-  switch (prv->type)
-  {
-  case Type::Undefined:
-    throw index_out_of_bounds("Key not found.");
-  case Type::Map:
-    try {
-      return prv->m->m.at(name);
-    } catch(const std::out_of_range&) {}
-    throw index_out_of_bounds("Key not found.");
-  default:
-    throw type_mismatch("Must be of type Map for that operation.");
-  }
+// The resource of a block allocated by _nodeAlloc() from a resource.
+static MemoryResource *_nodeResource(const void *p) {
+  MemoryResource *res;
+  memcpy(&res, static_cast<const char*>(p) - resourceHeader, sizeof(res));
+  return res;
 }
 
 
-Value& Value::at(const std::string& name) {
-  switch (prv->type)
-  {
-  case Type::Undefined:
-    throw index_out_of_bounds("Key not found.");
-  case Type::Map:
-    try {
-      return prv->m->m.at(name);
-    } catch(const std::out_of_range&) {}
-    throw index_out_of_bounds("Key not found.");
-  default:
-    throw type_mismatch("Must be of type Map for that operation.");
+// For objects owned by a ValueImpl, which are allocated from the same
+// resource as the ValueImpl.
+template<class T, class... Args>
+static T *_create(MemoryResource *res, Args&&... args) {
+  void *p = _nodeAlloc(sizeof(T), res);
+  try {
+    return ::new(p) T(std::forward<Args>(args)...);
+  } catch (...) {
+    _nodeFree(p, sizeof(T), res);
+    throw;
   }
 }
 
 
-const Value& Value::at(const char *name) const {
-  return at(std::string(name));
+template<class T>
+static void _destroy(MemoryResource *res, T *p) {
+  if (p) {
+    p->~T();
+    _nodeFree(p, sizeof(T), res);
+  }
 }
 
 
-Value& Value::at(const char *name) {
-  return at(std::string(name));
-}
+// Allocator for the standard containers used inside a ValueImpl. Uses the
+// global operator new if the resource is null.
+template<class T>
+class ResourceAllocator {
+public:
+  typedef T value_type;
 
+  ResourceAllocator(MemoryResource *_res = 0) : res(_res) {}
+  template<class U>
+  ResourceAllocator(const ResourceAllocator<U> &other) : res(other.res) {}
 
-const Value Value::operator[](const std::string& name) const {
-  if (prv->type == Type::Undefined) {
-    return Value();
-  } else if (prv->type == Type::Map) {
-    auto it = prv->m->m.find(name);
-    if (it == prv->m->m.end()) {
-      return Value();
+  T *allocate(size_t n) {
+    if (!res) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T*>(res->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *p, size_t n) {
+    if (!res) {
+      ::operator delete(p);
+    } else {
+      res->deallocate(p, n * sizeof(T), alignof(T));
     }
-    return it->second;
   }
 
-  throw type_mismatch("Must be of type Undefined or Map for that operation.");
-}
-
+  MemoryResource *res;
+};
 
-MapProxy Value::operator[](const std::string& name) {
-  if (prv->type == Type::Undefined) {
-    prv->~ValueImpl();
-    // Recreate the private object using the same memory block.
-    new(&(*prv)) ValueImpl(Type::Map);
-  } else if (prv->type != Type::Map) {
-    throw type_mismatch("Must be of type Undefined or Map for that operation.");
-  }
 
-  auto it = prv->m->m.find(name);
-  if (it == prv->m->m.end()) {
-    return MapProxy(prv, name, 0);
-  }
-  return MapProxy(prv, name, &it->second);
+template<class T, class U>
+static bool operator==(const ResourceAllocator<T> &a,
+  const ResourceAllocator<U> &b)
+{
+  return a.res == b.res;
 }
 
 
-const Value Value::operator[](const char *input) const {
-  return operator[](std::string(input));
+template<class T, class U>
+static bool operator!=(const ResourceAllocator<T> &a,
+  const ResourceAllocator<U> &b)
+{
+  return a.res != b.res;
 }
 
 
-MapProxy Value::operator[](const char *input) {
-  return operator[](std::string(input));
-}
+typedef std::basic_string<char, std::char_traits<char>,
+  ResourceAllocator<char> > ResourceString;
+typedef std::vector<Value, ResourceAllocator<Value> > ValueVec;
 
 
-const Value Value::operator[](char *input) const {
-  return operator[](std::string(input));
+// Used for all map keys instead of std::hash<std::string>, so that a key can
+// be hashed without first being copied into a std::string. Mixes 8 bytes at a
+// time and finishes with the MurmurHash3 finalizer, since ValueVecMap uses the
+// lowest bits of the hash.
+static size_t hashKey(const char *key, size_t keySize) {
+  std::uint64_t h = 0x9e3779b97f4a7c15ULL ^ keySize;
+
+  while (keySize >= 8) {
+    std::uint64_t w;
+    memcpy(&w, key, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+    key += 8;
+    keySize -= 8;
+  }
+  if (keySize) {
+    std::uint64_t w = 0;
+    memcpy(&w, key, keySize);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+  }
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  return static_cast<size_t>(h);
+}
+
+
+// Hash map that keeps the insertion order of its elements. The elements are
+// stored in blocks that never move, so pointers and references to an element
+// stay valid until that element is erased. The hash table uses open addressing
+// with linear probing and stores the hash of each key, so that most probes
+// don't need any string comparison. Erasing an element leaves a null pointer
+// (tombstone) in the insertion order vector, which is compacted by erase()
+// when there are more tombstones than elements. The alphabetical order, and
+// the insertion order without tombstones, are only created when they are
+// needed. None of the const functions change anything that other threads
+// might read at the same time, except that those two vectors are published
+// once with an atomic pointer (like PackedVec::mirror), so a map can be read
+// from many threads without locks.
+class ValueVecMap {
+public:
+  typedef std::vector<MapElem*, ResourceAllocator<MapElem*> > ElemVec;
+
+  explicit ValueVecMap(MemoryResource *res);
+  ~ValueVecMap();
+
+  size_t size() const { return count; }
+  // Returns null if the key is not found.
+  MapElem *find(const std::string &key) const;
+  // The hash must have been created by hashKey().
+  MapElem *find(const char *key, size_t keySize, size_t hash) const;
+  // Returns the existing element if the key already exists.
+  MapElem *emplace(const std::string &key, Value &&val);
+  MapElem *emplace(std::string &&key, Value &&val);
+  void reserve(size_t capacity);
+  bool erase(const std::string &key);
+  void clear();
+  // The element at the insertion index, which must be less than size().
+  MapElem *at(size_t index) const;
+  // Same semantics as Value::move().
+  void move(size_t from, size_t to);
+
+  // All elements in insertion order.
+  const ElemVec& order() const;
+  // All elements in alphabetical key order.
+  const ElemVec& sorted() const;
+  // Bytes allocated by the map, not counting the keys and values.
+  size_t memory_usage() const;
+  // Bytes that a new map allocates from a CompactArena for reserve(count)
+  // followed by count insertions. The blocks of dqStorage are estimated,
+  // since their sizes depend on the standard library.
+  static size_t arenaBytes(size_t count);
+
+private:
+  struct Bucket {
+    size_t hash;
+    // Null if the bucket is empty.
+    MapElem *elem;
+    // Index in vOrder.
+    size_t orderIndex;
+  };
+  typedef std::aligned_storage<sizeof(MapElem), alignof(MapElem)>::type Storage;
+
+  size_t _findBucket(const char *key, size_t keySize, size_t hash) const;
+  template<class K>
+  MapElem *_emplace(K &&key, Value &&val);
+  void _rehash(size_t capacity);
+  // Removes the tombstones from vOrder.
+  void _compact();
+  // Must be called by every function that changes vOrder.
+  void _invalidateCaches();
+
+  typedef std::vector<Bucket, ResourceAllocator<Bucket> > BucketVec;
+#if HJSON_SINGLE_THREADED
+  typedef ElemVec *ElemVecPtr;
+#else
+  typedef std::atomic<ElemVec*> ElemVecPtr;
+#endif
+
+  static const ElemVec& _publish(ElemVecPtr &target, ElemVec *created);
+
+  BucketVec vBuckets;
+  ElemVec vOrder;
+  // Null until order() or sorted() is called after a change. Never use the
+  // MemoryResource of the map, since they can be created by any thread.
+  mutable ElemVecPtr pDense;
+  mutable ElemVecPtr pSorted;
+  std::deque<Storage, ResourceAllocator<Storage> > dqStorage;
+  ElemVec vFree;
+  size_t count;
+};
+
+
+// Storage for a Vector where all elements are of type Int64, or all of type
+// Double, and have no comments. See ValueImpl::packed.
+struct PackedVec {
+  explicit PackedVec(MemoryResource *res)
+    : vi(ResourceAllocator<std::int64_t>(res)),
+    vd(ResourceAllocator<double>(res)),
+    mirror(0)
+  {
+  }
+  ~PackedVec() { _destroy<ValueVec>(0, mirror); }
+
+  // Only the one matching ValueImpl::packed is used.
+  std::vector<std::int64_t, ResourceAllocator<std::int64_t> > vi;
+  std::vector<double, ResourceAllocator<double> > vd;
+  // Frozen Value objects for the elements, created the first time an element
+  // is accessed through the const bracket operator, and freed when the
+  // numbers are changed. Can be created by many threads at the same time for
+  // a frozen Vector, so it is only set once per change, and it never uses the
+  // MemoryResource of the Vector, which might not be thread safe.
+#if HJSON_SINGLE_THREADED
+  ValueVec *mirror;
+#else
+  std::atomic<ValueVec*> mirror;
+#endif
+};
+
+
+class Value::ValueImpl {
+public:
+  static void *operator new(size_t size) {
+    return _nodeAlloc(size, tlsResource);
+  }
+  // Only called if a constructor throws, when tlsResource is still the same.
+  // Otherwise destroy() is used.
+  static void operator delete(void *p, size_t size) {
+    _nodeFree(p, size, tlsResource);
+  }
+
+  // Strings of up to this many bytes are stored in "sso" instead of "s", to
+  // avoid one allocation and one pointer hop.
+  static const size_t maxShortString = 23;
+  // Value of sso[maxShortString] when the string is stored in "s".
+  static const char longString = -1;
+  // A short string of up to this many bytes that contains a decimal number
+  // also stores the number after the null terminator, so that to_double()
+  // and to_int64() don't need to parse the text on each call. The text is
+  // parsed by the first such call after the string was changed. Until then,
+  // sso[numberTypeIndex] is numberUnknown. Otherwise it is the type of the
+  // stored number (Int64, Double, or Undefined if there is none), followed
+  // by the number itself, or numberBusy while the number is being stored.
+  static const size_t maxNumberString = 13;
+  static const size_t numberTypeIndex = 14;
+  static const char numberUnknown = -1;
+  static const char numberBusy = -2;
+
+#if HJSON_SINGLE_THREADED
+  std::uint32_t refCount;
+#else
+  std::atomic<std::uint32_t> refCount;
+#endif
+  Type type;
+  // Set by Value::freeze().
+  bool frozen;
+  // For type Vector: Int64 or Double if the elements are stored in "pv",
+  // Undefined if they are stored in "v". For type Int64 or Double: Vector if
+  // this is an element in the mirror of a packed Vector that was not frozen
+  // when the mirror was created, see copyOnWrite().
+  Type packed;
+  // True if allocated from a MemoryResource. Then "rs" is used instead of
+  // "s" for long strings.
+  bool external;
+  union {
+    bool b;
+    double d;
+    std::int64_t i;
+    std::string *s;
+    ResourceString *rs;
+    ValueVec *v;
+    PackedVec *pv;
+    ValueVecMap *m;
+    // For a short string, the last byte holds the number of unused bytes. It
+    // is 0 when the buffer is full, so it then also acts as null terminator.
+    char sso[maxShortString + 1];
+  };
+
+  ValueImpl();
+  ValueImpl(bool);
+  ValueImpl(double);
+  explicit ValueImpl(std::int64_t);
+  ValueImpl(const std::string&);
+  ValueImpl(std::string&&);
+  ValueImpl(Type);
+  ~ValueImpl();
+  static void destroy(ValueImpl *p) {
+    MemoryResource *res = p->resource();
+    p->~ValueImpl();
+    _nodeFree(p, sizeof(ValueImpl), res);
+  }
+  static void DeepClear(Value &val);
+  // The resource used for everything this ValueImpl owns.
+  MemoryResource *resource() const {
+    return external ? _nodeResource(this) : 0;
+  }
+
+#if HJSON_SINGLE_THREADED
+  ValueImpl *addRef() {
+    ++refCount;
+    return this;
+  }
+  static void release(ValueImpl *p) {
+    if (--p->refCount == 0) {
+      destroy(p);
+    }
+  }
+#else
+  ValueImpl *addRef() {
+    refCount.fetch_add(1, std::memory_order_relaxed);
+    return this;
+  }
+  static void release(ValueImpl *p) {
+    if (p->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      destroy(p);
+    }
+  }
+#endif
+  // Replaces the content with an empty Value of the specified type, keeping
+  // the reference count.
+  void recreate(Type);
+  // Returns a new mutable ValueImpl with the same content as this one. The
+  // child elements of a Vector or Map are shared, not cloned.
+  ValueImpl *shallowCopy() const;
+  // Returns a deep copy of the tree, where each node is directly followed by
+  // its children and no container has unused capacity. Nodes that are shared
+  // within the tree are shared within the copy too.
+  ValueImpl *compactCopy() const;
+  // The bytes that compactCopy() allocates from a CompactArena, found
+  // without copying anything. Exact except for the storage blocks of Maps.
+  size_t compactSize() const;
+  // If the element is frozen, makes it point to a mutable shallow copy
+  // instead, keeping its comments. Used by the non-const accessors of mutable
+  // containers, so that frozen subtrees shared by clone() are copied on write.
+  static void thaw(Value &elem) {
+    if (elem.prv()->frozen) {
+      ValueImpl *copy = elem.prv()->shallowCopy();
+      elem._setImpl(copy);
+      release(copy);
+    }
+  }
+  // An element in the mirror of a packed Vector is frozen, since it is shared
+  // by all threads that read the Vector, but the Vector itself might not be
+  // frozen. A Value that points to such an element gets a mutable copy of it
+  // instead of throwing frozen_error when it is changed, see
+  // Value::_checkMutable().
+  bool copyOnWrite() const {
+    return packed == Type::Vector;
+  }
+  void checkMutable() const {
+    if (frozen) {
+      throw frozen_error("The Value is frozen.");
+    }
+  }
+
+  // Only valid for type Vector.
+  size_t vec_size() const {
+    switch (packed) {
+    case Type::Int64:
+      return pv->vi.size();
+    case Type::Double:
+      return pv->vd.size();
+    default:
+      return v->size();
+    }
+  }
+  // The elements of a Vector, for reading. Creates the mirror of a packed
+  // Vector if needed.
+  const ValueVec& vec_const() const;
+  // The elements of a Vector, for writing. Converts a packed Vector to
+  // ordinary Value objects.
+  ValueVec& vec() {
+    if (packed != Type::Undefined) {
+      unpack();
+    }
+    return *v;
+  }
+  void vec_push(Value &&elem);
+  // Frees the mirror of a packed Vector, which must be done before the
+  // numbers are changed. Values that refer to elements in the mirror keep
+  // those elements alive, and they are still copied on write.
+  void vec_forget_mirror() {
+    ValueVec *mirror = pv->mirror;
+    if (mirror) {
+      pv->mirror = 0;
+      _destroy(static_cast<MemoryResource*>(0), mirror);
+    }
+  }
+  // True if this is the last owner of a Vector or Map containing Value
+  // objects.
+  bool ownsChildren() const {
+    return refCount == 1 && ((type == Type::Vector &&
+      packed == Type::Undefined && !v->empty()) ||
+      (type == Type::Map && m->size()));
+  }
+  // Changes an empty unpacked Vector to a packed Vector of the type.
+  void pack(Type);
+  void unpack();
+
+  // Only valid for type String. str_data() is null terminated.
+  const char *str_data() const {
+    return sso[maxShortString] != longString ? sso :
+      (external ? rs->c_str() : s->c_str());
+  }
+  size_t str_size() const {
+    return sso[maxShortString] != longString ?
+      maxShortString - sso[maxShortString] :
+      (external ? rs->size() : s->size());
+  }
+  std::string str() const {
+    return std::string(str_data(), str_size());
+  }
+  void str_assign(const char *data, size_t size);
+  void str_append(const char *data, size_t size);
+  // Must be called whenever a short string has been changed.
+  void str_forget_number() {
+    if (str_size() <= maxNumberString) {
+      sso[numberTypeIndex] = numberUnknown;
+    }
+  }
+  // Returns Int64 or Double and sets *pI or *pD if this is a short String
+  // that contains a plain decimal number, otherwise returns Undefined.
+  Type str_number(std::int64_t *pI, double *pD) const;
+  int str_compare(const ValueImpl &other) const;
+};
+
+
+class Value::Comments {
+public:
+  // Allocated from the current MemoryResource, like ValueImpl.
+  static void *operator new(size_t size) {
+    return _nodeAlloc(size, tlsResource);
+  }
+  static void operator delete(void *p, size_t size) {
+    _nodeFree(p, size, tlsResource);
+  }
+
+  Comments(ValueImpl *_node)
+    : refCount(1),
+    external(tlsResource != 0),
+    node(_node)
+  {
+  }
+
+  static void destroy(Comments *p) {
+    MemoryResource *res = (p->external ? _nodeResource(p) : 0);
+    p->~Comments();
+    _nodeFree(p, sizeof(Comments), res);
+  }
+
+  // Only more than 1 while a MapProxy refers to these comments.
+  int refCount;
+  bool external;
+  // Owns one reference to the ValueImpl.
+  ValueImpl *node;
+  std::string m_commentBefore, m_commentKey, m_commentInside, m_commentAfter;
+};
+
+
+ValueVecMap::ValueVecMap(MemoryResource *res)
+  : vBuckets(ResourceAllocator<Bucket>(res)),
+  vOrder(ResourceAllocator<MapElem*>(res)),
+  pDense(0),
+  pSorted(0),
+  dqStorage(ResourceAllocator<Storage>(res)),
+  vFree(ResourceAllocator<MapElem*>(res)),
+  count(0)
+{
+}
+
+
+ValueVecMap::~ValueVecMap() {
+  clear();
+}
+
+
+size_t ValueVecMap::_findBucket(const char *key, size_t keySize,
+  size_t hash) const
+{
+  if (vBuckets.empty()) {
+    return SIZE_MAX;
+  }
+
+  size_t mask = vBuckets.size() - 1;
+  for (size_t a = hash & mask;; a = (a + 1) & mask) {
+    const Bucket &b = vBuckets[a];
+    if (!b.elem) {
+      return SIZE_MAX;
+    }
+    if (b.hash == hash && b.elem->first.size() == keySize &&
+      !memcmp(b.elem->first.data(), key, keySize))
+    {
+      return a;
+    }
+  }
+}
+
+
+void ValueVecMap::_rehash(size_t capacity) {
+  BucketVec old(capacity, Bucket(), vBuckets.get_allocator());
+  old.swap(vBuckets);
+
+  size_t mask = capacity - 1;
+  for (const auto &b : old) {
+    if (b.elem) {
+      size_t a = b.hash & mask;
+      while (vBuckets[a].elem) {
+        a = (a + 1) & mask;
+      }
+      vBuckets[a] = b;
+    }
+  }
+}
+
+
+void ValueVecMap::_compact() {
+  std::vector<size_t> newIndex(vOrder.size());
+  size_t n = 0;
+  for (size_t a = 0; a < vOrder.size(); ++a) {
+    newIndex[a] = n;
+    if (vOrder[a]) {
+      vOrder[n++] = vOrder[a];
+    }
+  }
+  vOrder.resize(n);
+
+  for (auto &b : vBuckets) {
+    if (b.elem) {
+      b.orderIndex = newIndex[b.orderIndex];
+    }
+  }
+}
+
+
+void ValueVecMap::_invalidateCaches() {
+  ElemVec *dense = pDense;
+  if (dense) {
+    pDense = 0;
+    _destroy(static_cast<MemoryResource*>(0), dense);
+  }
+  ElemVec *sorted = pSorted;
+  if (sorted) {
+    pSorted = 0;
+    _destroy(static_cast<MemoryResource*>(0), sorted);
+  }
+}
+
+
+// Can be called by many threads at the same time for the same target.
+const ValueVecMap::ElemVec& ValueVecMap::_publish(ElemVecPtr &target,
+  ElemVec *created)
+{
+#if HJSON_SINGLE_THREADED
+  target = created;
+#else
+  ElemVec *expected = 0;
+  if (!target.compare_exchange_strong(expected, created)) {
+    // Another thread was faster.
+    _destroy(static_cast<MemoryResource*>(0), created);
+    return *expected;
+  }
+#endif
+
+  return *created;
+}
+
+
+MapElem *ValueVecMap::find(const std::string &key) const {
+  return find(key.data(), key.size(), hashKey(key.data(), key.size()));
+}
+
+
+MapElem *ValueVecMap::find(const char *key, size_t keySize, size_t hash) const {
+  size_t a = _findBucket(key, keySize, hash);
+  return a == SIZE_MAX ? 0 : vBuckets[a].elem;
+}
+
+
+MapElem *ValueVecMap::emplace(const std::string &key, Value &&val) {
+  return _emplace(key, std::move(val));
+}
+
+
+MapElem *ValueVecMap::emplace(std::string &&key, Value &&val) {
+  return _emplace(std::move(key), std::move(val));
+}
+
+
+void ValueVecMap::reserve(size_t capacity) {
+  size_t buckets = vBuckets.empty() ? 8 : vBuckets.size();
+  while (capacity * 4 > buckets * 3) {
+    buckets *= 2;
+  }
+  if (buckets > vBuckets.size()) {
+    _rehash(buckets);
+  }
+  vOrder.reserve(capacity);
+}
+
+
+// "key" is only moved from if the element is inserted.
+template<class K>
+MapElem *ValueVecMap::_emplace(K &&key, Value &&val) {
+  size_t hash = hashKey(key.data(), key.size());
+  size_t a = _findBucket(key.data(), key.size(), hash);
+  if (a != SIZE_MAX) {
+    return vBuckets[a].elem;
+  }
+
+  // Keep the load factor below 3/4.
+  if ((count + 1) * 4 > vBuckets.size() * 3) {
+    _rehash(vBuckets.empty() ? 8 : vBuckets.size() * 2);
+  }
+  MapElem *elem;
+  if (vFree.empty()) {
+    dqStorage.emplace_back();
+    elem = reinterpret_cast<MapElem*>(&dqStorage.back());
+  } else {
+    elem = vFree.back();
+    vFree.pop_back();
+  }
+  try {
+    new(elem) MapElem(std::forward<K>(key), std::move(val));
+  } catch (...) {
+    vFree.push_back(elem);
+    throw;
+  }
+
+  size_t mask = vBuckets.size() - 1;
+  a = hash & mask;
+  while (vBuckets[a].elem) {
+    a = (a + 1) & mask;
+  }
+  vBuckets[a].hash = hash;
+  vBuckets[a].elem = elem;
+  vBuckets[a].orderIndex = vOrder.size();
+  vOrder.push_back(elem);
+  ++count;
+  _invalidateCaches();
+
+  return elem;
+}
+
+
+bool ValueVecMap::erase(const std::string &key) {
+  size_t a = _findBucket(key.data(), key.size(),
+    hashKey(key.data(), key.size()));
+  if (a == SIZE_MAX) {
+    return false;
+  }
+
+  MapElem *elem = vBuckets[a].elem;
+  vOrder[vBuckets[a].orderIndex] = 0;
+
+  // Backward shift deletion, so that the hash table never contains any
+  // tombstones. A bucket can be moved to the empty slot if the empty slot is
+  // not before the home bucket of its hash.
+  size_t mask = vBuckets.size() - 1;
+  size_t b = a;
+  for (;;) {
+    b = (b + 1) & mask;
+    if (!vBuckets[b].elem) {
+      break;
+    }
+    size_t home = vBuckets[b].hash & mask;
+    if (((b - home) & mask) >= ((b - a) & mask)) {
+      vBuckets[a] = vBuckets[b];
+      a = b;
+    }
+  }
+  vBuckets[a].elem = 0;
+  --count;
+  _invalidateCaches();
+
+  // Don't let the tombstones grow without limit. Compacting only when they
+  // outnumber the elements keeps the cost per erase constant on average.
+  if (vOrder.size() - count > count) {
+    _compact();
+  }
+
+  // Must be done last, since "key" might be a reference to elem->first.
+  elem->~MapElem();
+  vFree.push_back(elem);
+
+  return true;
+}
+
+
+void ValueVecMap::clear() {
+  for (auto elem : vOrder) {
+    if (elem) {
+      elem->~MapElem();
+    }
+  }
+  vOrder.clear();
+  _invalidateCaches();
+  vBuckets.clear();
+  dqStorage.clear();
+  vFree.clear();
+  count = 0;
+}
+
+
+size_t ValueVecMap::memory_usage() const {
+  const ElemVec *dense = pDense;
+  const ElemVec *sorted = pSorted;
+  return sizeof(ValueVecMap) + vBuckets.capacity() * sizeof(Bucket) +
+    (vOrder.capacity() + vFree.capacity()) * sizeof(MapElem*) +
+    (dense ? sizeof(ElemVec) + dense->capacity() * sizeof(MapElem*) : 0) +
+    (sorted ? sizeof(ElemVec) + sorted->capacity() * sizeof(MapElem*) : 0) +
+    dqStorage.size() * sizeof(Storage);
+}
+
+
+size_t ValueVecMap::arenaBytes(size_t count) {
+  size_t buckets = 8;
+  while (count * 4 > buckets * 3) {
+    buckets *= 2;
+  }
+  size_t ret = _arenaSize(sizeof(ValueVecMap) + resourceHeader) +
+    _arenaSize(buckets * sizeof(Bucket)) +
+    (count ? _arenaSize(count * sizeof(MapElem*)) : 0);
+
+  // Follows how libstdc++ grows a deque at the back: blocks of about 512
+  // bytes, and an array of pointers to the blocks that starts with 8
+  // pointers, is recentered if it is less than half full, and otherwise
+  // reallocated with about twice the size.
+  size_t perBlock = std::max<size_t>(1, 512 / sizeof(Storage));
+  size_t blocks = count / perBlock + 1;
+  ret += blocks * _arenaSize(perBlock * sizeof(Storage));
+  size_t pointers = 8, first = 3;
+  ret += _arenaSize(pointers * sizeof(void*));
+  for (size_t used = 1; used < blocks; ++used) {
+    if (first + used == pointers) {
+      if (pointers <= 2 * (used + 1)) {
+        pointers = pointers * 2 + 2;
+        ret += _arenaSize(pointers * sizeof(void*));
+      }
+      first = (pointers - used - 1) / 2;
+    }
+  }
+
+  return ret;
+}
+
+
+const ValueVecMap::ElemVec& ValueVecMap::order() const {
+  if (vOrder.size() == count) {
+    return vOrder;
+  }
+
+  const ElemVec *dense = pDense;
+  if (dense) {
+    return *dense;
+  }
+
+  MemoryResourceScope scope(0);
+  ElemVec *created = _create<ElemVec>(0, ResourceAllocator<MapElem*>(0));
+  created->reserve(count);
+  for (auto elem : vOrder) {
+    if (elem) {
+      created->push_back(elem);
+    }
+  }
+
+  return _publish(pDense, created);
+}
+
+
+MapElem *ValueVecMap::at(size_t index) const {
+  return order()[index];
+}
+
+
+void ValueVecMap::move(size_t from, size_t to) {
+  if (vOrder.size() != count) {
+    _compact();
+  }
+  _invalidateCaches();
+
+  auto it = vOrder.begin();
+  if (from < to) {
+    std::rotate(it + from, it + from + 1, it + to);
+  } else {
+    std::rotate(it + to, it + from, it + from + 1);
+  }
+
+  for (auto &b : vBuckets) {
+    if (b.elem) {
+      size_t &oi = b.orderIndex;
+      if (from < to) {
+        if (oi == from) {
+          oi = to - 1;
+        } else if (oi > from && oi < to) {
+          --oi;
+        }
+      } else {
+        if (oi == from) {
+          oi = to;
+        } else if (oi >= to && oi < from) {
+          ++oi;
+        }
+      }
+    }
+  }
+}
+
+
+const ValueVecMap::ElemVec& ValueVecMap::sorted() const {
+  const ElemVec *sorted = pSorted;
+  if (sorted) {
+    return *sorted;
+  }
+
+  MemoryResourceScope scope(0);
+  ElemVec *created = _create<ElemVec>(0, ResourceAllocator<MapElem*>(0));
+  created->reserve(count);
+  for (auto elem : vOrder) {
+    if (elem) {
+      created->push_back(elem);
+    }
+  }
+  std::sort(created->begin(), created->end(),
+    [](const MapElem *a, const MapElem *b) { return a->first < b->first; });
+
+  return _publish(pSorted, created);
+}
+
+
+Value::ValueImpl::ValueImpl()
+  : refCount(1),
+  type(Type::Undefined),
+  frozen(false),
+  packed(Type::Undefined),
+  external(tlsResource != 0)
+{
+}
+
+
+Value::ValueImpl::ValueImpl(bool input)
+  : refCount(1),
+  type(Type::Bool),
+  frozen(false),
+  packed(Type::Undefined),
+  external(tlsResource != 0),
+  b(input)
+{
+}
+
+
+Value::ValueImpl::ValueImpl(double input)
+  : refCount(1),
+  type(Type::Double),
+  frozen(false),
+  packed(Type::Undefined),
+  external(tlsResource != 0),
+  d(input)
+{
+}
+
+
+Value::ValueImpl::ValueImpl(std::int64_t input)
+  : refCount(1),
+  type(Type::Int64),
+  frozen(false),
+  packed(Type::Undefined),
+  external(tlsResource != 0),
+  i(input)
+{
+}
+
+
+Value::ValueImpl::ValueImpl(const std::string &input)
+  : refCount(1),
+  type(Type::String),
+  frozen(false),
+  packed(Type::Undefined),
+  external(tlsResource != 0)
+{
+  str_assign(input.data(), input.size());
+}
+
+
+Value::ValueImpl::ValueImpl(std::string &&input)
+  : refCount(1),
+  type(Type::String),
+  frozen(false),
+  packed(Type::Undefined),
+  external(tlsResource != 0)
+{
+  if (input.size() <= maxShortString || external) {
+    str_assign(input.data(), input.size());
+  } else {
+    s = new std::string(std::move(input));
+    sso[maxShortString] = longString;
+  }
+}
+
+
+Value::ValueImpl::ValueImpl(Type _type)
+  : refCount(1),
+  type(_type),
+  frozen(false),
+  packed(Type::Undefined),
+  external(tlsResource != 0)
+{
+  switch (_type)
+  {
+  case Type::String:
+    sso[0] = 0;
+    sso[numberTypeIndex] = static_cast<char>(Type::Undefined);
+    sso[maxShortString] = maxShortString;
+    break;
+  case Type::Vector:
+    v = _create<ValueVec>(resource(), ResourceAllocator<Value>(resource()));
+    break;
+  case Type::Map:
+    m = _create<ValueVecMap>(resource(), resource());
+    break;
+  default:
+    break;
+  }
+}
+
+
+// Must only be called from a constructor.
+void Value::ValueImpl::str_assign(const char *data, size_t size) {
+  if (size <= maxShortString) {
+    memcpy(sso, data, size);
+    sso[size] = 0;
+    sso[maxShortString] = static_cast<char>(maxShortString - size);
+    str_forget_number();
+  } else if (external) {
+    rs = _create<ResourceString>(resource(), data, size,
+      ResourceAllocator<char>(resource()));
+    sso[maxShortString] = longString;
+  } else {
+    s = new std::string(data, size);
+    sso[maxShortString] = longString;
+  }
+}
+
+
+void Value::ValueImpl::str_append(const char *data, size_t size) {
+  if (sso[maxShortString] == longString) {
+    if (external) {
+      rs->append(data, size);
+    } else {
+      s->append(data, size);
+    }
+    return;
+  }
+
+  size_t oldSize = str_size();
+  if (oldSize + size <= maxShortString) {
+    // Works also if data points to sso, since the ranges can't overlap.
+    memcpy(sso + oldSize, data, size);
+    sso[oldSize + size] = 0;
+    sso[maxShortString] = static_cast<char>(maxShortString - oldSize - size);
+    str_forget_number();
+  } else if (external) {
+    ResourceString *ns = _create<ResourceString>(resource(),
+      ResourceAllocator<char>(resource()));
+    ns->reserve(oldSize + size);
+    ns->append(sso, oldSize);
+    ns->append(data, size);
+    rs = ns;
+    sso[maxShortString] = longString;
+  } else {
+    std::string *ns = new std::string();
+    ns->reserve(oldSize + size);
+    ns->append(sso, oldSize);
+    ns->append(data, size);
+    s = ns;
+    sso[maxShortString] = longString;
+  }
+}
+
+
+// Only plain decimal numbers are recognized, for which all number parsers
+// agree. Other strings are parsed on each call to to_double() or to_int64().
+static Type _parsePlainNumber(const char *pText, size_t size,
+  std::int64_t *pI, double *pD)
+{
+  const char *pCh = pText, *pEnd = pText + size;
+  bool negative = (pCh < pEnd && *pCh == '-');
+  if (negative) {
+    ++pCh;
+  }
+  const char *pDigits = pCh;
+  while (pCh < pEnd && *pCh >= '0' && *pCh <= '9') {
+    ++pCh;
+  }
+  if (pCh == pDigits) {
+    return Type::Undefined;
+  }
+
+  if (pCh == pEnd) {
+    // strtoll() parses a leading zero as octal, and "-0" is a negative zero
+    // when parsed as a double.
+    if (*pDigits == '0' && (pEnd - pDigits > 1 || negative)) {
+      return Type::Undefined;
+    }
+    std::int64_t i = 0;
+    for (pCh = pDigits; pCh < pEnd; ++pCh) {
+      i = i * 10 + (*pCh - '0');
+    }
+    if (negative) {
+      i = -i;
+    }
+    *pI = i;
+    return Type::Int64;
+  }
+
+  if (*pCh == '.') {
+    const char *pFraction = ++pCh;
+    while (pCh < pEnd && *pCh >= '0' && *pCh <= '9') {
+      ++pCh;
+    }
+    if (pCh == pFraction) {
+      return Type::Undefined;
+    }
+  }
+  if (pCh < pEnd && (*pCh == 'e' || *pCh == 'E')) {
+    ++pCh;
+    if (pCh < pEnd && (*pCh == '-' || *pCh == '+')) {
+      ++pCh;
+    }
+    const char *pExponent = pCh;
+    while (pCh < pEnd && *pCh >= '0' && *pCh <= '9') {
+      ++pCh;
+    }
+    if (pCh == pExponent) {
+      return Type::Undefined;
+    }
+  }
+
+  if (pCh != pEnd || !_parseDouble(pD, pText, size)) {
+    return Type::Undefined;
+  }
+  return Type::Double;
+}
+
+
+Type Value::ValueImpl::str_number(std::int64_t *pI, double *pD) const {
+  if (sso[maxShortString] == longString || str_size() > maxNumberString) {
+    return Type::Undefined;
+  }
+
+  // Other threads can read the same String at the same time, so only one of
+  // them stores the number. The others parse the text themselves until the
+  // number has been stored.
+#if HJSON_SINGLE_THREADED
+  char &state = const_cast<char&>(sso[numberTypeIndex]);
+  char current = state;
+#else
+  static_assert(sizeof(std::atomic<char>) == 1 && ATOMIC_CHAR_LOCK_FREE == 2,
+    "std::atomic<char> must be a lock free char.");
+  auto &state = *reinterpret_cast<std::atomic<char>*>(
+    const_cast<char*>(sso + numberTypeIndex));
+  char current = state.load(std::memory_order_acquire);
+#endif
+  if (current != numberUnknown && current != numberBusy) {
+    Type type = static_cast<Type>(current);
+    if (type == Type::Int64) {
+      memcpy(pI, sso + numberTypeIndex + 1, sizeof(*pI));
+    } else if (type == Type::Double) {
+      memcpy(pD, sso + numberTypeIndex + 1, sizeof(*pD));
+    }
+    return type;
+  }
+
+  Type type = _parsePlainNumber(sso, str_size(), pI, pD);
+
+#if HJSON_SINGLE_THREADED
+  bool store = true;
+#else
+  bool store = (current == numberUnknown &&
+    state.compare_exchange_strong(current, numberBusy));
+#endif
+  if (store) {
+    char *pNumber = const_cast<char*>(sso + numberTypeIndex + 1);
+    if (type == Type::Int64) {
+      memcpy(pNumber, pI, sizeof(*pI));
+    } else if (type == Type::Double) {
+      memcpy(pNumber, pD, sizeof(*pD));
+    }
+#if HJSON_SINGLE_THREADED
+    state = static_cast<char>(type);
+#else
+    state.store(static_cast<char>(type), std::memory_order_release);
+#endif
+  }
+
+  return type;
+}
+
+
+Value::ValueImpl *Value::ValueImpl::shallowCopy() const {
+  ValueImpl *ret = new ValueImpl(type);
+
+  switch (type) {
+  case Type::Bool:
+    ret->b = b;
+    break;
+  case Type::Double:
+    ret->d = d;
+    break;
+  case Type::Int64:
+    ret->i = i;
+    break;
+  case Type::String:
+    ret->str_append(str_data(), str_size());
+    break;
+  case Type::Vector:
+    if (packed != Type::Undefined) {
+      ret->pack(packed);
+      ret->pv->vi = pv->vi;
+      ret->pv->vd = pv->vd;
+    } else {
+      *ret->v = *v;
+    }
+    break;
+  case Type::Map:
+    for (auto elem : m->order()) {
+      ret->m->emplace(elem->first, Value(elem->second));
+    }
+    break;
+  default:
+    break;
+  }
+
+  return ret;
+}
+
+
+const ValueVec& Value::ValueImpl::vec_const() const {
+  if (packed == Type::Undefined) {
+    return *v;
+  }
+
+  ValueVec *mirror = pv->mirror;
+  if (!mirror) {
+    // The mirror is read by other threads, so it must not be allocated from
+    // the MemoryResource of the calling thread.
+    MemoryResourceScope scope(0);
+    mirror = _create<ValueVec>(0);
+    mirror->reserve(vec_size());
+    for (size_t index = 0; index < vec_size(); ++index) {
+      if (packed == Type::Int64) {
+        mirror->push_back(Value(pv->vi[index]));
+      } else {
+        mirror->push_back(Value(pv->vd[index]));
+      }
+      ValueImpl *elem = mirror->back().prv();
+      elem->frozen = true;
+      if (!frozen) {
+        elem->packed = Type::Vector;
+      }
+    }
+#if HJSON_SINGLE_THREADED
+    pv->mirror = mirror;
+#else
+    ValueVec *expected = 0;
+    if (!pv->mirror.compare_exchange_strong(expected, mirror)) {
+      // Another thread was faster.
+      _destroy(static_cast<MemoryResource*>(0), mirror);
+      mirror = expected;
+    }
+#endif
+  }
+
+  return *mirror;
+}
+
+
+void Value::ValueImpl::pack(Type _packed) {
+  size_t capacity = v->capacity();
+  _destroy(resource(), v);
+  pv = _create<PackedVec>(resource(), resource());
+  packed = _packed;
+  if (packed == Type::Int64) {
+    pv->vi.reserve(capacity);
+  } else {
+    pv->vd.reserve(capacity);
+  }
+}
+
+
+void Value::ValueImpl::unpack() {
+  PackedVec *old = pv;
+  ValueVec *mirror = old->mirror;
+  ValueVec *nv = _create<ValueVec>(resource(),
+    ResourceAllocator<Value>(resource()));
+
+  nv->reserve(vec_size());
+  if (mirror) {
+    // Keep the Value objects, since references to them might exist.
+    for (auto &elem : *mirror) {
+      nv->push_back(elem);
+    }
+  } else {
+    for (size_t index = 0; index < vec_size(); ++index) {
+      if (packed == Type::Int64) {
+        nv->push_back(Value(old->vi[index]));
+      } else {
+        nv->push_back(Value(old->vd[index]));
+      }
+    }
+  }
+
+  _destroy(resource(), old);
+  v = nv;
+  packed = Type::Undefined;
+}
+
+
+static bool _hasComments(const std::string &a, const std::string &b,
+  const std::string &c, const std::string &d)
+{
+  return !a.empty() || !b.empty() || !c.empty() || !d.empty();
+}
+
+
+void Value::ValueImpl::vec_push(Value &&elem) {
+  Type elemType = elem.prv()->type;
+  Comments *c = elem.cm();
+  bool packable = (elemType == Type::Int64 || elemType == Type::Double) &&
+    (!c || !_hasComments(c->m_commentBefore, c->m_commentKey,
+    c->m_commentInside, c->m_commentAfter));
+
+  if (packed == Type::Undefined && packable && v->empty()) {
+    pack(elemType);
+  }
+
+  if (packed != Type::Undefined) {
+    if (packable && elemType == packed) {
+      vec_forget_mirror();
+      if (packed == Type::Int64) {
+        pv->vi.push_back(elem.prv()->i);
+      } else {
+        pv->vd.push_back(elem.prv()->d);
+      }
+      return;
+    }
+    unpack();
+  }
+
+  v->push_back(std::move(elem));
+}
+
+
+void Value::ValueImpl::recreate(Type _type) {
+  std::uint32_t count = refCount;
+  // Keep using the resource that the memory block was allocated from.
+  MemoryResourceScope scope(resource());
+  this->~ValueImpl();
+  // Recreate the private object using the same memory block.
+  ::new(this) ValueImpl(_type);
+  refCount = count;
+}
+
+
+int Value::ValueImpl::str_compare(const ValueImpl &other) const {
+  size_t sizeA = str_size(), sizeB = other.str_size();
+  int ret = memcmp(str_data(), other.str_data(), std::min(sizeA, sizeB));
+  if (ret) {
+    return ret;
+  }
+  return sizeA < sizeB ? -1 : (sizeA > sizeB ? 1 : 0);
+}
+
+
+// Bottom-up destruction in order to avoid stack overflow due to recursive destructor calls.
+void Value::ValueImpl::DeepClear(Value &val) {
+  // The map/vector will only be destroyed if use_count == 1
+  if (val.prv()->ownsChildren()) {
+    std::vector<std::pair<Value, size_t> > v;
+
+    v.emplace_back(val, 0);
+
+    while (!v.empty()) {
+      ValueImpl *node = v.back().first.prv();
+      if (v.back().second >= (node->type == Type::Vector ? node->v->size() :
+        node->m->size()))
+      {
+        if (node->type == Type::Vector) {
+          node->v->clear();
+        } else {
+          node->m->clear();
+        }
+        v.pop_back();
+      } else {
+        Value &n = (node->type == Type::Vector ? (*node->v)[v.back().second] :
+          node->m->at(v.back().second)->second);
+        v.back().second++;
+        // The map/vector will only be destroyed if use_count == 1
+        if (n.prv()->ownsChildren()) {
+          v.emplace_back(n, 0);
+        }
+      }
+    }
+  }
+}
+
+
+Value::ValueImpl::~ValueImpl() {
+  switch (type)
+  {
+  case Type::String:
+    if (sso[maxShortString] == longString) {
+      if (external) {
+        _destroy(resource(), rs);
+      } else {
+        delete s;
+      }
+    }
+    break;
+  case Type::Vector:
+    if (packed != Type::Undefined) {
+      _destroy(resource(), pv);
+      break;
+    }
+    for (auto e = v->begin(); e != v->end(); ++e) {
+      DeepClear(*e);
+    }
+    _destroy(resource(), v);
+    break;
+  case Type::Map:
+    for (auto elem : m->order()) {
+      DeepClear(elem->second);
+    }
+    _destroy(resource(), m);
+    break;
+  default:
+    break;
+  }
+}
+
+
+// Sacrifice efficiency for predictability: It is allowed to do bracket
+// assignment on an Undefined Value, and thereby turn it into a Map Value.
+// A Map Value is passed by reference, therefore an Undefined Value should also
+// be passed by reference, to avoid surprises when doing bracket assignment
+// on a Value that has been passed around but is still of type Undefined.
+Value::Value()
+  : Value(new ValueImpl(Type::Undefined))
+{
+}
+
+
+Value::Value(bool input)
+  : Value(new ValueImpl(input))
+{
+}
+
+
+Value::Value(float input)
+  : Value(new ValueImpl(static_cast<double>(input)))
+{
+}
+
+
+Value::Value(double input)
+  : Value(new ValueImpl(input))
+{
+}
+
+
+Value::Value(long double input)
+  : Value(new ValueImpl(static_cast<double>(input)))
+{
+}
+
+
+Value::Value(char input)
+  : Value(new ValueImpl(static_cast<std::int64_t>(input)))
+{
+}
+
+
+Value::Value(unsigned char input)
+  : Value(new ValueImpl(static_cast<std::int64_t>(input)))
+{
+}
+
+
+Value::Value(short input)
+  : Value(new ValueImpl(static_cast<std::int64_t>(input)))
+{
+}
+
+
+Value::Value(unsigned short input)
+  : Value(new ValueImpl(static_cast<std::int64_t>(input)))
+{
+}
+
+
+Value::Value(int input)
+  : Value(new ValueImpl(static_cast<std::int64_t>(input)))
+{
+}
+
+
+Value::Value(unsigned int input)
+  : Value(new ValueImpl(static_cast<std::int64_t>(input)))
+{
+}
+
+
+Value::Value(long input)
+  : Value(new ValueImpl(static_cast<std::int64_t>(input)))
+{
+}
+
+
+Value::Value(unsigned long input)
+  : Value(new ValueImpl(static_cast<std::int64_t>(input)))
+{
+}
+
+
+Value::Value(long long input)
+  : Value(new ValueImpl(static_cast<std::int64_t>(input)))
+{
+}
+
+
+Value::Value(unsigned long long input)
+  : Value(new ValueImpl(static_cast<std::int64_t>(input)))
+{
+}
+
+
+Value::Value(const char *input)
+  : Value(new ValueImpl(std::string(input)))
+{
+}
+
+
+Value::Value(const std::string& input)
+  : Value(new ValueImpl(input))
+{
+}
+
+
+Value::Value(std::string&& input)
+  : Value(new ValueImpl(std::move(input)))
+{
+}
+
+
+Value::Value(Type _type)
+  : Value(new ValueImpl(_type))
+{
+}
+
+
+Value::Value(const Value& other)
+  : Value(other.prv()->addRef())
+{
+  if (other.cm()) {
+    // Clone the comments instead of sharing the reference. This way a change
+    // in the other Value does not affect the comments in this Value.
+    set_comments(other);
+  }
+}
+
+
+// The other Value keeps a reference to the ValueImpl, but loses its comments.
+Value::Value(Value&& other)
+  : ptr(other.ptr)
+{
+  Comments *c = other.cm();
+  if (c && c->refCount > 1) {
+    // The comments are shared between a map element and a temporary
+    // MapProxy, so they must stay in the map element.
+    ptr = reinterpret_cast<std::uintptr_t>(c->node->addRef());
+    set_comments(other);
+  } else if (c) {
+    other.ptr = reinterpret_cast<std::uintptr_t>(prv()->addRef());
+  } else {
+    prv()->addRef();
+  }
+}
+
+
+// Even though the MapProxy is temporary, it contains references that are owned
+// by a non-temporary object. Make sure the lvalue constructor is called.
+Value::Value(MapProxy&& other)
+  : Value(other)
+{
+}
+
+
+// Takes over the reference to the ValueImpl.
+Value::Value(ValueImpl *_prv)
+  : ptr(reinterpret_cast<std::uintptr_t>(_prv))
+{
+}
+
+
+Value::~Value() {
+  _release();
+}
+
+
+inline Value::ValueImpl *Value::prv() const {
+  return (ptr & 1) ? reinterpret_cast<Comments*>(ptr - 1)->node :
+    reinterpret_cast<ValueImpl*>(ptr);
+}
+
+
+inline Value::Comments *Value::cm() const {
+  return (ptr & 1) ? reinterpret_cast<Comments*>(ptr - 1) : 0;
+}
+
+
+// Returns the comments of this Value, creating them if needed.
+Value::Comments *Value::_getComments() {
+  if (!(ptr & 1)) {
+    // The Comments object takes over the reference to the ValueImpl.
+    ptr = reinterpret_cast<std::uintptr_t>(new Comments(prv())) | 1;
+  }
+
+  return cm();
+}
+
+
+// Makes this Value point to another ValueImpl, keeping the comments.
+void Value::_setImpl(ValueImpl *other) {
+  other->addRef();
+  ValueImpl *old = prv();
+  if (Comments *c = cm()) {
+    c->node = other;
+  } else {
+    ptr = reinterpret_cast<std::uintptr_t>(other);
+  }
+  ValueImpl::release(old);
+}
+
+
+// Throws frozen_error if the ValueImpl is frozen, except if it is an element
+// from the mirror of a packed Vector. Then this Value is changed to point to
+// a mutable copy of the element instead.
+void Value::_checkMutable() {
+  if (prv()->copyOnWrite()) {
+    ValueImpl::thaw(*this);
+  }
+  prv()->checkMutable();
+}
+
+
+// Makes this Value share both ValueImpl and comments with the other Value.
+// Only used by MapProxy.
+void Value::_share(const Value& other) {
+  if (ptr == other.ptr) {
+    return;
+  }
+
+  if (Comments *c = other.cm()) {
+    ++c->refCount;
+  } else {
+    other.prv()->addRef();
+  }
+  _release();
+  ptr = other.ptr;
+}
+
+
+// Moves the comments from the other Value to this Value.
+void Value::_takeComments(Value& other) {
+  Comments *oc = other.cm();
+  if (!oc) {
+    clear_comments();
+    return;
+  }
+
+  if (oc->refCount > 1) {
+    // Shared between a map element and a temporary MapProxy.
+    set_comments(other);
+    return;
+  }
+
+  Comments *c = _getComments();
+  if (c != oc) {
+    c->m_commentBefore = std::move(oc->m_commentBefore);
+    c->m_commentKey = std::move(oc->m_commentKey);
+    c->m_commentInside = std::move(oc->m_commentInside);
+    c->m_commentAfter = std::move(oc->m_commentAfter);
+  }
+}
+
+
+void Value::_release() {
+  if (Comments *c = cm()) {
+    if (--c->refCount == 0) {
+      ValueImpl::release(c->node);
+      Comments::destroy(c);
+    }
+  } else {
+    ValueImpl::release(prv());
+  }
+}
+
+
+Value& Value::operator=(const Value& other) {
+  // So that comments are kept when assigning a Value to a new key in a map,
+  // or to a variable that has not been assigned any other value yet.
+  if (!this->defined()) {
+    this->set_comments(other);
+  }
+
+  _setImpl(other.prv());
+
+  return *this;
+}
+
+
+Value& Value::operator=(Value&& other) {
+  // So that comments are kept when assigning a Value to a new key in a map,
+  // or to a variable that has not been assigned any other value yet.
+  if (!this->defined()) {
+    _takeComments(other);
+  }
+
+  _setImpl(other.prv());
+
+  return *this;
+}
+
+
+const Value& Value::at(const std::string& name) const {
+  switch (prv()->type)
+  {
+  case Type::Undefined:
+    throw index_out_of_bounds("Key not found.");
+  case Type::Map:
+    {
+      auto elem = prv()->m->find(name);
+      if (elem) {
+        return elem->second;
+      }
+    }
+    throw index_out_of_bounds("Key not found.");
+  default:
+    throw type_mismatch("Must be of type Map for that operation.");
+  }
+}
+
+
+Value& Value::at(const std::string& name) {
+  _checkMutable();
+
+  switch (prv()->type)
+  {
+  case Type::Undefined:
+    throw index_out_of_bounds("Key not found.");
+  case Type::Map:
+    {
+      auto elem = prv()->m->find(name);
+      if (elem) {
+        ValueImpl::thaw(elem->second);
+        return elem->second;
+      }
+    }
+    throw index_out_of_bounds("Key not found.");
+  default:
+    throw type_mismatch("Must be of type Map for that operation.");
+  }
+}
+
+
+const Value& Value::at(const char *name) const {
+  if (prv()->type != Type::Undefined && prv()->type != Type::Map) {
+    throw type_mismatch("Must be of type Map for that operation.");
+  }
+  const Value *pVal = find(name);
+  if (!pVal) {
+    throw index_out_of_bounds("Key not found.");
+  }
+  return *pVal;
+}
+
+
+
+const Value* Value::find(const char *key, size_t keySize) const {
+  switch (prv()->type) {
+  case Type::Undefined:
+    return 0;
+  case Type::Map:
+    {
+      auto elem = prv()->m->find(key, keySize, hashKey(key, keySize));
+      return elem ? &elem->second : 0;
+    }
+  default:
+    throw type_mismatch("Must be of type Undefined or Map for that operation.");
+  }
+}
+
+
+const Value* Value::find(const char *key) const {
+  return find(key, strlen(key));
+}
+
+
+const Value* Value::find(const std::string& key) const {
+  return find(key.data(), key.size());
+}
+
+
+const Value* Value::find(const HashedKey& key) const {
+  switch (prv()->type) {
+  case Type::Undefined:
+    return 0;
+  case Type::Map:
+    {
+      auto elem = prv()->m->find(key.str().data(), key.str().size(),
+        key.hash());
+      return elem ? &elem->second : 0;
+    }
+  default:
+    throw type_mismatch("Must be of type Undefined or Map for that operation.");
+  }
+}
+
+
+bool Value::contains(const char *key, size_t keySize) const {
+  return find(key, keySize) != 0;
+}
+
+
+bool Value::contains(const char *key) const {
+  return find(key) != 0;
+}
+
+
+bool Value::contains(const std::string& key) const {
+  return find(key) != 0;
+}
+
+
+bool Value::contains(const HashedKey& key) const {
+  return find(key) != 0;
+}
+
+
+const Value* Value::find_path(const char *path, size_t pathSize) const {
+  const Value *pVal = this;
+  const char *pCh = path, *pEnd = path + pathSize;
+  std::string unescaped;
+
+  while (pCh < pEnd) {
+    if (*pCh != '/') {
+      return 0;
+    }
+    const char *key = ++pCh;
+    while (pCh < pEnd && *pCh != '/') {
+      ++pCh;
+    }
+    size_t keySize = pCh - key;
+
+    if (memchr(key, '~', keySize)) {
+      unescaped.clear();
+      for (size_t a = 0; a < keySize; ++a) {
+        if (key[a] != '~') {
+          unescaped += key[a];
+        } else if (a + 1 < keySize && (key[a + 1] == '0' || key[a + 1] == '1')) {
+          unescaped += (key[++a] == '0' ? '~' : '/');
+        } else {
+          return 0;
+        }
+      }
+      key = unescaped.data();
+      keySize = unescaped.size();
+    }
+
+    switch (pVal->prv()->type) {
+    case Type::Map:
+      pVal = pVal->find(key, keySize);
+      if (!pVal) {
+        return 0;
+      }
+      break;
+    case Type::Vector:
+      {
+        // Leading zeros are not allowed in a JSON Pointer index.
+        if (!keySize || keySize > 9 || (key[0] == '0' && keySize > 1)) {
+          return 0;
+        }
+        size_t index = 0;
+        for (size_t a = 0; a < keySize; ++a) {
+          if (key[a] < '0' || key[a] > '9') {
+            return 0;
+          }
+          index = index * 10 + (key[a] - '0');
+        }
+        if (index >= pVal->prv()->vec_size()) {
+          return 0;
+        }
+        pVal = &pVal->prv()->vec_const()[index];
+      }
+      break;
+    default:
+      return 0;
+    }
+  }
+
+  return pVal;
+}
+
+
+const Value* Value::find_path(const char *path) const {
+  return find_path(path, strlen(path));
+}
+
+
+const Value* Value::find_path(const std::string& path) const {
+  return find_path(path.data(), path.size());
+}
+
+
+Value& Value::at(const char *name) {
+  return at(std::string(name));
+}
+
+
+const Value Value::operator[](const std::string& name) const {
+  if (prv()->type == Type::Undefined) {
+    return Value();
+  } else if (prv()->type == Type::Map) {
+    auto elem = prv()->m->find(name);
+    if (!elem) {
+      return Value();
+    }
+    return elem->second;
+  }
+
+  throw type_mismatch("Must be of type Undefined or Map for that operation.");
+}
+
+
+MapProxy Value::operator[](const std::string& name) {
+  if (prv()->type == Type::Undefined) {
+    if (prv()->frozen) {
+      // Allowed for reading, MapProxy prevents any assignment.
+      return MapProxy(prv(), name, 0);
+    }
+    prv()->recreate(Type::Map);
+  } else if (prv()->type != Type::Map) {
+    throw type_mismatch("Must be of type Undefined or Map for that operation.");
+  }
+
+  auto elem = prv()->m->find(name);
+  if (!elem) {
+    return MapProxy(prv(), name, 0);
+  }
+  if (!prv()->frozen) {
+    ValueImpl::thaw(elem->second);
+  }
+  return MapProxy(prv(), name, &elem->second);
+}
+
+
+const Value Value::operator[](const char *input) const {
+  const Value *pVal = find(input);
+  return pVal ? *pVal : Value();
+}
+
+
+MapProxy Value::operator[](const char *input) {
+  return operator[](std::string(input));
+}
+
+
+const Value Value::operator[](char *input) const {
+  return operator[](static_cast<const char*>(input));
 }
 
 
@@ -432,1514 +2224,2833 @@ MapProxy Value::operator[](char *input) {
 }
 
 
-const Value& Value::operator[](int index) const {
-  switch (prv->type)
-  {
-  case Type::Undefined:
-    throw index_out_of_bounds("Index out of bounds.");
-  case Type::Vector:
-  case Type::Map:
-    if (index < 0 || index >= size()) {
-      throw index_out_of_bounds("Index out of bounds.");
+const Value& Value::operator[](int index) const {
+  switch (prv()->type)
+  {
+  case Type::Undefined:
+    throw index_out_of_bounds("Index out of bounds.");
+  case Type::Vector:
+  case Type::Map:
+    if (index < 0 || index >= size()) {
+      throw index_out_of_bounds("Index out of bounds.");
+    }
+
+    switch (prv()->type)
+    {
+    case Type::Vector:
+      return prv()->vec_const()[index];
+    case Type::Map:
+      return prv()->m->at(index)->second;
+    default:
+      break;
+    }
+  default:
+    throw type_mismatch("Must be of type Undefined, Vector or Map for that operation.");
+  }
+}
+
+
+Value& Value::operator[](int index) {
+  _checkMutable();
+
+  switch (prv()->type)
+  {
+  case Type::Undefined:
+    throw index_out_of_bounds("Index out of bounds.");
+  case Type::Vector:
+  case Type::Map:
+    if (index < 0 || index >= size()) {
+      throw index_out_of_bounds("Index out of bounds.");
+    }
+
+    {
+      Value &elem = (prv()->type == Type::Vector ? prv()->vec()[index] :
+        prv()->m->at(index)->second);
+      ValueImpl::thaw(elem);
+      return elem;
+    }
+  default:
+    throw type_mismatch("Must be of type Undefined, Vector or Map for that operation.");
+  }
+}
+
+
+bool Value::operator==(bool input) const {
+  return operator bool() == input;
+}
+
+
+bool Value::operator!=(bool input) const {
+  return !(*this == input);
+}
+
+
+#define RET_VAL(_T, _O) \
+Value operator _O(_T a, const Value& b) { \
+  return Value(a) _O b; \
+} \
+Value operator _O(const Value& a, _T b) { \
+  return a _O Value(b); \
+}
+
+#define RET_BOOL(_T, _O) \
+bool operator _O(_T a, const Value& b) { \
+  return Value(a) _O b; \
+} \
+bool operator _O(const Value& a, _T b) { \
+  return a _O Value(b); \
+}
+
+#define HJSON_OP_IMPL_A(_T) \
+RET_BOOL(_T, <) \
+RET_BOOL(_T, >) \
+RET_BOOL(_T, <=) \
+RET_BOOL(_T, >=) \
+RET_BOOL(_T, ==) \
+RET_BOOL(_T, !=)
+
+#define HJSON_OP_IMPL_B(_T) \
+HJSON_OP_IMPL_A(_T) \
+RET_VAL(_T, +) \
+RET_VAL(_T, -) \
+RET_VAL(_T, *) \
+RET_VAL(_T, /)
+
+#define HJSON_OP_IMPL_C(_T) \
+HJSON_OP_IMPL_B(_T) \
+RET_VAL(_T, %)
+
+HJSON_OP_IMPL_A(const char*)
+HJSON_OP_IMPL_A(const std::string&)
+HJSON_OP_IMPL_B(float)
+HJSON_OP_IMPL_B(double)
+HJSON_OP_IMPL_B(long double)
+HJSON_OP_IMPL_C(char)
+HJSON_OP_IMPL_C(unsigned char)
+HJSON_OP_IMPL_C(short)
+HJSON_OP_IMPL_C(unsigned short)
+HJSON_OP_IMPL_C(int)
+HJSON_OP_IMPL_C(unsigned int)
+HJSON_OP_IMPL_C(long)
+HJSON_OP_IMPL_C(unsigned long)
+HJSON_OP_IMPL_C(long long)
+HJSON_OP_IMPL_C(unsigned long long)
+
+
+std::string operator+(const char *a, const Value& b) {
+  return std::string(a) + b.to_string();
+}
+
+
+std::string operator+(const Value& a ,const char *b) {
+  return  a.to_string() + std::string(b);
+}
+
+
+std::string operator+(const std::string &a, const Value& b) {
+  return a + b.to_string();
+}
+
+
+std::string operator+(const Value& a, const std::string &b) {
+  return a.to_string() + b;
+}
+
+
+Value operator+(const Value& a, const Value& b) {
+  if (a.prv()->type == Type::Double && b.prv()->type == Type::Int64) {
+    return a.prv()->d + b.prv()->i;
+  } else if (a.prv()->type == Type::Int64 && b.prv()->type == Type::Double) {
+    return a.prv()->i + b.prv()->d;
+  }
+
+  if (a.prv()->type != b.prv()->type) {
+    throw type_mismatch("The values must be of the same type for this operation.");
+  }
+
+  switch (a.prv()->type) {
+  case Type::Double:
+    return a.prv()->d + b.prv()->d;
+  case Type::Int64:
+    return a.prv()->i + b.prv()->i;
+  case Type::String:
+    return a.prv()->str() + b.prv()->str();
+  default:
+    break;
+  }
+
+  throw type_mismatch("The values must be of type Double, Int64 or String for this operation.");
+}
+
+
+bool operator<(const Value& a, const Value& b) {
+  if (a.prv()->type == Type::Double && b.prv()->type == Type::Int64) {
+    return a.prv()->d < b.prv()->i;
+  } else if (a.prv()->type == Type::Int64 && b.prv()->type == Type::Double) {
+    return a.prv()->i < b.prv()->d;
+  }
+
+  if (a.prv()->type != b.prv()->type) {
+    throw type_mismatch("The values must be of the same type for this operation.");
+  }
+
+  switch (a.prv()->type) {
+  case Type::Double:
+    return a.prv()->d < b.prv()->d;
+  case Type::Int64:
+    return a.prv()->i < b.prv()->i;
+  case Type::String:
+    return a.prv()->str_compare(*b.prv()) < 0;
+  default:
+    break;
+  }
+
+  throw type_mismatch("The values must be of type Double, Int64 or String for this operation.");
+}
+
+
+bool operator>(const Value& a, const Value& b) {
+  if (a.prv()->type == Type::Double && b.prv()->type == Type::Int64) {
+    return a.prv()->d > b.prv()->i;
+  } else if (a.prv()->type == Type::Int64 && b.prv()->type == Type::Double) {
+    return a.prv()->i > b.prv()->d;
+  }
+
+  if (a.prv()->type != b.prv()->type) {
+    throw type_mismatch("The values must be of the same type for this operation.");
+  }
+
+  switch (a.prv()->type) {
+  case Type::Double:
+    return a.prv()->d > b.prv()->d;
+  case Type::Int64:
+    return a.prv()->i > b.prv()->i;
+  case Type::String:
+    return a.prv()->str_compare(*b.prv()) > 0;
+  default:
+    break;
+  }
+
+  throw type_mismatch("The values must be of type Double, Int64 or String for this operation.");
+}
+
+
+bool operator<=(const Value& a, const Value& b) {
+  if (a.prv()->type == Type::Double && b.prv()->type == Type::Int64) {
+    return a.prv()->d <= b.prv()->i;
+  } else if (a.prv()->type == Type::Int64 && b.prv()->type == Type::Double) {
+    return a.prv()->i <= b.prv()->d;
+  }
+
+  if (a.prv()->type != b.prv()->type) {
+    throw type_mismatch("The values must be of the same type for this operation.");
+  }
+
+  switch (a.prv()->type) {
+  case Type::Double:
+    return a.prv()->d <= b.prv()->d;
+  case Type::Int64:
+    return a.prv()->i <= b.prv()->i;
+  case Type::String:
+    return a.prv()->str_compare(*b.prv()) <= 0;
+  default:
+    break;
+  }
+
+  throw type_mismatch("The values must be of type Double, Int64 or String for this operation.");
+}
+
+
+bool operator>=(const Value& a, const Value& b) {
+  if (a.prv()->type == Type::Double && b.prv()->type == Type::Int64) {
+    return a.prv()->d >= b.prv()->i;
+  } else if (a.prv()->type == Type::Int64 && b.prv()->type == Type::Double) {
+    return a.prv()->i >= b.prv()->d;
+  }
+
+  if (a.prv()->type != b.prv()->type) {
+    throw type_mismatch("The values must be of the same type for this operation.");
+  }
+
+  switch (a.prv()->type) {
+  case Type::Double:
+    return a.prv()->d >= b.prv()->d;
+  case Type::Int64:
+    return a.prv()->i >= b.prv()->i;
+  case Type::String:
+    return a.prv()->str_compare(*b.prv()) >= 0;
+  default:
+    break;
+  }
+
+  throw type_mismatch("The values must be of type Double, Int64 or String for this operation.");
+}
+
+
+bool operator==(const Value& a, const Value& b) {
+  if (a.prv()->type == Type::Double && b.prv()->type == Type::Int64) {
+    return a.prv()->d == b.prv()->i;
+  } else if (a.prv()->type == Type::Int64 && b.prv()->type == Type::Double) {
+    return a.prv()->i == b.prv()->d;
+  }
+
+  if (a.prv()->type != b.prv()->type) {
+    return false;
+  }
+
+  switch (a.prv()->type) {
+  case Type::Undefined:
+  case Type::Null:
+    return true;
+  case Type::Bool:
+    return a.prv()->b == b.prv()->b;
+  case Type::Double:
+    return a.prv()->d == b.prv()->d;
+  case Type::String:
+    return a.prv()->str_compare(*b.prv()) == 0;
+  case Type::Vector:
+    return a.prv() == b.prv();
+  case Type::Map:
+    return a.prv()->m == b.prv()->m;
+  case Type::Int64:
+    return a.prv()->i == b.prv()->i;
+  }
+
+  assert(!"Unknown type");
+
+  return false;
+}
+
+
+bool operator!=(const Value& a, const Value& b) {
+  return !(a == b);
+}
+
+
+Value operator-(const Value& a, const Value& b) {
+  if (a.prv()->type == Type::Double && b.prv()->type == Type::Int64) {
+    return a.prv()->d - b.prv()->i;
+  } else if (a.prv()->type == Type::Int64 && b.prv()->type == Type::Double) {
+    return a.prv()->i - b.prv()->d;
+  }
+
+  if (a.prv()->type != b.prv()->type) {
+    throw type_mismatch("The values must be of the same type for this operation.");
+  }
+
+  switch (a.prv()->type) {
+  case Type::Double:
+    return a.prv()->d - b.prv()->d;
+  case Type::Int64:
+    return a.prv()->i - b.prv()->i;
+  default:
+    break;
+  }
+
+  throw type_mismatch("The values must be of type Double or Int64 for this operation.");
+}
+
+
+Value operator*(const Value& a, const Value& b) {
+  if (a.prv()->type == Type::Double && b.prv()->type == Type::Int64) {
+    return a.prv()->d * b.prv()->i;
+  } else if (a.prv()->type == Type::Int64 && b.prv()->type == Type::Double) {
+    return a.prv()->i * b.prv()->d;
+  }
+
+  if (a.prv()->type != b.prv()->type) {
+    throw type_mismatch("The values must be of the same type for this operation.");
+  }
+
+  switch (a.prv()->type) {
+  case Type::Double:
+    return a.prv()->d * b.prv()->d;
+  case Type::Int64:
+    return a.prv()->i * b.prv()->i;
+  default:
+    break;
+  }
+
+  throw type_mismatch("The values must be of type Double or Int64 for this operation.");
+}
+
+
+Value operator/(const Value& a, const Value& b) {
+  if (a.prv()->type == Type::Double && b.prv()->type == Type::Int64) {
+    return a.prv()->d / b.prv()->i;
+  } else if (a.prv()->type == Type::Int64 && b.prv()->type == Type::Double) {
+    return a.prv()->i / b.prv()->d;
+  }
+
+  if (a.prv()->type != b.prv()->type) {
+    throw type_mismatch("The values must be of the same type for this operation.");
+  }
+
+  switch (a.prv()->type) {
+  case Type::Double:
+    return a.prv()->d / b.prv()->d;
+  case Type::Int64:
+    return a.prv()->i / b.prv()->i;
+  default:
+    break;
+  }
+
+  throw type_mismatch("The values must be of type Double or Int64 for this operation.");
+}
+
+
+Value operator%(const Value& a, const Value& b) {
+  if (a.prv()->type != b.prv()->type || a.prv()->type != Type::Int64) {
+    throw type_mismatch("The values must be of the Int64 type for this operation.");
+  }
+
+  return a.prv()->i % b.prv()->i;
+}
+
+
+#define OP_ASS(_O, _T) \
+Value& Value::operator _O(_T b) { \
+  return operator _O(Value(b)); \
+}
+
+#define HJSON_ASS_IMPL_A(_T) \
+OP_ASS(+=, _T) \
+OP_ASS(-=, _T) \
+OP_ASS(*=, _T) \
+OP_ASS(/=, _T)
+
+#define HJSON_ASS_IMPL_B(_T) \
+HJSON_ASS_IMPL_A(_T) \
+OP_ASS(%=, _T)
+
+HJSON_ASS_IMPL_A(float)
+HJSON_ASS_IMPL_A(double)
+HJSON_ASS_IMPL_A(long double)
+HJSON_ASS_IMPL_B(char)
+HJSON_ASS_IMPL_B(unsigned char)
+HJSON_ASS_IMPL_B(short)
+HJSON_ASS_IMPL_B(unsigned short)
+HJSON_ASS_IMPL_B(int)
+HJSON_ASS_IMPL_B(unsigned int)
+HJSON_ASS_IMPL_B(long)
+HJSON_ASS_IMPL_B(unsigned long)
+HJSON_ASS_IMPL_B(long long)
+HJSON_ASS_IMPL_B(unsigned long long)
+
+
+Value& Value::operator+=(const char *b) {
+  return operator+=(std::string(b));
+}
+
+
+Value& Value::operator+=(const std::string& b) {
+  if (prv()->type != Type::String) {
+    throw type_mismatch("The value must be of type String for this operation.");
+  }
+  _checkMutable();
+
+  prv()->str_append(b.data(), b.size());
+
+  return *this;
+}
+
+
+Value& Value::operator+=(const Value& b) {
+  _checkMutable();
+
+  if (prv()->type == Type::Double && b.prv()->type == Type::Int64) {
+    prv()->d += b.prv()->i;
+  } else if (prv()->type == Type::Int64 && b.prv()->type == Type::Double) {
+    prv()->i += static_cast<int64_t>(b.prv()->d);
+  } else {
+    if (prv()->type != b.prv()->type) {
+      throw type_mismatch("The values must be of the same type for this operation.");
+    }
+
+    switch (prv()->type) {
+    case Type::Double:
+      prv()->d += b.prv()->d;
+      break;
+    case Type::Int64:
+      prv()->i += b.prv()->i;
+      break;
+    case Type::String:
+      prv()->str_append(b.prv()->str_data(), b.prv()->str_size());
+      break;
+    default:
+      throw type_mismatch("The values must be of type Double, Int64 or String for this operation.");
+      break;
+    }
+  }
+
+  return *this;
+}
+
+
+Value& Value::operator-=(const Value& b) {
+  operator +=(-b);
+
+  return *this;
+}
+
+
+Value& Value::operator*=(const Value& b) {
+  _checkMutable();
+
+  if (prv()->type == Type::Double && b.prv()->type == Type::Int64) {
+    prv()->d *= b.prv()->i;
+  } else if (prv()->type == Type::Int64 && b.prv()->type == Type::Double) {
+    prv()->i = static_cast<int64_t>(prv()->i * b.prv()->d);
+  } else {
+    if (prv()->type != b.prv()->type) {
+      throw type_mismatch("The values must be of the same type for this operation.");
+    }
+
+    switch (prv()->type) {
+    case Type::Double:
+      prv()->d *= b.prv()->d;
+      break;
+    case Type::Int64:
+      prv()->i *= b.prv()->i;
+      break;
+    default:
+      throw type_mismatch("The values must be of type Double or Int64 for this operation.");
+      break;
+    }
+  }
+
+  return *this;
+}
+
+
+Value& Value::operator/=(const Value& b) {
+  _checkMutable();
+
+  if (prv()->type == Type::Double && b.prv()->type == Type::Int64) {
+    prv()->d /= b.prv()->i;
+  } else if (prv()->type == Type::Int64 && b.prv()->type == Type::Double) {
+    prv()->i = static_cast<int64_t>(prv()->i / b.prv()->d);
+  } else {
+    if (prv()->type != b.prv()->type) {
+      throw type_mismatch("The values must be of the same type for this operation.");
+    }
+
+    switch (prv()->type) {
+    case Type::Double:
+      prv()->d /= b.prv()->d;
+      break;
+    case Type::Int64:
+      prv()->i /= b.prv()->i;
+      break;
+    default:
+      throw type_mismatch("The values must be of type Double or Int64 for this operation.");
+      break;
+    }
+  }
+
+  return *this;
+}
+
+
+Value& Value::operator%=(const Value& b) {
+  if (prv()->type != b.prv()->type || prv()->type != Type::Int64) {
+    throw type_mismatch("The values must be of the Int64 type for this operation.");
+  }
+  _checkMutable();
+
+  prv()->i %= b.prv()->i;
+
+  return *this;
+}
+
+
+Value Value::operator+() const {
+  switch (prv()->type) {
+  case Type::Double:
+    return prv()->d;
+  case Type::Int64:
+    return prv()->i;
+  default:
+    throw type_mismatch("The value must be of type Double or Int64 for this operation.");
+    break;
+  }
+
+  return *this;
+}
+
+
+Value Value::operator-() const {
+  switch (prv()->type) {
+  case Type::Double:
+    return -prv()->d;
+  case Type::Int64:
+    return -prv()->i;
+  default:
+    throw type_mismatch("The value must be of type Double or Int64 for this operation.");
+    break;
+  }
+
+  return *this;
+}
+
+
+Value& Value::operator++() {
+  _checkMutable();
+
+  switch (prv()->type) {
+  case Type::Double:
+    prv()->d++;
+    break;
+  case Type::Int64:
+    prv()->i++;
+    break;
+  default:
+    throw type_mismatch("The values must be of type Double or Int64 for this operation.");
+    break;
+  }
+
+  return *this;
+}
+
+
+Value& Value::operator--() {
+  _checkMutable();
+
+  switch (prv()->type) {
+  case Type::Double:
+    prv()->d--;
+    break;
+  case Type::Int64:
+    prv()->i--;
+    break;
+  default:
+    throw type_mismatch("The values must be of type Double or Int64 for this operation.");
+    break;
+  }
+
+  return *this;
+}
+
+
+Value Value::operator++(int) {
+  _checkMutable();
+  Value ret;
+
+  switch (prv()->type) {
+  case Type::Double:
+    ret = prv()->d;
+    prv()->d++;
+    break;
+  case Type::Int64:
+    ret = prv()->i;
+    prv()->i++;
+    break;
+  default:
+    throw type_mismatch("The values must be of type Double or Int64 for this operation.");
+    break;
+  }
+
+  return ret;
+}
+
+
+Value Value::operator--(int) {
+  _checkMutable();
+  Value ret;
+
+  switch (prv()->type) {
+  case Type::Double:
+    ret = prv()->d;
+    prv()->d--;
+    break;
+  case Type::Int64:
+    ret = prv()->i;
+    prv()->i--;
+    break;
+  default:
+    throw type_mismatch("The values must be of type Double or Int64 for this operation.");
+    break;
+  }
+
+  return ret;
+}
+
+
+Value::operator bool() const {
+  switch (prv()->type)
+  {
+  case Type::Double:
+    return !!prv()->d;
+  case Type::Int64:
+    return !!prv()->i;
+  case Type::Bool:
+    return prv()->b;
+  default:
+    break;
+  }
+
+  return !empty();
+}
+
+
+Value::operator float() const {
+  return static_cast<float>(operator double());
+}
+
+
+Value::operator double() const {
+  switch (prv()->type)
+  {
+  case Type::Double:
+    return prv()->d;
+  case Type::Int64:
+    return static_cast<double>(prv()->i);
+  default:
+    break;
+  }
+
+  throw type_mismatch("Must be of type Double or Int64 for that operation.");
+
+  return 0.0;
+}
+
+
+Value::operator long double() const {
+  return static_cast<long double>(operator double());
+}
+
+
+#define HJSON_CONV_INT_IMPL(_T) \
+Value::operator _T() const { \
+  return static_cast<_T>(operator long long()); \
+}
+
+HJSON_CONV_INT_IMPL(char)
+HJSON_CONV_INT_IMPL(unsigned char)
+HJSON_CONV_INT_IMPL(short)
+HJSON_CONV_INT_IMPL(unsigned short)
+HJSON_CONV_INT_IMPL(int)
+HJSON_CONV_INT_IMPL(unsigned int)
+HJSON_CONV_INT_IMPL(long)
+HJSON_CONV_INT_IMPL(unsigned long)
+HJSON_CONV_INT_IMPL(unsigned long long)
+
+
+Value::operator long long() const {
+  switch (prv()->type)
+  {
+  case Type::Double:
+    return static_cast<long long>(prv()->d);
+  case Type::Int64:
+    return prv()->i;
+  default:
+    break;
+  }
+
+  throw type_mismatch("Must be of type Double or Int64 for that operation.");
+
+  return 0;
+}
+
+
+Value::operator const char*() const {
+  if (prv()->type != Type::String) {
+    throw type_mismatch("Must be of type String for that operation.");
+  }
+
+  return prv()->str_data();
+}
+
+
+Value::operator std::string() const {
+  if (prv()->type != Type::String) {
+    throw type_mismatch("Must be of type String for that operation.");
+  }
+
+  return prv()->str();
+}
+
+
+bool Value::defined() const {
+  return prv()->type != Type::Undefined;
+}
+
+
+bool Value::empty() const {
+  return (prv()->type == Type::Undefined ||
+    prv()->type == Type::Null ||
+    (prv()->type == Type::String && !prv()->str_size()) ||
+    (prv()->type == Type::Vector && !prv()->vec_size()) ||
+    (prv()->type == Type::Map && !prv()->m->size()));
+}
+
+
+Type Value::type() const {
+  return prv()->type;
+}
+
+
+bool Value::is_container() const {
+  return prv()->type == Type::Vector || prv()->type == Type::Map;
+}
+
+
+bool Value::is_numeric() const {
+  return prv()->type == Type::Double || prv()->type == Type::Int64;
+}
+
+
+size_t Value::size() const {
+  switch (prv()->type)
+  {
+  case Type::Vector:
+    return prv()->vec_size();
+  case Type::Map:
+    return prv()->m->size();
+  default:
+    break;
+  }
+
+  return 0;
+}
+
+
+void Value::reserve(size_t capacity) {
+  switch (prv()->type)
+  {
+  case Type::Vector:
+    _checkMutable();
+    switch (prv()->packed) {
+    case Type::Int64:
+      prv()->pv->vi.reserve(capacity);
+      break;
+    case Type::Double:
+      prv()->pv->vd.reserve(capacity);
+      break;
+    default:
+      prv()->v->reserve(capacity);
+      break;
+    }
+    break;
+  case Type::Map:
+    _checkMutable();
+    prv()->m->reserve(capacity);
+    break;
+  default:
+    throw type_mismatch("Must be of type Vector or Map for that operation.");
+  }
+}
+
+
+bool Value::deep_equal(const Value& other) const {
+  if (*this == other) {
+    return true;
+  }
+
+  if (this->type() != other.type() || this->size() != other.size()) {
+    return false;
+  }
+
+  switch (prv()->type)
+  {
+  case Type::Vector:
+    if (prv()->packed != Type::Undefined &&
+      other.prv()->packed != Type::Undefined)
+    {
+      if (prv()->packed != other.prv()->packed) {
+        // Int64 and Double elements are never equal.
+        return empty();
+      }
+      return prv()->packed == Type::Int64 ?
+        prv()->pv->vi == other.prv()->pv->vi :
+        prv()->pv->vd == other.prv()->pv->vd;
+    }
+    if (prv()->packed != Type::Undefined ||
+      other.prv()->packed != Type::Undefined)
+    {
+      // Compare the numbers directly, so that no mirror of Value objects is
+      // created for the packed Vector.
+      const ValueImpl *packed = (prv()->packed != Type::Undefined ? prv() :
+        other.prv());
+      const ValueVec &elems = *(packed == prv() ? other.prv()->v :
+        prv()->v);
+      for (size_t index = 0; index < elems.size(); ++index) {
+        const ValueImpl *elem = elems[index].prv();
+        double d = (packed->packed == Type::Int64 ?
+          static_cast<double>(packed->pv->vi[index]) : packed->pv->vd[index]);
+        if (elem->type == Type::Int64 && packed->packed == Type::Int64) {
+          if (elem->i != packed->pv->vi[index]) {
+            return false;
+          }
+        } else if (elem->type == Type::Int64) {
+          if (elem->i != d) {
+            return false;
+          }
+        } else if (elem->type != Type::Double || elem->d != d) {
+          return false;
+        }
+      }
+      return true;
+    }
+    {
+      auto itA = this->prv()->vec_const().begin();
+      auto endA = this->prv()->vec_const().end();
+      auto itB = other.prv()->vec_const().begin();
+      while (itA != endA) {
+        if (!itA->deep_equal(*itB)) {
+          return false;
+        }
+        ++itA;
+        ++itB;
+      }
+    }
+    return true;
+
+  case Type::Map:
+    for (auto elemA : this->prv()->m->order()) {
+      auto elemB = other.prv()->m->find(elemA->first);
+      if (!elemB || !elemA->second.deep_equal(elemB->second)) {
+        return false;
+      }
+    }
+    return true;
+
+  default:
+    break;
+  }
+
+  return false;
+}
+
+
+Value Value::clone() const {
+  if (prv()->frozen) {
+    // Nothing in a frozen tree can change, so the child elements are shared
+    // instead of copied. Each child is copied when it is first accessed for
+    // writing through the clone (see ValueImpl::thaw()).
+    Value ret(prv()->shallowCopy());
+    ret.set_comments(*this);
+    return ret;
+  }
+
+  switch (prv()->type) {
+  case Type::Vector:
+    if (prv()->packed != Type::Undefined) {
+      Value ret(prv()->shallowCopy());
+      ret.set_comments(*this);
+      return ret;
+    }
+    {
+      Value ret;
+      for (int index = 0; index < int(size()); ++index) {
+        const Value& elem = operator[](index);
+        ret.push_back(elem.prv()->frozen ? elem : elem.clone());
+      }
+      ret.set_comments(*this);
+      return ret;
+    }
+
+  case Type::Map:
+    {
+      Value ret;
+      for (int index = 0; index < size(); ++index) {
+        const Value& elem = operator[](index);
+        ret[key(index)] = elem.prv()->frozen ? elem : elem.clone();
+      }
+      ret.set_comments(*this);
+      return ret;
+    }
+
+  default:
+    break;
+  }
+
+  return *this;
+}
+
+
+void Value::freeze() {
+  // Not recursive, to avoid stack overflow for deep trees.
+  std::vector<ValueImpl*> stack(1, prv());
+
+  while (!stack.empty()) {
+    ValueImpl *node = stack.back();
+    stack.pop_back();
+    if (node->copyOnWrite()) {
+      // From the mirror of a packed Vector, already frozen.
+      node->packed = Type::Undefined;
+      continue;
+    }
+    if (node->frozen) {
+      // Already visited, or frozen before.
+      continue;
     }
+    node->frozen = true;
 
-    switch (prv->type)
-    {
+    switch (node->type) {
     case Type::Vector:
-      return prv->v[0][index];
+      if (node->packed == Type::Undefined) {
+        for (const auto &child : *node->v) {
+          stack.push_back(child.prv());
+        }
+      } else if (const ValueVec *mirror = node->pv->mirror) {
+        for (const auto &child : *mirror) {
+          stack.push_back(child.prv());
+        }
+      }
+      break;
     case Type::Map:
-      {
-        auto it = prv->m->m.find(prv->m->v[index]);
-        assert(it != prv->m->m.end());
-        return it->second;
+      // Create the lazy parts of the map now, so that reading never changes
+      // anything.
+      node->m->sorted();
+      for (auto elem : node->m->order()) {
+        stack.push_back(elem->second.prv());
       }
+      break;
     default:
       break;
     }
-  default:
-    throw type_mismatch("Must be of type Undefined, Vector or Map for that operation.");
   }
 }
 
 
-Value& Value::operator[](int index) {
-  switch (prv->type)
-  {
-  case Type::Undefined:
-    throw index_out_of_bounds("Index out of bounds.");
-  case Type::Vector:
-  case Type::Map:
-    if (index < 0 || index >= size()) {
-      throw index_out_of_bounds("Index out of bounds.");
+bool Value::is_frozen() const {
+  return prv()->frozen && !prv()->copyOnWrite();
+}
+
+
+Value::ValueImpl *Value::ValueImpl::compactCopy() const {
+  std::unordered_map<const ValueImpl*, ValueImpl*> copies;
+  // Containers whose children are being copied, and the index of the next
+  // child to copy. Not recursive, to avoid stack overflow for deep trees.
+  struct Pending {
+    const ValueImpl *src;
+    ValueImpl *dst;
+    size_t index;
+  };
+  std::vector<Pending> stack;
+
+  // Returns a new reference to the copy.
+  auto copyNode = [&](const ValueImpl *src) {
+    auto it = copies.find(src);
+    if (it != copies.end()) {
+      return it->second->addRef();
     }
 
-    switch (prv->type)
-    {
+    ValueImpl *dst;
+    switch (src->type) {
+    case Type::String:
+      dst = new ValueImpl(Type::String);
+      dst->str_append(src->str_data(), src->str_size());
+      break;
     case Type::Vector:
-      return prv->v[0][index];
+      dst = new ValueImpl(Type::Vector);
+      if (src->packed != Type::Undefined) {
+        dst->pack(src->packed);
+        dst->pv->vi.assign(src->pv->vi.begin(), src->pv->vi.end());
+        dst->pv->vd.assign(src->pv->vd.begin(), src->pv->vd.end());
+      } else {
+        // Reserved now so that the element array follows the node.
+        dst->v->reserve(src->v->size());
+        stack.push_back(Pending{src, dst, 0});
+      }
+      break;
     case Type::Map:
-      {
-        auto it = prv->m->m.find(prv->m->v[index]);
-        assert(it != prv->m->m.end());
-        return it->second;
+      dst = new ValueImpl(Type::Map);
+      dst->m->reserve(src->m->size());
+      stack.push_back(Pending{src, dst, 0});
+      break;
+    default:
+      dst = src->shallowCopy();
+      break;
+    }
+    dst->frozen = src->frozen && !src->copyOnWrite();
+    copies[src] = dst;
+
+    return dst;
+  };
+
+  ValueImpl *root = copyNode(this);
+
+  while (!stack.empty()) {
+    Pending &top = stack.back();
+    const ValueImpl *src = top.src;
+    ValueImpl *dst = top.dst;
+    bool isVector = (src->type == Type::Vector);
+
+    if (top.index >= (isVector ? src->v->size() : src->m->size())) {
+      if (!isVector && dst->frozen) {
+        // Create the lazy parts now, as freeze() does.
+        dst->m->sorted();
+      }
+      stack.pop_back();
+      continue;
+    }
+
+    size_t index = top.index++;
+    // Invalidates top, and pushes the child on the stack if it is a
+    // container, so that its children are copied before its siblings.
+    if (isVector) {
+      const Value &child = (*src->v)[index];
+      dst->v->push_back(Value(copyNode(child.prv())));
+      if (child.cm()) {
+        dst->v->back().set_comments(child);
+      }
+    } else {
+      const MapElem *elem = src->m->at(index);
+      MapElem *copy = dst->m->emplace(elem->first,
+        Value(copyNode(elem->second.prv())));
+      if (elem->second.cm()) {
+        copy->second.set_comments(elem->second);
+      }
+    }
+  }
+
+  return root;
+}
+
+
+size_t Value::ValueImpl::compactSize() const {
+  const size_t nodeBytes = _arenaSize(sizeof(ValueImpl) + resourceHeader);
+  const size_t commentsBytes = _arenaSize(sizeof(Comments) + resourceHeader);
+  std::unordered_set<const ValueImpl*> visited;
+  // Not recursive, to avoid stack overflow for deep trees.
+  std::vector<const ValueImpl*> stack(1, this);
+  size_t total = 0;
+
+  while (!stack.empty()) {
+    const ValueImpl *node = stack.back();
+    stack.pop_back();
+    if (!visited.insert(node).second) {
+      continue;
+    }
+
+    total += nodeBytes;
+    switch (node->type) {
+    case Type::String:
+      if (node->str_size() > maxShortString) {
+        total += _arenaSize(sizeof(ResourceString) + resourceHeader) +
+          _arenaSize(node->str_size() + 1);
+      }
+      break;
+    case Type::Vector:
+      // The ValueVec is created by the constructor even if the copy is packed.
+      total += _arenaSize(sizeof(ValueVec) + resourceHeader);
+      if (node->packed != Type::Undefined) {
+        total += _arenaSize(sizeof(PackedVec) + resourceHeader);
+        if (node->vec_size()) {
+          total += _arenaSize(node->vec_size() * (node->packed ==
+            Type::Int64 ? sizeof(std::int64_t) : sizeof(double)));
+        }
+      } else {
+        if (!node->v->empty()) {
+          total += _arenaSize(node->v->size() * sizeof(Value));
+        }
+        for (const auto &child : *node->v) {
+          if (child.cm()) {
+            total += commentsBytes;
+          }
+          stack.push_back(child.prv());
+        }
+      }
+      break;
+    case Type::Map:
+      total += ValueVecMap::arenaBytes(node->m->size());
+      for (auto elem : node->m->order()) {
+        if (elem->second.cm()) {
+          total += commentsBytes;
+        }
+        stack.push_back(elem->second.prv());
       }
+      break;
     default:
       break;
     }
-  default:
-    throw type_mismatch("Must be of type Undefined, Vector or Map for that operation.");
   }
+
+  return total;
 }
 
 
-bool Value::operator==(bool input) const {
-  return operator bool() == input;
+// One block of memory holding a compacted tree. Memory is never reused
+// within the block. The block is freed when everything allocated in it has
+// been deallocated. After seal(), everything is allocated with the global
+// operator new.
+class CompactArena : public MemoryResource {
+public:
+  explicit CompactArena(size_t size)
+    : pBegin(static_cast<char*>(::operator new(size))),
+    pNext(pBegin),
+    pEnd(pBegin + size),
+    sealed(false),
+    live(0)
+  {
+  }
+  ~CompactArena() {
+    ::operator delete(pBegin);
+  }
+
+  void *allocate(size_t bytes, size_t alignment) override {
+    if (!sealed && alignment <= resourceHeader &&
+      _arenaSize(bytes) <= size_t(pEnd - pNext))
+    {
+      void *p = pNext;
+      pNext += _arenaSize(bytes);
+      ++live;
+      return p;
+    }
+    return ::operator new(bytes);
+  }
+  void deallocate(void *p, size_t, size_t) override {
+    std::uintptr_t u = reinterpret_cast<std::uintptr_t>(p);
+    if (u < reinterpret_cast<std::uintptr_t>(pBegin) ||
+      u >= reinterpret_cast<std::uintptr_t>(pEnd))
+    {
+      ::operator delete(p);
+    } else if (--live == 0 && sealed) {
+      delete this;
+    }
+  }
+  void seal() {
+    sealed = true;
+    if (!live) {
+      delete this;
+    }
+  }
+
+private:
+  char *pBegin, *pNext, *pEnd;
+  bool sealed;
+  // Number of allocations in the block that have not been deallocated.
+#if HJSON_SINGLE_THREADED
+  size_t live;
+#else
+  std::atomic<size_t> live;
+#endif
+};
+
+
+void Value::compact() {
+  // If the size is too small, the rest of the tree is allocated with the
+  // global operator new.
+  CompactArena *arena = new CompactArena(prv()->compactSize());
+  ValueImpl *root;
+  {
+    MemoryResourceScope scope(arena);
+    root = prv()->compactCopy();
+  }
+  arena->seal();
+
+  _setImpl(root);
+  ValueImpl::release(root);
 }
 
 
-bool Value::operator!=(bool input) const {
-  return !(*this == input);
+// Heap bytes used by a string, or 0 if it uses its internal buffer.
+template<class S>
+static size_t _stringHeapBytes(const S &str) {
+  static const size_t internalCapacity = S().capacity();
+  return str.capacity() > internalCapacity ? str.capacity() + 1 : 0;
 }
 
 
-#define RET_VAL(_T, _O) \
-Value operator _O(_T a, const Value& b) { \
-  return Value(a) _O b; \
-} \
-Value operator _O(const Value& a, _T b) { \
-  return a _O Value(b); \
+MemoryUsage Value::memory_usage() const {
+  MemoryUsage ret;
+  std::unordered_set<const ValueImpl*> visited;
+  // Not recursive, to avoid stack overflow for deep trees.
+  std::vector<const Value*> stack(1, this);
+
+  while (!stack.empty()) {
+    const Value *val = stack.back();
+    stack.pop_back();
+
+    if (const Comments *c = val->cm()) {
+      ret.commentBytes += sizeof(Comments) +
+        _stringHeapBytes(c->m_commentBefore) +
+        _stringHeapBytes(c->m_commentKey) +
+        _stringHeapBytes(c->m_commentInside) +
+        _stringHeapBytes(c->m_commentAfter);
+    }
+
+    const ValueImpl *node = val->prv();
+    if (!visited.insert(node).second) {
+      continue;
+    }
+    ++ret.nodeCount;
+    ret.nodeBytes += sizeof(ValueImpl);
+
+    switch (node->type) {
+    case Type::String:
+      if (node->sso[ValueImpl::maxShortString] == ValueImpl::longString) {
+        ret.stringBytes += (node->external ?
+          sizeof(ResourceString) + _stringHeapBytes(*node->rs) :
+          sizeof(std::string) + _stringHeapBytes(*node->s));
+      }
+      break;
+    case Type::Vector:
+      if (node->packed != Type::Undefined) {
+        size_t capacity = node->pv->vi.capacity() + node->pv->vd.capacity();
+        ret.vectorBytes += sizeof(PackedVec) + capacity * sizeof(double);
+        ret.vectorSlackBytes += (capacity - node->vec_size()) *
+          sizeof(double);
+        if (const ValueVec *mirror = node->pv->mirror) {
+          ret.vectorBytes += sizeof(ValueVec) +
+            mirror->capacity() * sizeof(Value);
+          for (const auto &child : *mirror) {
+            stack.push_back(&child);
+          }
+        }
+      } else {
+        ret.vectorBytes += sizeof(ValueVec) +
+          node->v->capacity() * sizeof(Value);
+        ret.vectorSlackBytes += (node->v->capacity() - node->v->size()) *
+          sizeof(Value);
+        for (const auto &child : *node->v) {
+          stack.push_back(&child);
+        }
+      }
+      break;
+    case Type::Map:
+      ret.mapBytes += node->m->memory_usage();
+      for (auto elem : node->m->order()) {
+        ret.keyBytes += _stringHeapBytes(elem->first);
+        stack.push_back(&elem->second);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  return ret;
 }
 
-#define RET_BOOL(_T, _O) \
-bool operator _O(_T a, const Value& b) { \
-  return Value(a) _O b; \
-} \
-bool operator _O(const Value& a, _T b) { \
-  return a _O Value(b); \
+
+static size_t _hashCombine(size_t h, size_t v) {
+  return h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
 }
 
-#define HJSON_OP_IMPL_A(_T) \
-RET_BOOL(_T, <) \
-RET_BOOL(_T, >) \
-RET_BOOL(_T, <=) \
-RET_BOOL(_T, >=) \
-RET_BOOL(_T, ==) \
-RET_BOOL(_T, !=)
 
-#define HJSON_OP_IMPL_B(_T) \
-HJSON_OP_IMPL_A(_T) \
-RET_VAL(_T, +) \
-RET_VAL(_T, -) \
-RET_VAL(_T, *) \
-RET_VAL(_T, /)
+void Value::dedupe(bool subtrees) {
+  // The nodes that other equal nodes are replaced by. Each Value owns a
+  // reference, so that a node cannot be destroyed while it is in the table.
+  std::unordered_multimap<size_t, Value> table;
+
+  auto sameComments = [](const Value &a, const Value &b) {
+    const Comments *ca = a.cm(), *cb = b.cm();
+    if (!ca || !cb) {
+      const Comments *c = (ca ? ca : cb);
+      return !c || (c->m_commentBefore.empty() && c->m_commentKey.empty() &&
+        c->m_commentInside.empty() && c->m_commentAfter.empty());
+    }
+    return ca->m_commentBefore == cb->m_commentBefore &&
+      ca->m_commentKey == cb->m_commentKey &&
+      ca->m_commentInside == cb->m_commentInside &&
+      ca->m_commentAfter == cb->m_commentAfter;
+  };
+
+  // The children of a Vector or Map have already been replaced when the
+  // container itself is compared, so it is enough to compare the children's
+  // node pointers instead of comparing the subtrees.
+  auto hashNode = [](const ValueImpl *node) {
+    size_t h = static_cast<size_t>(node->type);
+    switch (node->type) {
+    case Type::Bool:
+      return _hashCombine(h, node->b);
+    case Type::Double:
+      {
+        std::uint64_t bits;
+        memcpy(&bits, &node->d, sizeof(bits));
+        return _hashCombine(h, static_cast<size_t>(bits));
+      }
+    case Type::Int64:
+      return _hashCombine(h, static_cast<size_t>(node->i));
+    case Type::String:
+      return _hashCombine(h, hashKey(node->str_data(), node->str_size()));
+    case Type::Vector:
+      switch (node->packed) {
+      case Type::Int64:
+        return _hashCombine(h, hashKey(reinterpret_cast<const char*>(
+          node->pv->vi.data()), node->pv->vi.size() * sizeof(std::int64_t)));
+      case Type::Double:
+        return _hashCombine(h, hashKey(reinterpret_cast<const char*>(
+          node->pv->vd.data()), node->pv->vd.size() * sizeof(double)));
+      default:
+        for (const auto &child : *node->v) {
+          h = _hashCombine(h, std::hash<const void*>()(child.prv()));
+        }
+        return h;
+      }
+    case Type::Map:
+      for (size_t index = 0; index < node->m->size(); ++index) {
+        auto elem = node->m->at(index);
+        h = _hashCombine(h, hashKey(elem->first.data(), elem->first.size()));
+        h = _hashCombine(h, std::hash<const void*>()(elem->second.prv()));
+      }
+      return h;
+    default:
+      return h;
+    }
+  };
+
+  auto sameNode = [&sameComments](const ValueImpl *a, const ValueImpl *b) {
+    if (a->type != b->type) {
+      return false;
+    }
+    switch (a->type) {
+    case Type::Bool:
+      return a->b == b->b;
+    case Type::Double:
+      // Compare the bits, so that 0.0 and -0.0 are not merged.
+      return !memcmp(&a->d, &b->d, sizeof(double));
+    case Type::Int64:
+      return a->i == b->i;
+    case Type::String:
+      return !a->str_compare(*b);
+    case Type::Vector:
+      if (a->packed != b->packed) {
+        return false;
+      }
+      switch (a->packed) {
+      case Type::Int64:
+        return a->pv->vi == b->pv->vi;
+      case Type::Double:
+        return a->pv->vd.size() == b->pv->vd.size() && !memcmp(
+          a->pv->vd.data(), b->pv->vd.data(), a->pv->vd.size() * sizeof(double));
+      default:
+        if (a->v->size() != b->v->size()) {
+          return false;
+        }
+        for (size_t index = 0; index < a->v->size(); ++index) {
+          const Value &ca = (*a->v)[index], &cb = (*b->v)[index];
+          if (ca.prv() != cb.prv() || !sameComments(ca, cb)) {
+            return false;
+          }
+        }
+        return true;
+      }
+    case Type::Map:
+      if (a->m->size() != b->m->size()) {
+        return false;
+      }
+      for (size_t index = 0; index < a->m->size(); ++index) {
+        auto ea = a->m->at(index), eb = b->m->at(index);
+        if (ea->first != eb->first || ea->second.prv() != eb->second.prv() ||
+          !sameComments(ea->second, eb->second))
+        {
+          return false;
+        }
+      }
+      return true;
+    default:
+      return true;
+    }
+  };
+
+  auto replace = [&](Value &slot) {
+    ValueImpl *node = slot.prv();
+    // A String that is not frozen can only be shared if no other Value refers
+    // to it, since it would otherwise be possible to change the String through
+    // that Value. Other types are only shared if they are frozen, but not if
+    // they come from the mirror of a packed Vector.
+    if (node->type == Type::String ? (!node->frozen && node->refCount != 1) :
+      (!subtrees || !node->frozen || node->copyOnWrite() ||
+      node->type == Type::Undefined))
+    {
+      return;
+    }
+    size_t h = hashNode(node);
+    auto range = table.equal_range(h);
+    for (auto it = range.first; it != range.second; ++it) {
+      ValueImpl *other = it->second.prv();
+      if (other == node) {
+        return;
+      }
+      if (sameNode(other, node)) {
+        // Writing through a mutable parent copies the frozen node.
+        other->frozen = true;
+        slot._setImpl(other);
+        return;
+      }
+    }
+    table.emplace(h, Value(node->addRef()));
+  };
+
+  // Not recursive, to avoid stack overflow for deep trees. Each entry is a
+  // Vector or Map and the index of the next child to visit.
+  std::vector<std::pair<Value*, size_t> > stack;
+  if ((prv()->type == Type::Vector && prv()->packed == Type::Undefined) ||
+    prv()->type == Type::Map)
+  {
+    stack.emplace_back(this, 0);
+  }
+
+  while (!stack.empty()) {
+    ValueImpl *node = stack.back().first->prv();
+    size_t index = stack.back().second++;
+    bool isVector = (node->type == Type::Vector);
+
+    if (index >= (isVector ? node->v->size() : node->m->size())) {
+      Value *done = stack.back().first;
+      stack.pop_back();
+      if (!stack.empty()) {
+        replace(*done);
+      }
+      continue;
+    }
+
+    Value &child = (isVector ? (*node->v)[index] :
+      node->m->at(index)->second);
+    // Children of a container that is shared with another tree are left as
+    // they are.
+    if (child.prv()->ownsChildren()) {
+      stack.emplace_back(&child, 0);
+    } else {
+      replace(child);
+    }
+  }
+}
+
+
+void Value::clear() {
+  switch (prv()->type) {
+  case Type::Vector:
+    _checkMutable();
+    if (prv()->packed != Type::Undefined) {
+      prv()->recreate(Type::Vector);
+    } else {
+      prv()->v->clear();
+    }
+    break;
+
+  case Type::Map:
+    _checkMutable();
+    prv()->m->clear();
+    break;
+
+  default:
+    break;
+  }
+}
+
+
+void Value::erase(int index) {
+  _checkMutable();
+
+  switch (prv()->type)
+  {
+  case Type::Undefined:
+  case Type::Vector:
+  case Type::Map:
+    if (index < 0 || index >= size()) {
+      throw index_out_of_bounds("Index out of bounds.");
+    }
+
+    switch (prv()->type)
+    {
+    case Type::Vector:
+      if (prv()->packed == Type::Int64) {
+        prv()->vec_forget_mirror();
+        prv()->pv->vi.erase(prv()->pv->vi.begin() + index);
+      } else if (prv()->packed == Type::Double) {
+        prv()->vec_forget_mirror();
+        prv()->pv->vd.erase(prv()->pv->vd.begin() + index);
+      } else {
+        prv()->vec().erase(prv()->v->begin() + index);
+      }
+      break;
+    case Type::Map:
+      prv()->m->erase(prv()->m->at(index)->first);
+      break;
+    default:
+      break;
+    }
+    break;
 
-#define HJSON_OP_IMPL_C(_T) \
-HJSON_OP_IMPL_B(_T) \
-RET_VAL(_T, %)
+  default:
+    throw type_mismatch("Must be of type Vector or Map for that operation.");
+  }
+}
 
-HJSON_OP_IMPL_A(const char*)
-HJSON_OP_IMPL_A(const std::string&)
-HJSON_OP_IMPL_B(float)
-HJSON_OP_IMPL_B(double)
-HJSON_OP_IMPL_B(long double)
-HJSON_OP_IMPL_C(char)
-HJSON_OP_IMPL_C(unsigned char)
-HJSON_OP_IMPL_C(short)
-HJSON_OP_IMPL_C(unsigned short)
-HJSON_OP_IMPL_C(int)
-HJSON_OP_IMPL_C(unsigned int)
-HJSON_OP_IMPL_C(long)
-HJSON_OP_IMPL_C(unsigned long)
-HJSON_OP_IMPL_C(long long)
-HJSON_OP_IMPL_C(unsigned long long)
 
+void Value::push_back(const Value& other) {
+  _checkMutable();
+
+  if (prv()->type == Type::Undefined) {
+    prv()->recreate(Type::Vector);
+  } else if (prv()->type != Type::Vector) {
+    throw type_mismatch("Must be of type Undefined or Vector for that operation.");
+  }
 
-std::string operator+(const char *a, const Value& b) {
-  return std::string(a) + b.to_string();
+  prv()->vec_push(Value(other));
 }
 
 
-std::string operator+(const Value& a ,const char *b) {
-  return  a.to_string() + std::string(b);
-}
+void Value::push_back(Value&& other) {
+  _checkMutable();
 
+  if (prv()->type == Type::Undefined) {
+    prv()->recreate(Type::Vector);
+  } else if (prv()->type != Type::Vector) {
+    throw type_mismatch("Must be of type Undefined or Vector for that operation.");
+  }
 
-std::string operator+(const std::string &a, const Value& b) {
-  return a + b.to_string();
+  prv()->vec_push(std::move(other));
 }
 
 
-std::string operator+(const Value& a, const std::string &b) {
-  return a.to_string() + b;
+Type Value::packed_type() const {
+  return prv()->type == Type::Vector ? prv()->packed : Type::Undefined;
 }
 
 
-Value operator+(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d + b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i + b.prv->d;
+Span<const double> Value::double_span() const {
+  if (packed_type() != Type::Double) {
+    return Span<const double>();
   }
 
-  if (a.prv->type != b.prv->type) {
-    throw type_mismatch("The values must be of the same type for this operation.");
-  }
+  return Span<const double>(prv()->pv->vd.data(), prv()->pv->vd.size());
+}
 
-  switch (a.prv->type) {
-  case Type::Double:
-    return a.prv->d + b.prv->d;
-  case Type::Int64:
-    return a.prv->i + b.prv->i;
-  case Type::String:
-    return *a.prv->s + *b.prv->s;
-  default:
-    break;
+
+Span<const std::int64_t> Value::int64_span() const {
+  if (packed_type() != Type::Int64) {
+    return Span<const std::int64_t>();
   }
 
-  throw type_mismatch("The values must be of type Double, Int64 or String for this operation.");
+  return Span<const std::int64_t>(prv()->pv->vi.data(), prv()->pv->vi.size());
 }
 
 
-bool operator<(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d < b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i < b.prv->d;
-  }
+void Value::move(int from, int to) {
+  _checkMutable();
 
-  if (a.prv->type != b.prv->type) {
-    throw type_mismatch("The values must be of the same type for this operation.");
-  }
+  switch (prv()->type)
+  {
+  case Type::Undefined:
+  case Type::Vector:
+  case Type::Map:
+    if (from < 0 || to < 0 || from >= size() || to > size()) {
+      throw index_out_of_bounds("Index out of bounds.");
+    }
 
-  switch (a.prv->type) {
-  case Type::Double:
-    return a.prv->d < b.prv->d;
-  case Type::Int64:
-    return a.prv->i < b.prv->i;
-  case Type::String:
-    return *a.prv->s < *b.prv->s;
-  default:
-    break;
-  }
+    if (from == to) {
+      return;
+    }
 
-  throw type_mismatch("The values must be of type Double, Int64 or String for this operation.");
-}
+    switch (prv()->type)
+    {
+    case Type::Vector:
+      {
+        auto it = prv()->vec().begin();
 
+        prv()->v->insert(it + to, it[from]);
+        if (to < from) {
+          ++from;
+        }
+        prv()->v->erase(prv()->v->begin() + from);
+      }
+      break;
+    case Type::Map:
+      prv()->m->move(from, to);
+      break;
+    default:
+      break;
+    }
+    break;
 
-bool operator>(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d > b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i > b.prv->d;
+  default:
+    throw type_mismatch("Must be of type Vector or Map for that operation.");
   }
+}
 
-  if (a.prv->type != b.prv->type) {
-    throw type_mismatch("The values must be of the same type for this operation.");
-  }
 
-  switch (a.prv->type) {
-  case Type::Double:
-    return a.prv->d > b.prv->d;
-  case Type::Int64:
-    return a.prv->i > b.prv->i;
-  case Type::String:
-    return *a.prv->s > *b.prv->s;
+std::string Value::key(int index) const {
+  switch (prv()->type)
+  {
+  case Type::Undefined:
+  case Type::Map:
+    if (index < 0 || index >= size()) {
+      throw index_out_of_bounds("Index out of bounds.");
+    }
+    return prv()->m->at(index)->first;
   default:
-    break;
+    throw type_mismatch("Must be of type Map for that operation.");
   }
-
-  throw type_mismatch("The values must be of type Double, Int64 or String for this operation.");
 }
 
 
-bool operator<=(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d <= b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i <= b.prv->d;
+Value::iterator Value::begin() {
+  if (prv()->type != Type::Map) {
+    return iterator();
   }
+  _checkMutable();
 
-  if (a.prv->type != b.prv->type) {
-    throw type_mismatch("The values must be of the same type for this operation.");
-  }
+  auto &v = prv()->m->sorted();
+  return iterator(v.data());
+}
 
-  switch (a.prv->type) {
-  case Type::Double:
-    return a.prv->d <= b.prv->d;
-  case Type::Int64:
-    return a.prv->i <= b.prv->i;
-  case Type::String:
-    return *a.prv->s <= *b.prv->s;
-  default:
-    break;
+
+Value::iterator Value::end() {
+  if (prv()->type != Type::Map) {
+    return iterator();
   }
+  _checkMutable();
 
-  throw type_mismatch("The values must be of type Double, Int64 or String for this operation.");
+  auto &v = prv()->m->sorted();
+  return iterator(v.data() + v.size());
 }
 
 
-bool operator>=(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d >= b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i >= b.prv->d;
+Value::const_iterator Value::begin() const {
+  if (prv()->type != Type::Map) {
+    return const_iterator();
   }
 
-  if (a.prv->type != b.prv->type) {
-    throw type_mismatch("The values must be of the same type for this operation.");
-  }
+  auto &v = prv()->m->sorted();
+  return const_iterator(v.data());
+}
 
-  switch (a.prv->type) {
-  case Type::Double:
-    return a.prv->d >= b.prv->d;
-  case Type::Int64:
-    return a.prv->i >= b.prv->i;
-  case Type::String:
-    return *a.prv->s >= *b.prv->s;
-  default:
-    break;
+
+Value::const_iterator Value::end() const {
+  if (prv()->type != Type::Map) {
+    return const_iterator();
   }
 
-  throw type_mismatch("The values must be of type Double, Int64 or String for this operation.");
+  auto &v = prv()->m->sorted();
+  return const_iterator(v.data() + v.size());
 }
 
 
-bool operator==(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d == b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i == b.prv->d;
+Value::iterator Value::insertion_begin() {
+  if (prv()->type != Type::Map) {
+    return iterator();
   }
+  _checkMutable();
 
-  if (a.prv->type != b.prv->type) {
-    return false;
-  }
+  auto &v = prv()->m->order();
+  return iterator(v.data());
+}
 
-  switch (a.prv->type) {
-  case Type::Undefined:
-  case Type::Null:
-    return true;
-  case Type::Bool:
-    return a.prv->b == b.prv->b;
-  case Type::Double:
-    return a.prv->d == b.prv->d;
-  case Type::String:
-    return *a.prv->s == *b.prv->s;
-  case Type::Vector:
-    return a.prv->v == b.prv->v;
-  case Type::Map:
-    return a.prv->m == b.prv->m;
-  case Type::Int64:
-    return a.prv->i == b.prv->i;
-  }
 
-  assert(!"Unknown type");
+Value::iterator Value::insertion_end() {
+  if (prv()->type != Type::Map) {
+    return iterator();
+  }
+  _checkMutable();
 
-  return false;
+  auto &v = prv()->m->order();
+  return iterator(v.data() + v.size());
 }
 
 
-bool operator!=(const Value& a, const Value& b) {
-  return !(a == b);
+Value::const_iterator Value::insertion_begin() const {
+  if (prv()->type != Type::Map) {
+    return const_iterator();
+  }
+
+  auto &v = prv()->m->order();
+  return const_iterator(v.data());
 }
 
 
-Value operator-(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d - b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i - b.prv->d;
+Value::const_iterator Value::insertion_end() const {
+  if (prv()->type != Type::Map) {
+    return const_iterator();
   }
 
-  if (a.prv->type != b.prv->type) {
-    throw type_mismatch("The values must be of the same type for this operation.");
-  }
+  auto &v = prv()->m->order();
+  return const_iterator(v.data() + v.size());
+}
 
-  switch (a.prv->type) {
-  case Type::Double:
-    return a.prv->d - b.prv->d;
-  case Type::Int64:
-    return a.prv->i - b.prv->i;
-  default:
-    break;
+
+size_t Value::erase(const std::string &key) {
+  if (prv()->type == Type::Undefined) {
+    return 0;
+  } else if (prv()->type != Type::Map) {
+    throw type_mismatch("Must be of type Map for that operation.");
   }
+  _checkMutable();
 
-  throw type_mismatch("The values must be of type Double or Int64 for this operation.");
+  return prv()->m->erase(key) ? 1 : 0;
 }
 
 
-Value operator*(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d * b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i * b.prv->d;
-  }
+bool Value::insert_or_assign(std::string key, Value val) {
+  _checkMutable();
 
-  if (a.prv->type != b.prv->type) {
-    throw type_mismatch("The values must be of the same type for this operation.");
+  if (prv()->type == Type::Undefined) {
+    prv()->recreate(Type::Map);
+  } else if (prv()->type != Type::Map) {
+    throw type_mismatch("Must be of type Undefined or Map for that operation.");
   }
 
-  switch (a.prv->type) {
-  case Type::Double:
-    return a.prv->d * b.prv->d;
-  case Type::Int64:
-    return a.prv->i * b.prv->i;
-  default:
-    break;
+  // Neither "key" nor "val" is moved from if the key already exists.
+  size_t oldSize = prv()->m->size();
+  auto elem = prv()->m->emplace(std::move(key), std::move(val));
+  if (prv()->m->size() == oldSize) {
+    elem->second = std::move(val);
+    return false;
   }
 
-  throw type_mismatch("The values must be of type Double or Int64 for this operation.");
+  return true;
 }
 
 
-Value operator/(const Value& a, const Value& b) {
-  if (a.prv->type == Type::Double && b.prv->type == Type::Int64) {
-    return a.prv->d / b.prv->i;
-  } else if (a.prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    return a.prv->i / b.prv->d;
-  }
+size_t Value::erase(const char *key) {
+  return erase(std::string(key));
+}
 
-  if (a.prv->type != b.prv->type) {
-    throw type_mismatch("The values must be of the same type for this operation.");
-  }
 
-  switch (a.prv->type) {
+double Value::to_double() const {
+  switch (prv()->type) {
+  case Type::Undefined:
+  case Type::Null:
+    return 0.0;
+  case Type::Bool:
+    return (prv()->b ? 1.0 : 0.0);
   case Type::Double:
-    return a.prv->d / b.prv->d;
+    return prv()->d;
   case Type::Int64:
-    return a.prv->i / b.prv->i;
-  default:
-    break;
-  }
-
-  throw type_mismatch("The values must be of type Double or Int64 for this operation.");
-}
+    return static_cast<double>(prv()->i);
+  case Type::String:
+    {
+      std::int64_t i;
+      double ret;
+      switch (prv()->str_number(&i, &ret)) {
+      case Type::Int64:
+        return static_cast<double>(i);
+      case Type::Double:
+        return ret;
+      default:
+        break;
+      }
 
+      if (!_parseDouble(&ret, prv()->str_data(), prv()->str_size())) {
+        return 0.0;
+      }
 
-Value operator%(const Value& a, const Value& b) {
-  if (a.prv->type != b.prv->type || a.prv->type != Type::Int64) {
-    throw type_mismatch("The values must be of the Int64 type for this operation.");
+      return ret;
+    }
+  default:
+    break;
   }
 
-  return a.prv->i % b.prv->i;
-}
-
-
-#define OP_ASS(_O, _T) \
-Value& Value::operator _O(_T b) { \
-  return operator _O(Value(b)); \
+  throw type_mismatch("Illegal type for this operation.");
 }
 
-#define HJSON_ASS_IMPL_A(_T) \
-OP_ASS(+=, _T) \
-OP_ASS(-=, _T) \
-OP_ASS(*=, _T) \
-OP_ASS(/=, _T)
-
-#define HJSON_ASS_IMPL_B(_T) \
-HJSON_ASS_IMPL_A(_T) \
-OP_ASS(%=, _T)
 
-HJSON_ASS_IMPL_A(float)
-HJSON_ASS_IMPL_A(double)
-HJSON_ASS_IMPL_A(long double)
-HJSON_ASS_IMPL_B(char)
-HJSON_ASS_IMPL_B(unsigned char)
-HJSON_ASS_IMPL_B(short)
-HJSON_ASS_IMPL_B(unsigned short)
-HJSON_ASS_IMPL_B(int)
-HJSON_ASS_IMPL_B(unsigned int)
-HJSON_ASS_IMPL_B(long)
-HJSON_ASS_IMPL_B(unsigned long)
-HJSON_ASS_IMPL_B(long long)
-HJSON_ASS_IMPL_B(unsigned long long)
+std::int64_t Value::to_int64() const {
+  switch (prv()->type) {
+  case Type::Undefined:
+  case Type::Null:
+    return 0;
+  case Type::Bool:
+    return (prv()->b ? 1 : 0);
+  case Type::Double:
+    return static_cast<std::int64_t>(prv()->d);
+  case Type::Int64:
+    return prv()->i;
+  case Type::String:
+    {
+      std::int64_t ret;
+      double d;
+      switch (prv()->str_number(&ret, &d)) {
+      case Type::Int64:
+        return ret;
+      case Type::Double:
+        return static_cast<std::int64_t>(d);
+      default:
+        break;
+      }
 
+#if HJSON_USE_CHARCONV
+      const char *pCh = prv()->str_data();
+      const char *pEnd = pCh + prv()->str_size();
 
-Value& Value::operator+=(const char *b) {
-  return operator+=(std::string(b));
-}
+      auto res = std::from_chars(pCh, pEnd, ret);
 
+      if (res.ec != std::errc() || res.ptr != pEnd) {
+#elif HJSON_USE_STRTOD
+      const char *pCh = prv()->str_data();
+      char *endptr;
+      errno = 0;
 
-Value& Value::operator+=(const std::string& b) {
-  if (prv->type != Type::String) {
-    throw type_mismatch("The value must be of type String for this operation.");
-  }
+      ret = std::strtoll(pCh, &endptr, 0);
 
-  *prv->s += b;
+      if (errno || endptr - pCh != prv()->str_size()) {
+#else
+      std::stringstream ss(prv()->str());
 
-  return *this;
-}
+      // Avoid localization surprises.
+      ss.imbue(std::locale::classic());
 
+      ss >> ret;
 
-Value& Value::operator+=(const Value& b) {
-  if (prv->type == Type::Double && b.prv->type == Type::Int64) {
-    prv->d += b.prv->i;
-  } else if (prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    prv->i += static_cast<int64_t>(b.prv->d);
-  } else {
-    if (prv->type != b.prv->type) {
-      throw type_mismatch("The values must be of the same type for this operation.");
-    }
+      if (!ss.eof() || ss.fail()) {
+#endif
+        // Perhaps the string contains a decimal point or exponential part.
+        return static_cast<std::int64_t>(to_double());
+      }
 
-    switch (prv->type) {
-    case Type::Double:
-      prv->d += b.prv->d;
-      break;
-    case Type::Int64:
-      prv->i += b.prv->i;
-      break;
-    case Type::String:
-      *prv->s += *b.prv->s;
-      break;
-    default:
-      throw type_mismatch("The values must be of type Double, Int64 or String for this operation.");
-      break;
+      return ret;
     }
+  default:
+    break;
   }
 
-  return *this;
+  throw type_mismatch("Illegal type for this operation.");
 }
 
 
-Value& Value::operator-=(const Value& b) {
-  operator +=(-b);
+bool Value::try_get(bool *pOut) const {
+  if (prv()->type != Type::Bool) {
+    return false;
+  }
 
-  return *this;
+  *pOut = prv()->b;
+  return true;
 }
 
 
-Value& Value::operator*=(const Value& b) {
-  if (prv->type == Type::Double && b.prv->type == Type::Int64) {
-    prv->d *= b.prv->i;
-  } else if (prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    prv->i = static_cast<int64_t>(prv->i * b.prv->d);
-  } else {
-    if (prv->type != b.prv->type) {
-      throw type_mismatch("The values must be of the same type for this operation.");
-    }
-
-    switch (prv->type) {
-    case Type::Double:
-      prv->d *= b.prv->d;
-      break;
-    case Type::Int64:
-      prv->i *= b.prv->i;
-      break;
-    default:
-      throw type_mismatch("The values must be of type Double or Int64 for this operation.");
-      break;
-    }
+bool Value::try_get(double *pOut) const {
+  switch (prv()->type) {
+  case Type::Double:
+    *pOut = prv()->d;
+    return true;
+  case Type::Int64:
+    *pOut = static_cast<double>(prv()->i);
+    return true;
+  default:
+    return false;
   }
-
-  return *this;
 }
 
 
-Value& Value::operator/=(const Value& b) {
-  if (prv->type == Type::Double && b.prv->type == Type::Int64) {
-    prv->d /= b.prv->i;
-  } else if (prv->type == Type::Int64 && b.prv->type == Type::Double) {
-    prv->i = static_cast<int64_t>(prv->i / b.prv->d);
-  } else {
-    if (prv->type != b.prv->type) {
-      throw type_mismatch("The values must be of the same type for this operation.");
-    }
+bool Value::try_get(std::int64_t *pOut) const {
+  switch (prv()->type) {
+  case Type::Double:
+    *pOut = static_cast<std::int64_t>(prv()->d);
+    return true;
+  case Type::Int64:
+    *pOut = prv()->i;
+    return true;
+  default:
+    return false;
+  }
+}
 
-    switch (prv->type) {
-    case Type::Double:
-      prv->d /= b.prv->d;
-      break;
-    case Type::Int64:
-      prv->i /= b.prv->i;
-      break;
-    default:
-      throw type_mismatch("The values must be of type Double or Int64 for this operation.");
-      break;
-    }
+
+bool Value::try_get(std::string *pOut) const {
+  if (prv()->type != Type::String) {
+    return false;
   }
 
-  return *this;
+  pOut->assign(prv()->str_data(), prv()->str_size());
+  return true;
 }
 
 
-Value& Value::operator%=(const Value& b) {
-  if (prv->type != b.prv->type || prv->type != Type::Int64) {
-    throw type_mismatch("The values must be of the Int64 type for this operation.");
+bool Value::try_get(const char **pOut) const {
+  if (prv()->type != Type::String) {
+    return false;
   }
 
-  prv->i %= b.prv->i;
+  *pOut = prv()->str_data();
+  return true;
+}
+
 
-  return *this;
+template<>
+const bool* Value::get_if<bool>() const {
+  return prv()->type == Type::Bool ? &prv()->b : 0;
 }
 
 
-Value Value::operator+() const {
-  switch (prv->type) {
-  case Type::Double:
-    return prv->d;
-  case Type::Int64:
-    return prv->i;
-  default:
-    throw type_mismatch("The value must be of type Double or Int64 for this operation.");
-    break;
-  }
+template<>
+const double* Value::get_if<double>() const {
+  return prv()->type == Type::Double ? &prv()->d : 0;
+}
 
-  return *this;
+
+template<>
+const std::int64_t* Value::get_if<std::int64_t>() const {
+  return prv()->type == Type::Int64 ? &prv()->i : 0;
 }
 
 
-Value Value::operator-() const {
-  switch (prv->type) {
+std::string Value::to_string() const {
+  switch (prv()->type) {
+  case Type::Undefined:
+    return "";
+  case Type::Null:
+    return "null";
+  case Type::Bool:
+    return (prv()->b ? "true" : "false");
   case Type::Double:
-    return -prv->d;
+    {
+      char buf[32];
+      return std::string(buf, formatDouble(buf, prv()->d));
+    }
   case Type::Int64:
-    return -prv->i;
+    {
+      char buf[32];
+      return std::string(buf, formatInt64(buf, prv()->i));
+    }
+  case Type::String:
+    return prv()->str();
   default:
-    throw type_mismatch("The value must be of type Double or Int64 for this operation.");
     break;
   }
 
-  return *this;
+  throw type_mismatch("Illegal type for this operation.");
 }
 
 
-Value& Value::operator++() {
-  switch (prv->type) {
-  case Type::Double:
-    prv->d++;
-    break;
-  case Type::Int64:
-    prv->i++;
-    break;
-  default:
-    throw type_mismatch("The values must be of type Double or Int64 for this operation.");
-    break;
+void Value::set_comment_before(const std::string& str) {
+  if (!cm() && str.empty()) {
+    return;
   }
 
-  return *this;
+  _getComments()->m_commentBefore = str;
 }
 
 
-Value& Value::operator--() {
-  switch (prv->type) {
-  case Type::Double:
-    prv->d--;
-    break;
-  case Type::Int64:
-    prv->i--;
-    break;
-  default:
-    throw type_mismatch("The values must be of type Double or Int64 for this operation.");
-    break;
+std::string Value::get_comment_before() const {
+  if (Comments *c = cm()) {
+    return c->m_commentBefore;
   }
 
-  return *this;
+  return "";
 }
 
 
-Value Value::operator++(int) {
-  Value ret;
-
-  switch (prv->type) {
-  case Type::Double:
-    ret = prv->d;
-    prv->d++;
-    break;
-  case Type::Int64:
-    ret = prv->i;
-    prv->i++;
-    break;
-  default:
-    throw type_mismatch("The values must be of type Double or Int64 for this operation.");
-    break;
+void Value::set_comment_key(const std::string& str) {
+  if (!cm() && str.empty()) {
+    return;
   }
 
-  return ret;
+  _getComments()->m_commentKey = str;
 }
 
 
-Value Value::operator--(int) {
-  Value ret;
+std::string Value::get_comment_key() const {
+  if (Comments *c = cm()) {
+    return c->m_commentKey;
+  }
 
-  switch (prv->type) {
-  case Type::Double:
-    ret = prv->d;
-    prv->d--;
-    break;
-  case Type::Int64:
-    ret = prv->i;
-    prv->i--;
-    break;
-  default:
-    throw type_mismatch("The values must be of type Double or Int64 for this operation.");
-    break;
+  return "";
+}
+
+
+void Value::set_comment_inside(const std::string& str) {
+  if (!cm() && str.empty()) {
+    return;
   }
 
-  return ret;
+  _getComments()->m_commentInside = str;
 }
 
 
-Value::operator bool() const {
-  switch (prv->type)
-  {
-  case Type::Double:
-    return !!prv->d;
-  case Type::Int64:
-    return !!prv->i;
-  case Type::Bool:
-    return prv->b;
-  default:
-    break;
+std::string Value::get_comment_inside() const {
+  if (Comments *c = cm()) {
+    return c->m_commentInside;
   }
 
-  return !empty();
+  return "";
 }
 
 
-Value::operator float() const {
-  return static_cast<float>(operator double());
+void Value::set_comment_after(const std::string& str) {
+  if (!cm() && str.empty()) {
+    return;
+  }
+
+  _getComments()->m_commentAfter = str;
 }
 
 
-Value::operator double() const {
-  switch (prv->type)
-  {
-  case Type::Double:
-    return prv->d;
-  case Type::Int64:
-    return static_cast<double>(prv->i);
-  default:
-    break;
+std::string Value::get_comment_after() const {
+  if (Comments *c = cm()) {
+    return c->m_commentAfter;
   }
 
-  throw type_mismatch("Must be of type Double or Int64 for that operation.");
+  return "";
+}
 
-  return 0.0;
+
+void Value::set_comments(const Value& other) {
+  if (Comments *oc = other.cm()) {
+    Comments *c = _getComments();
+    if (c != oc) {
+      c->m_commentBefore = oc->m_commentBefore;
+      c->m_commentKey = oc->m_commentKey;
+      c->m_commentInside = oc->m_commentInside;
+      c->m_commentAfter = oc->m_commentAfter;
+    }
+  } else {
+    clear_comments();
+  }
 }
 
 
-Value::operator long double() const {
-  return static_cast<long double>(operator double());
+void Value::clear_comments() {
+  if (Comments *c = cm()) {
+    ptr = reinterpret_cast<std::uintptr_t>(c->node->addRef());
+    if (--c->refCount == 0) {
+      ValueImpl::release(c->node);
+      Comments::destroy(c);
+    }
+  }
 }
 
 
-#define HJSON_CONV_INT_IMPL(_T) \
-Value::operator _T() const { \
-  return static_cast<_T>(operator long long()); \
+Value& Value::assign_with_comments(const Value& other) {
+  // If this object is of type Undefined set_comments() will be called in the
+  // assignment operator, no need to call it here.
+  if (defined()) {
+    set_comments(other);
+  }
+  return operator=(other);
 }
 
-HJSON_CONV_INT_IMPL(char)
-HJSON_CONV_INT_IMPL(unsigned char)
-HJSON_CONV_INT_IMPL(short)
-HJSON_CONV_INT_IMPL(unsigned short)
-HJSON_CONV_INT_IMPL(int)
-HJSON_CONV_INT_IMPL(unsigned int)
-HJSON_CONV_INT_IMPL(long)
-HJSON_CONV_INT_IMPL(unsigned long)
-HJSON_CONV_INT_IMPL(unsigned long long)
 
+Value& Value::assign_with_comments(Value&& other) {
+  // If this object is of type Undefined set_comments() will be called in the
+  // assignment operator, no need to call it here.
+  if (defined()) {
+    _takeComments(other);
+  }
+  return operator=(std::move(other));
+}
 
-Value::operator long long() const {
-  switch (prv->type)
-  {
-  case Type::Double:
-    return static_cast<long long>(prv->d);
-  case Type::Int64:
-    return prv->i;
-  default:
-    break;
+
+MapProxy::MapProxy(ValueImpl *_parent, const std::string &_key,
+  Value *_pTarget)
+  : Value(_pTarget ? _pTarget->prv()->addRef() : new ValueImpl(Type::Undefined)),
+    parentPrv(_parent->addRef()),
+    key(_key),
+    pTarget(_pTarget),
+    wasAssigned(false)
+{
+  if (_pTarget && _pTarget->cm()) {
+    if (_parent->frozen) {
+      // Sharing would change the reference count in the comments of the
+      // target, which is not allowed for a frozen tree.
+      set_comments(*_pTarget);
+    } else {
+      // Share the comments with the target, so that changes are visible
+      // through the target immediately.
+      _share(*_pTarget);
+    }
   }
+}
 
-  throw type_mismatch("Must be of type Double or Int64 for that operation.");
 
-  return 0;
+MapProxy::MapProxy(const MapProxy& other)
+  : Value(other),
+    parentPrv(other.parentPrv ? other.parentPrv->addRef() : 0),
+    key(other.key),
+    pTarget(other.pTarget),
+    wasAssigned(other.wasAssigned)
+{
 }
 
 
-Value::operator const char*() const {
-  if (prv->type != Type::String) {
-    throw type_mismatch("Must be of type String for that operation.");
-  }
-
-  return prv->s->c_str();
+MapProxy::MapProxy(Value&& other)
+  : Value(std::move(other)),
+    parentPrv(0),
+    pTarget(0),
+    wasAssigned(false)
+{
 }
 
 
-Value::operator std::string() const {
-  if (prv->type != Type::String) {
-    throw type_mismatch("Must be of type String for that operation.");
+MapProxy::~MapProxy() {
+  if ((wasAssigned || !empty()) && !(parentPrv && parentPrv->frozen)) {
+    if (pTarget) {
+      // Can have changed due to assignment, or comments could have been
+      // created by a call to set_comment_x.
+      pTarget->_share(*this);
+    } else if (parentPrv) {
+      // We waited until now because we don't want to insert a Value object of
+      // type Undefined into the parent map, unless such an object was explicitly
+      // assigned (e.g. `val["key"] = Hjson::Value()`).
+      // Without this requirement, checking for the existence of an element
+      // would create an Undefined element for that key if it didn't already exist
+      // (e.g. `if (val["key"] == 1) {` would create an element for "key").
+      parentPrv->m->emplace(key, std::move(*this));
+    }
   }
 
-  return *prv->s;
+  if (parentPrv) {
+    ValueImpl::release(parentPrv);
+  }
 }
 
 
-bool Value::defined() const {
-  return prv->type != Type::Undefined;
+void MapProxy::_checkParent() const {
+  if (parentPrv) {
+    parentPrv->checkMutable();
+  }
 }
 
 
-bool Value::empty() const {
-  return (prv->type == Type::Undefined ||
-    prv->type == Type::Null ||
-    (prv->type == Type::String && prv->s->empty()) ||
-    (prv->type == Type::Vector && prv->v->empty()) ||
-    (prv->type == Type::Map && prv->m->m.empty()));
+MapProxy& MapProxy::operator =(const MapProxy &other) {
+  return operator=(static_cast<Value>(other));
 }
 
 
-Type Value::type() const {
-  return prv->type;
+MapProxy& MapProxy::operator =(const Value& other) {
+  _checkParent();
+  Value::operator=(other);
+  wasAssigned = true;
+  return *this;
 }
 
 
-bool Value::is_container() const {
-  return prv->type == Type::Vector || prv->type == Type::Map;
+MapProxy& MapProxy::operator =(Value&& other) {
+  _checkParent();
+  Value::operator=(std::move(other));
+  wasAssigned = true;
+  return *this;
 }
 
 
-bool Value::is_numeric() const {
-  return prv->type == Type::Double || prv->type == Type::Int64;
+MapProxy& MapProxy::assign_with_comments(const MapProxy& other) {
+  return assign_with_comments(static_cast<Value>(other));
 }
 
 
-size_t Value::size() const {
-  switch (prv->type)
-  {
-  case Type::Vector:
-    return prv->v->size();
-  case Type::Map:
-    return prv->m->m.size();
-  default:
-    break;
+MapProxy& MapProxy::assign_with_comments(const Value& other) {
+  _checkParent();
+  // If this object is of type Undefined set_comments() will be called in the
+  // assignment operator, no need to call it here.
+  if (defined()) {
+    set_comments(other);
   }
-
-  return 0;
+  return operator=(other);
 }
 
 
-bool Value::deep_equal(const Value& other) const {
-  if (*this == other) {
-    return true;
+MapProxy& MapProxy::assign_with_comments(Value&& other) {
+  _checkParent();
+  // If this object is of type Undefined set_comments() will be called in the
+  // assignment operator, no need to call it here.
+  if (defined()) {
+    _takeComments(other);
   }
+  return operator=(std::move(other));
+}
 
-  if (this->type() != other.type() || this->size() != other.size()) {
-    return false;
-  }
 
-  switch (prv->type)
-  {
-  case Type::Vector:
-    {
-      auto itA = this->prv->v->begin();
-      auto endA = this->prv->v->end();
-      auto itB = other.prv->v->begin();
-      while (itA != endA) {
-        if (!itA->deep_equal(*itB)) {
-          return false;
-        }
-        ++itA;
-        ++itB;
+Value Merge(const Value& base, const Value& ext) {
+  Value merged;
+
+  if (!ext.defined()) {
+    merged = base.clone();
+  } else if (base.type() == Type::Map && ext.type() == Type::Map) {
+    for (int index = 0; index < ext.size(); ++index) {
+      if (base[ext.key(index)].defined()) {
+        merged[ext.key(index)] = Merge(base[ext.key(index)], ext[index]);
+      } else {
+        merged[ext.key(index)] = ext[index].clone();
       }
     }
-    return true;
 
-  case Type::Map:
-    {
-      auto itA = this->begin(), endA = this->end(), itB = other.begin();
-      while (itA != endA) {
-        if (!itA->second.deep_equal(itB->second)) {
-          return false;
-        }
-        ++itA;
-        ++itB;
+    for (int index = 0; index < base.size(); ++index) {
+      if (!merged[base.key(index)].defined()) {
+        merged[base.key(index)] = base[index].clone();
       }
     }
-    return true;
 
-  default:
-    break;
+    merged.set_comments(ext);
+  } else {
+    merged = ext.clone();
   }
 
-  return false;
+  return merged;
 }
 
 
-Value Value::clone() const {
-  switch (prv->type) {
-  case Type::Vector:
-    {
-      Value ret;
-      for (int index = 0; index < int(size()); ++index) {
-        ret.push_back(operator[](index).clone());
-      }
-      ret.set_comments(*this);
-      return ret;
-    }
+// The const_cast is safe since "ext" is only changed if "canMove" is true.
+void Value::_mergeInto(Value& target, Value& ext, bool canMove) {
+  if (!ext.defined()) {
+    return;
+  }
 
-  case Type::Map:
-    {
-      Value ret;
-      for (int index = 0; index < size(); ++index) {
-        ret[key(index)] = operator[](index).clone();
+  // Elements can only be moved out of a container that nobody else can see.
+  canMove = canMove && ext.prv()->refCount == 1 && !ext.prv()->frozen;
+
+  if (target.prv()->type == Type::Map && ext.prv()->type == Type::Map) {
+    target.prv()->checkMutable();
+    ValueVecMap *tm = target.prv()->m;
+
+    for (auto elem : ext.prv()->m->order()) {
+      bool moveElem = canMove && elem->second.prv()->refCount == 1;
+      auto targetElem = tm->find(elem->first);
+      if (!targetElem) {
+        if (moveElem) {
+          tm->emplace(elem->first, std::move(elem->second));
+        } else {
+          tm->emplace(elem->first, elem->second.clone());
+        }
+      } else if (targetElem->second.defined()) {
+        if (targetElem->second.prv()->type == Type::Map &&
+          elem->second.prv()->type == Type::Map)
+        {
+          ValueImpl::thaw(targetElem->second);
+        }
+        _mergeInto(targetElem->second, elem->second, canMove);
+      } else if (moveElem) {
+        targetElem->second.assign_with_comments(std::move(elem->second));
+      } else {
+        targetElem->second.assign_with_comments(elem->second.clone());
       }
-      ret.set_comments(*this);
-      return ret;
     }
 
-  default:
-    break;
+    target.set_comments(ext);
+  } else if (canMove) {
+    target.assign_with_comments(std::move(ext));
+  } else {
+    target.assign_with_comments(ext.clone());
   }
-
-  return *this;
 }
 
 
-void Value::clear() {
-  switch (prv->type) {
-  case Type::Vector:
-    prv->v->clear();
-    break;
+void MergeInto(Value& target, const Value& ext) {
+  Value::_mergeInto(target, const_cast<Value&>(ext), false);
+}
 
-  case Type::Map:
-    prv->m->m.clear();
-    prv->m->v.clear();
-    break;
 
-  default:
-    break;
-  }
+void MergeInto(Value& target, Value&& ext) {
+  Value::_mergeInto(target, ext, true);
 }
 
 
-void Value::erase(int index) {
-  switch (prv->type)
-  {
-  case Type::Undefined:
-  case Type::Vector:
-  case Type::Map:
-    if (index < 0 || index >= size()) {
-      throw index_out_of_bounds("Index out of bounds.");
-    }
+// The layers are ordered from lowest to highest priority.
+Value Value::_mergeLayers(const std::vector<const Value*>& layers) {
+  // Only the highest defined layer and the maps directly below it (ignoring
+  // Undefined layers) can contribute to the result.
+  size_t top = layers.size();
+  while (top > 0 && !layers[top - 1]->defined()) {
+    --top;
+  }
+  if (top == 0) {
+    return layers.empty() ? Value() : layers[0]->clone();
+  }
+  --top;
+  if (layers[top]->prv()->type != Type::Map) {
+    return layers[top]->clone();
+  }
 
-    switch (prv->type)
-    {
-    case Type::Vector:
-      {
-        prv->v->erase(prv->v->begin() + index);
-      }
-      break;
-    case Type::Map:
-      {
-        prv->m->m.erase(prv->m->v[index]);
-        prv->m->v.erase(prv->m->v.begin() + index);
-      }
-      break;
-    default:
+  std::vector<const Value*> maps;
+  for (size_t index = top + 1; index > 0; --index) {
+    const Value *layer = layers[index - 1];
+    if (layer->prv()->type == Type::Map) {
+      maps.push_back(layer);
+    } else if (layer->defined()) {
       break;
     }
-    break;
-
-  default:
-    throw type_mismatch("Must be of type Vector or Map for that operation.");
   }
-}
-
-
-void Value::push_back(const Value& other) {
-  if (prv->type == Type::Undefined) {
-    prv->~ValueImpl();
-    // Recreate the private object using the same memory block.
-    new(&(*prv)) ValueImpl(Type::Vector);
-  } else if (prv->type != Type::Vector) {
-    throw type_mismatch("Must be of type Undefined or Vector for that operation.");
+  // Now ordered from highest to lowest priority.
+  if (maps.size() == 1) {
+    return maps[0]->clone();
   }
 
-  prv->v->push_back(other);
-}
-
-
-void Value::move(int from, int to) {
-  switch (prv->type)
-  {
-  case Type::Undefined:
-  case Type::Vector:
-  case Type::Map:
-    if (from < 0 || to < 0 || from >= size() || to > size()) {
-      throw index_out_of_bounds("Index out of bounds.");
-    }
-
-    if (from == to) {
-      return;
-    }
-
-    switch (prv->type)
-    {
-    case Type::Vector:
-      {
-        auto it = prv->v->begin();
+  Value ret(Type::Map);
+  ValueVecMap *rm = ret.prv()->m;
+  std::vector<const Value*> elemLayers;
 
-        prv->v->insert(it + to, it[from]);
-        if (to < from) {
-          ++from;
-        }
-        prv->v->erase(prv->v->begin() + from);
+  // Same key order as repeated calls to Merge(): keys from higher priority
+  // maps first.
+  for (size_t index = 0; index < maps.size(); ++index) {
+    for (auto elem : maps[index]->prv()->m->order()) {
+      if (rm->find(elem->first)) {
+        continue;
       }
-      break;
-    case Type::Map:
-      {
-        auto vec = &prv->m->v;
-        auto it = vec->begin();
 
-        vec->insert(it + to, it[from]);
-        if (to < from) {
-          ++from;
+      elemLayers.clear();
+      for (size_t lower = maps.size(); lower > index + 1; --lower) {
+        auto lowerElem = maps[lower - 1]->prv()->m->find(elem->first);
+        if (lowerElem) {
+          elemLayers.push_back(&lowerElem->second);
         }
-        vec->erase(vec->begin() + from);
       }
-      break;
-    default:
-      break;
-    }
-    break;
+      elemLayers.push_back(&elem->second);
 
-  default:
-    throw type_mismatch("Must be of type Vector or Map for that operation.");
+      rm->emplace(elem->first, _mergeLayers(elemLayers));
+    }
   }
-}
 
+  ret.set_comments(*maps[0]);
 
-std::string Value::key(int index) const {
-  switch (prv->type)
-  {
-  case Type::Undefined:
-  case Type::Map:
-    if (index < 0 || index >= size()) {
-      throw index_out_of_bounds("Index out of bounds.");
-    }
-    return prv->m->v[index];
-  default:
-    throw type_mismatch("Must be of type Map for that operation.");
-  }
+  return ret;
 }
 
 
-ValueMap::iterator Value::begin() {
-  if (prv->type != Type::Map) {
-    // Some C++ compilers might not allow comparing this to another
-    // default-constructed iterator.
-    return ValueMap::iterator();
+Value MergeLayers(const Value *layers, size_t count) {
+  std::vector<const Value*> layerPtrs;
+  layerPtrs.reserve(count);
+  for (size_t index = 0; index < count; ++index) {
+    layerPtrs.push_back(layers + index);
   }
 
-  return prv->m->m.begin();
+  return Value::_mergeLayers(layerPtrs);
 }
 
 
-ValueMap::iterator Value::end() {
-  if (prv->type != Type::Map) {
-    // Some C++ compilers might not allow comparing this to another
-    // default-constructed iterator.
-    return ValueMap::iterator();
-  }
-
-  return prv->m->m.end();
+Value MergeLayers(const std::vector<Value>& layers) {
+  return MergeLayers(layers.data(), layers.size());
 }
 
 
-ValueMap::const_iterator Value::begin() const {
-  if (prv->type != Type::Map) {
-    // Some C++ compilers might not allow comparing this to another
-    // default-constructed iterator.
-    return ValueMap::const_iterator();
-  }
-
-  return prv->m->m.begin();
+Builder::Builder(Type type, size_t size)
+  : val(type)
+{
+  val.reserve(size);
 }
 
 
-ValueMap::const_iterator Value::end() const {
-  if (prv->type != Type::Map) {
-    // Some C++ compilers might not allow comparing this to another
-    // default-constructed iterator.
-    return ValueMap::const_iterator();
-  }
+Builder& Builder::add(Value elem) {
+  val.push_back(std::move(elem));
 
-  return prv->m->m.end();
+  return *this;
 }
 
 
-size_t Value::erase(const std::string &key) {
-  if (prv->type == Type::Undefined) {
-    return 0;
-  } else if (prv->type != Type::Map) {
-    throw type_mismatch("Must be of type Map for that operation.");
-  }
+Builder& Builder::add(std::string key, Value elem) {
+  val.insert_or_assign(std::move(key), std::move(elem));
 
-  size_t ret = prv->m->m.erase(key);
+  return *this;
+}
 
-  if (ret > 0) {
-    auto v = &prv->m->v;
-    auto it = std::find(v->begin(), v->end(), key);
-    if (it == v->end()) {
-      assert(!"Value found in map but not in vector");
-    } else {
-      v->erase(it);
-    }
-  }
+
+Value Builder::build() {
+  Value ret(std::move(val));
+  val = Value();
 
   return ret;
 }
 
 
-size_t Value::erase(const char *key) {
-  return erase(std::string(key));
+HashedKey::HashedKey(const std::string& _key)
+  : key(_key),
+    h(hashKey(_key.data(), _key.size()))
+{
 }
 
 
-double Value::to_double() const {
-  switch (prv->type) {
-  case Type::Undefined:
-  case Type::Null:
-    return 0.0;
-  case Type::Bool:
-    return (prv->b ? 1.0 : 0.0);
-  case Type::Double:
-    return prv->d;
-  case Type::Int64:
-    return static_cast<double>(prv->i);
-  case Type::String:
-    {
-      double ret;
+HashedKey::HashedKey(const char *_key)
+  : key(_key),
+    h(hashKey(key.data(), key.size()))
+{
+}
 
-#if HJSON_USE_CHARCONV
-      const char *pCh = prv->s->c_str();
-      const char *pEnd = pCh + prv->s->size();
 
-      auto res = std::from_chars(pCh, pEnd, ret);
+const std::string& HashedKey::str() const {
+  return key;
+}
 
-      if (res.ptr != pEnd || res.ec == std::errc::result_out_of_range) {
-#elif HJSON_USE_STRTOD
-      const char *pCh = prv->s->c_str();
-      char *endptr;
-      errno = 0;
 
-      ret = std::strtod(pCh, &endptr);
+size_t HashedKey::hash() const {
+  return h;
+}
 
-      if (errno || endptr - pCh != prv->s->size()) {
-#else
-      std::stringstream ss(*prv->s);
 
-      // Make sure we expect dot (not comma) as decimal point.
-      ss.imbue(std::locale::classic());
+ConstValueRef::ConstValueRef(const Value& val)
+  : pVal(&val)
+{
+}
 
-      ss >> ret;
 
-      if (!ss.eof() || ss.fail()) {
-#endif
-        return 0.0;
-      }
+Type ConstValueRef::type() const {
+  return pVal->type();
+}
 
-      return ret;
-    }
-  default:
-    break;
-  }
 
-  throw type_mismatch("Illegal type for this operation.");
+bool ConstValueRef::defined() const {
+  return pVal->defined();
 }
 
 
-std::int64_t Value::to_int64() const {
-  switch (prv->type) {
-  case Type::Undefined:
-  case Type::Null:
-    return 0;
-  case Type::Bool:
-    return (prv->b ? 1 : 0);
-  case Type::Double:
-    return static_cast<std::int64_t>(prv->d);
-  case Type::Int64:
-    return prv->i;
-  case Type::String:
-    {
-      std::int64_t ret;
+bool ConstValueRef::empty() const {
+  return pVal->empty();
+}
 
-#if HJSON_USE_CHARCONV
-      const char *pCh = prv->s->c_str();
-      const char *pEnd = pCh + prv->s->size();
 
-      auto res = std::from_chars(pCh, pEnd, ret);
+bool ConstValueRef::is_container() const {
+  return pVal->is_container();
+}
 
-      if (res.ptr != pEnd || res.ec == std::errc::result_out_of_range) {
-#elif HJSON_USE_STRTOD
-      const char *pCh = prv->s->c_str();
-      char *endptr;
-      errno = 0;
 
-      ret = std::strtoll(pCh, &endptr, 0);
+bool ConstValueRef::is_numeric() const {
+  return pVal->is_numeric();
+}
 
-      if (errno || endptr - pCh != prv->s->size()) {
-#else
-      std::stringstream ss(*prv->s);
 
-      // Avoid localization surprises.
-      ss.imbue(std::locale::classic());
+size_t ConstValueRef::size() const {
+  return pVal->size();
+}
 
-      ss >> ret;
 
-      if (!ss.eof() || ss.fail()) {
-#endif
-        // Perhaps the string contains a decimal point or exponential part.
-        return static_cast<std::int64_t>(to_double());
-      }
+ConstValueRef ConstValueRef::operator[](const std::string& key) const {
+  // Never changed, so it can be read from many threads.
+  static const Value undefinedValue;
 
-      return ret;
+  switch (pVal->prv()->type) {
+  case Type::Undefined:
+    return undefinedValue;
+  case Type::Map:
+    {
+      auto elem = pVal->prv()->m->find(key);
+      if (!elem) {
+        return undefinedValue;
+      }
+      return elem->second;
     }
   default:
-    break;
+    throw type_mismatch("Must be of type Undefined or Map for that operation.");
   }
+}
 
-  throw type_mismatch("Illegal type for this operation.");
+
+ConstValueRef ConstValueRef::operator[](const char *key) const {
+  // Never changed, so it can be read from many threads.
+  static const Value undefinedValue;
+
+  const Value *pElem = pVal->find(key);
+  return pElem ? *pElem : undefinedValue;
 }
 
 
-std::string Value::to_string() const {
-  switch (prv->type) {
-  case Type::Undefined:
-    return "";
-  case Type::Null:
-    return "null";
-  case Type::Bool:
-    return (prv->b ? "true" : "false");
-  case Type::Double:
-    {
-#if HJSON_USE_CHARCONV
-      std::array<char, 32> buf;
+ConstValueRef ConstValueRef::operator[](const HashedKey& key) const {
+  // Never changed, so it can be read from many threads.
+  static const Value undefinedValue;
 
-      auto res = std::to_chars(buf.data(), buf.data() + buf.size(), prv->d);
+  const Value *pElem = pVal->find(key);
+  return pElem ? *pElem : undefinedValue;
+}
 
-      if (res.ptr - buf.data() >= buf.size() || res.ec != std::errc()) {
-        return "";
-      }
 
-      // to_chars() does not set a zero termination, which is needed by strchr().
-      *res.ptr = '\0';
+#ifdef __cpp_lib_string_view
+ConstValueRef ConstValueRef::operator[](std::string_view key) const {
+  // Never changed, so it can be read from many threads.
+  static const Value undefinedValue;
 
-      // Always output a decimal point.
-      if (strchr(buf.data(), '.') == nullptr) {
-        if (res.ptr - buf.data() >= buf.size() - 1) {
-          return "";
-        }
-        *(res.ptr++) = '.';
-        *(res.ptr++) = '0';
-      }
+  const Value *pElem = pVal->find(key);
+  return pElem ? *pElem : undefinedValue;
+}
+#endif
 
-      return std::string(buf.data(), res.ptr);
-#elif HJSON_USE_STRTOD
-      char buf[32];
-      int nChars = snprintf(buf, sizeof(buf), "%.15g", prv->d);
 
-      if (nChars < 0 || nChars >= static_cast<int>(sizeof(buf))) {
-        return "";
-      }
+ConstValueRef ConstValueRef::operator[](int index) const {
+  return (*pVal)[index];
+}
 
-      // Always output a decimal point.
-      if (strchr(buf, '.') == nullptr) {
-        if (nChars >= static_cast<int>(sizeof(buf)) - 1) {
-          return "";
-        }
-        buf[nChars++] = '.';
-        buf[nChars++] = '0';
-      }
 
-      return std::string(buf, nChars);
-#else
-      std::ostringstream oss;
+const Value* ConstValueRef::find(const std::string& key) const {
+  return pVal->find(key);
+}
 
-      // Make sure we use dot (not comma) as decimal point.
-      oss.imbue(std::locale::classic());
-      oss.precision(15);
 
-      oss << prv->d;
+const Value* ConstValueRef::find(const char *key) const {
+  return pVal->find(key);
+}
 
-      // Always output a decimal point. Done like this to avoid printing more
-      // decimals than needed, which would be the result of using
-      // std::ios::showpoint.
-      if (oss.str().find_first_of('.', 0) == std::string::npos) {
-        oss << ".0";
-      }
 
-      return oss.str();
-#endif
-    }
-  case Type::Int64:
-    {
-#if HJSON_USE_CHARCONV
-      std::array<char, 32> buf;
+const Value* ConstValueRef::find(const HashedKey& key) const {
+  return pVal->find(key);
+}
 
-      auto res = std::to_chars(buf.data(), buf.data() + buf.size(), prv->i);
 
-      if (res.ec != std::errc()) {
-        return "";
-      }
+bool ConstValueRef::contains(const std::string& key) const {
+  return pVal->contains(key);
+}
 
-      return std::string(buf.data(), res.ptr);
-#elif HJSON_USE_STRTOD
-      return std::to_string(prv->i);
-#else
-      std::ostringstream oss;
 
-      // Avoid localization surprises.
-      oss.imbue(std::locale::classic());
+bool ConstValueRef::contains(const char *key) const {
+  return pVal->contains(key);
+}
 
-      oss << prv->i;
 
-      return oss.str();
-#endif
+bool ConstValueRef::contains(const HashedKey& key) const {
+  return pVal->contains(key);
+}
+
+
+const std::string& ConstValueRef::key(int index) const {
+  switch (pVal->prv()->type)
+  {
+  case Type::Undefined:
+  case Type::Map:
+    if (index < 0 || index >= size()) {
+      throw index_out_of_bounds("Index out of bounds.");
     }
-  case Type::String:
-    return *prv->s;
+    return pVal->prv()->m->at(index)->first;
   default:
-    break;
+    throw type_mismatch("Must be of type Map for that operation.");
   }
-
-  throw type_mismatch("Illegal type for this operation.");
 }
 
 
-void Value::set_comment_before(const std::string& str) {
-  if (!cm) {
-    if (str.empty()) {
-      return;
-    }
-    cm.reset(new Comments());
+ConstValueRef::const_iterator ConstValueRef::begin() const {
+  if (!pVal->is_container()) {
+    return const_iterator();
   }
 
-  cm->m_commentBefore = str;
+  return const_iterator(pVal, 0);
 }
 
 
-std::string Value::get_comment_before() const {
-  if (cm) {
-    return cm->m_commentBefore;
+ConstValueRef::const_iterator ConstValueRef::end() const {
+  if (!pVal->is_container()) {
+    return const_iterator();
   }
 
-  return "";
+  return const_iterator(pVal, static_cast<int>(pVal->size()));
 }
 
 
-void Value::set_comment_key(const std::string& str) {
-  if (!cm) {
-    if (str.empty()) {
-      return;
-    }
-    cm.reset(new Comments());
+ConstValueRef ConstValueRef::const_iterator::operator*() const {
+  if (pParent->prv()->type == Type::Map) {
+    return pParent->prv()->m->at(index)->second;
   }
 
-  cm->m_commentKey = str;
+  return pParent->prv()->vec_const()[index];
 }
 
 
-std::string Value::get_comment_key() const {
-  if (cm) {
-    return cm->m_commentKey;
+const std::string& ConstValueRef::const_iterator::key() const {
+  if (!pParent || pParent->prv()->type != Type::Map) {
+    throw type_mismatch("Must be of type Map for that operation.");
   }
 
-  return "";
+  return pParent->prv()->m->at(index)->first;
 }
 
 
-void Value::set_comment_inside(const std::string& str) {
-  if (!cm) {
-    if (str.empty()) {
-      return;
-    }
-    cm.reset(new Comments());
-  }
+ConstValueRef::operator bool() const {
+  return static_cast<bool>(*pVal);
+}
+
 
-  cm->m_commentInside = str;
+double ConstValueRef::to_double() const {
+  return pVal->to_double();
 }
 
 
-std::string Value::get_comment_inside() const {
-  if (cm) {
-    return cm->m_commentInside;
-  }
+std::int64_t ConstValueRef::to_int64() const {
+  return pVal->to_int64();
+}
 
-  return "";
+
+std::string ConstValueRef::to_string() const {
+  return pVal->to_string();
 }
 
 
-void Value::set_comment_after(const std::string& str) {
-  if (!cm) {
-    if (str.empty()) {
-      return;
-    }
-    cm.reset(new Comments());
+const char* ConstValueRef::c_str() const {
+  if (pVal->prv()->type != Type::String) {
+    throw type_mismatch("Must be of type String for that operation.");
   }
 
-  cm->m_commentAfter = str;
+  return pVal->prv()->str_data();
 }
 
 
-std::string Value::get_comment_after() const {
-  if (cm) {
-    return cm->m_commentAfter;
+#ifdef __cpp_lib_string_view
+std::string_view ConstValueRef::to_string_view() const {
+  if (pVal->prv()->type != Type::String) {
+    throw type_mismatch("Must be of type String for that operation.");
   }
 
-  return "";
+  return std::string_view(pVal->prv()->str_data(), pVal->prv()->str_size());
 }
+#endif
 
 
-void Value::set_comments(const Value& other) {
-  if (other.cm) {
-    if (!cm) {
-      cm.reset(new Comments());
-    }
+const Value& ConstValueRef::value() const {
+  return *pVal;
+}
 
-    *cm = *other.cm;
-  } else {
-    clear_comments();
-  }
+
+Overlay::Overlay() {
 }
 
 
-void Value::clear_comments() {
-  cm.reset();
+Overlay::Overlay(const Value *_layers, size_t count)
+  : layers(_layers, _layers + count)
+{
 }
 
 
-Value& Value::assign_with_comments(const Value& other) {
-  // If this object is of type Undefined set_comments() will be called in the
-  // assignment operator, no need to call it here.
-  if (defined()) {
-    set_comments(other);
-  }
-  return operator=(other);
+Overlay::Overlay(const std::vector<Value>& _layers)
+  : layers(_layers)
+{
 }
 
 
-Value& Value::assign_with_comments(Value&& other) {
-  // If this object is of type Undefined set_comments() will be called in the
-  // assignment operator, no need to call it here.
-  if (defined()) {
-    cm = other.cm;
+void Overlay::set_layer(size_t index, const Value& layer) {
+  if (index >= layers.size()) {
+    throw index_out_of_bounds("Index out of bounds.");
   }
-  return operator=(std::move(other));
+
+  layers[index] = layer;
 }
 
 
-MapProxy::MapProxy(std::shared_ptr<ValueImpl> _parent, const std::string &_key,
-  Value *_pTarget)
-  : Value(_pTarget ? _pTarget->prv : std::make_shared<ValueImpl>(Type::Undefined),
-      _pTarget ? _pTarget->cm : 0),
-    parentPrv(_parent),
-    key(_key),
-    pTarget(_pTarget),
-    wasAssigned(false)
-{
+void Overlay::push_layer(const Value& layer) {
+  layers.push_back(layer);
 }
 
 
-MapProxy::MapProxy(Value&& other)
-  : Value(std::move(other))
-{
+size_t Overlay::layer_count() const {
+  return layers.size();
 }
 
 
-MapProxy::~MapProxy() {
-  if (wasAssigned || !empty()) {
-    if (pTarget) {
-      // Can have changed due to assignment.
-      pTarget->prv = this->prv;
-      // In case cm was 0 but now has been created by a call to set_comment_x.
-      pTarget->cm = this->cm;
-    } else {
-      // If the key is new we must add it to the order vector also.
-      parentPrv->m->v.push_back(key);
+// Same rules as Value::_mergeLayers(): the highest defined layer, and if that
+// is a Map also the maps below it down to the first layer of another type
+// (except Undefined).
+void Overlay::_active(size_t *pBegin, size_t *pEnd) const {
+  size_t end = layers.size();
+  while (end > 0 && !layers[end - 1].defined()) {
+    --end;
+  }
 
-      // We waited until now because we don't want to insert a Value object of
-      // type Undefined into the parent map, unless such an object was explicitly
-      // assigned (e.g. `val["key"] = Hjson::Value()`).
-      // Without this requirement, checking for the existence of an element
-      // would create an Undefined element for that key if it didn't already exist
-      // (e.g. `if (val["key"] == 1) {` would create an element for "key").
-      parentPrv->m->m.emplace(key, Value(this->prv, this->cm));
+  size_t begin = end;
+  if (end > 0) {
+    --begin;
+    if (layers[begin].prv()->type == Type::Map) {
+      while (begin > 0 && (!layers[begin - 1].defined() ||
+        layers[begin - 1].prv()->type == Type::Map))
+      {
+        --begin;
+      }
     }
   }
+
+  *pBegin = begin;
+  *pEnd = end;
 }
 
 
-MapProxy& MapProxy::operator =(const MapProxy &other) {
-  return operator=(static_cast<Value>(other));
+Type Overlay::type() const {
+  size_t begin, end;
+  _active(&begin, &end);
+
+  return end > 0 ? layers[end - 1].prv()->type : Type::Undefined;
 }
 
 
-MapProxy& MapProxy::operator =(const Value& other) {
-  Value::operator=(other);
-  wasAssigned = true;
-  return *this;
+bool Overlay::defined() const {
+  return type() != Type::Undefined;
 }
 
 
-MapProxy& MapProxy::operator =(Value&& other) {
-  Value::operator=(std::move(other));
-  wasAssigned = true;
-  return *this;
+Overlay Overlay::operator[](const std::string& key) const {
+  size_t begin, end;
+  _active(&begin, &end);
+
+  Overlay ret;
+  if (end == 0) {
+    return ret;
+  }
+  if (layers[end - 1].prv()->type != Type::Map) {
+    throw type_mismatch("Must be of type Undefined or Map for that operation.");
+  }
+
+  for (size_t index = begin; index < end; ++index) {
+    if (layers[index].prv()->type == Type::Map) {
+      auto elem = layers[index].prv()->m->find(key);
+      if (elem) {
+        ret.layers.push_back(elem->second);
+      }
+    }
+  }
+
+  return ret;
 }
 
 
-MapProxy& MapProxy::assign_with_comments(const MapProxy& other) {
-  return assign_with_comments(static_cast<Value>(other));
+Overlay Overlay::operator[](const char *key) const {
+  return operator[](std::string(key));
 }
 
 
-MapProxy& MapProxy::assign_with_comments(const Value& other) {
-  // If this object is of type Undefined set_comments() will be called in the
-  // assignment operator, no need to call it here.
-  if (defined()) {
-    set_comments(other);
+std::vector<std::string> Overlay::keys() const {
+  size_t begin, end;
+  _active(&begin, &end);
+
+  std::vector<std::string> ret;
+  if (end == 0 || layers[end - 1].prv()->type != Type::Map) {
+    return ret;
   }
-  return operator=(other);
+
+  std::unordered_set<std::string> seen;
+  for (size_t index = end; index > begin; --index) {
+    const Value& layer = layers[index - 1];
+    if (layer.prv()->type != Type::Map) {
+      continue;
+    }
+    for (auto elem : layer.prv()->m->order()) {
+      if (seen.insert(elem->first).second) {
+        ret.push_back(elem->first);
+      }
+    }
+  }
+
+  return ret;
 }
 
 
-MapProxy& MapProxy::assign_with_comments(Value&& other) {
-  // If this object is of type Undefined set_comments() will be called in the
-  // assignment operator, no need to call it here.
-  if (defined()) {
-    cm = other.cm;
+size_t Overlay::size() const {
+  switch (type()) {
+  case Type::Map:
+    return keys().size();
+  case Type::Vector:
+    return value().size();
+  default:
+    return 0;
   }
-  return operator=(std::move(other));
 }
 
 
-Value Merge(const Value& base, const Value& ext) {
-  Value merged;
+Value Overlay::value() const {
+  size_t begin, end;
+  _active(&begin, &end);
 
-  if (!ext.defined()) {
-    merged = base.clone();
-  } else if (base.type() == Type::Map && ext.type() == Type::Map) {
-    for (int index = 0; index < ext.size(); ++index) {
-      if (base[ext.key(index)].defined()) {
-        merged[ext.key(index)] = Merge(base[ext.key(index)], ext[index]);
-      } else {
-        merged[ext.key(index)] = ext[index].clone();
-      }
-    }
+  if (end == 0) {
+    return Value();
+  }
 
-    for (int index = 0; index < base.size(); ++index) {
-      if (!merged[base.key(index)].defined()) {
-        merged[base.key(index)] = base[index].clone();
-      }
+  size_t count = 0;
+  for (size_t index = begin; index < end; ++index) {
+    if (layers[index].defined()) {
+      ++count;
     }
-
-    merged.set_comments(ext);
-  } else {
-    merged = ext.clone();
+  }
+  if (count == 1) {
+    return layers[end - 1];
   }
 
-  return merged;
+  return MergeLayers(layers.data() + begin, end - begin);
+}
+
+
+double Overlay::to_double() const {
+  return value().to_double();
+}
+
+
+std::int64_t Overlay::to_int64() const {
+  return value().to_int64();
+}
+
+
+std::string Overlay::to_string() const {
+  return value().to_string();
 }
 
 
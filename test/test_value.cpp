@@ -1,11 +1,34 @@
 #include <hjson.h>
 #include <cmath>
+#include <algorithm>
 #include <cstring>
 #include <sstream>
 #include <cstdio>
+#include <limits>
+#include <thread>
+#include <vector>
 #include "hjson_test.h"
 
 
+// Counts the bytes that are allocated and not yet deallocated.
+class CountingResource : public Hjson::MemoryResource {
+public:
+  CountingResource() : allocated(0), outstanding(0) {}
+
+  void *allocate(size_t bytes, size_t) override {
+    allocated += bytes;
+    outstanding += bytes;
+    return ::operator new(bytes);
+  }
+  void deallocate(void *p, size_t bytes, size_t) override {
+    outstanding -= bytes;
+    ::operator delete(p);
+  }
+
+  size_t allocated, outstanding;
+};
+
+
 static std::string _test_string_param(std::string param) {
   return param;
 }
@@ -496,7 +519,7 @@ void test_value() {
     assert(it == val.end());
 
     const Hjson::Value valConst = val;
-    std::map<std::string, Hjson::Value>::const_iterator itConst = valConst.begin();
+    Hjson::Value::const_iterator itConst = valConst.begin();
     assert(itConst->first == "first");
     assert(itConst->second == "leaf1");
     ++itConst;
@@ -1676,4 +1699,1408 @@ key: val2
       assert(!"Did not throw error for duplicate key");
     } catch(const Hjson::syntax_error& e) {}
   }
+  {
+    // All parser instantiations must produce the same tree, only the amount
+    // of comment info differs.
+    std::string str = R"(
+# before
+{
+  a: 1 # after a
+  b: [ 2, /* before 3 */ 3 ]
+  c: {
+    d: x
+  }
+}
+)";
+    auto base = Hjson::Unmarshal(str);
+    for (int a = 0; a < 8; ++a) {
+      Hjson::DecoderOptions decOpt;
+      decOpt.comments = !!(a & 1);
+      decOpt.whitespaceAsComments = !!(a & 2);
+      decOpt.duplicateKeyException = !!(a & 4);
+      auto root = Hjson::Unmarshal(str, decOpt);
+      assert(root.deep_equal(base));
+      bool hasComments = decOpt.comments || decOpt.whitespaceAsComments;
+      assert(root["a"].get_comment_after().empty() == !hasComments);
+      assert(root["b"][1].get_comment_before().empty() == !hasComments);
+    }
+  }
+  {
+    std::string str = R"(
+a: [ 1, 2, { b: [ 3 ] } ]
+c: hello
+d: '''
+  multi
+  line
+  '''
+)";
+    auto _throwsLimit = [](const std::string& str, const Hjson::DecoderOptions& decOpt) {
+      try {
+        Hjson::Unmarshal(str, decOpt);
+      } catch (const Hjson::limit_error&) {
+        return true;
+      }
+      return false;
+    };
+
+    Hjson::DecoderOptions decOpt;
+    assert(!_throwsLimit(str, decOpt));
+    decOpt.maxDepth = 4;
+    assert(!_throwsLimit(str, decOpt));
+    decOpt.maxDepth = 3;
+    assert(_throwsLimit(str, decOpt));
+    decOpt = Hjson::DecoderOptions();
+    decOpt.maxNodes = 9;
+    assert(!_throwsLimit(str, decOpt));
+    decOpt.maxNodes = 8;
+    assert(_throwsLimit(str, decOpt));
+    decOpt = Hjson::DecoderOptions();
+    decOpt.maxStringLength = 10;
+    assert(!_throwsLimit(str, decOpt));
+    decOpt.maxStringLength = 9;
+    assert(_throwsLimit(str, decOpt));
+    decOpt = Hjson::DecoderOptions();
+    // Keys a, b, c, d plus the values "hello" and "multi\nline".
+    decOpt.maxStringBytes = 19;
+    assert(!_throwsLimit(str, decOpt));
+    decOpt.maxStringBytes = 18;
+    assert(_throwsLimit(str, decOpt));
+
+    std::string big = "[";
+    for (int a = 0; a < 100000; ++a) {
+      big += "[1,2,3]\n";
+    }
+    big += "]";
+    decOpt = Hjson::DecoderOptions();
+    decOpt.maxDuration = std::chrono::nanoseconds(1);
+    assert(_throwsLimit(big, decOpt));
+
+    // A huge string is rejected while it is read, so the missing end quotes
+    // are never found.
+    std::string huge(1000000, 'x');
+    decOpt = Hjson::DecoderOptions();
+    decOpt.maxStringLength = 1000;
+    assert(_throwsLimit("a: '''\n" + huge, decOpt));
+    assert(_throwsLimit("a: \"" + huge, decOpt));
+    decOpt = Hjson::DecoderOptions();
+    decOpt.maxDuration = std::chrono::nanoseconds(1);
+    assert(_throwsLimit("a: \"" + huge + "\"", decOpt));
+    assert(_throwsLimit("a: " + huge, decOpt));
+  }
+  {
+    assert(Hjson::Lint("a: 1\nb: [1, 2]\n").empty());
+    assert(Hjson::Lint("true").empty());
+
+    std::string str = R"(a: 1
+: 2
+c: "abc
+d: 4
+e x: 5
+f: {
+  g: [1, 2
+}
+)";
+    auto diags = Hjson::Lint(str);
+    assert(diags.size() == 4);
+    assert(diags[0].line == 2 && diags[0].column == 1 && diags[0].offset == 5);
+    assert(diags[1].line == 3);
+    assert(diags[1].message == "Bad string containing newline");
+    assert(diags[2].line == 5);
+    assert(diags[3].line == 8);
+    try {
+      Hjson::Unmarshal(str);
+      assert(!"Did not throw error for invalid syntax");
+    } catch(const Hjson::syntax_error& e) {}
+
+    Hjson::DecoderOptions decOpt;
+    decOpt.duplicateKeyException = true;
+    diags = Hjson::Lint("a: 1\nb: 1\nb: 2\nc: 3\nc: 4\n", decOpt);
+    assert(diags.size() == 2);
+    assert(diags[0].line == 3 && diags[1].line == 5);
+  }
+  {
+    std::string str = R"(# root
+a: {
+  # inside a
+  b: [1, 2, 3]
+  c: {
+    d: hello
+  }
+}
+e: [
+  {f: 1}
+  {f: 2}
+]
+)";
+    Hjson::IncrementalDecoder inc(str);
+    assert(Hjson::Marshal(inc.root()) == Hjson::Marshal(Hjson::Unmarshal(str)));
+    Hjson::Value e = inc.root()["e"];
+
+    // Change a value inside the innermost vector.
+    auto pos = inc.text().find("2, 3");
+    inc.apply(Hjson::TextEdit{pos, 1, "20"});
+    assert(inc.root()["a"]["b"][1] == 20);
+    // The tree was updated in place, other containers are untouched.
+    assert(inc.root()["e"] == e);
+
+    // Add a key to a nested map, then make the nested map invalid and valid
+    // again in the same call.
+    pos = inc.text().find("d: hello");
+    inc.apply(std::vector<Hjson::TextEdit>{
+      {pos, 0, "x: 9\n    "},
+      {pos, 0, "{"},
+      {pos, 1, ""},
+    });
+    assert(inc.root()["a"]["c"]["x"] == 9);
+
+    // An edit inside a map that changes the structure of the parent.
+    pos = inc.text().find("{f: 2}");
+    inc.apply(Hjson::TextEdit{pos + 4, 1, "2}\n  {f: 3"});
+    assert(inc.root()["e"].size() == 3);
+    assert(inc.root()["e"][2]["f"] == 3);
+
+    // An edit in the root map.
+    inc.apply(Hjson::TextEdit{inc.text().size(), 0, "g: 3\n"});
+    assert(inc.root()["g"] == 3);
+
+    Hjson::EncoderOptions encOpt;
+    encOpt.comments = true;
+    assert(Hjson::Marshal(inc.root(), encOpt) ==
+      Hjson::Marshal(Hjson::Unmarshal(inc.text()), encOpt));
+
+    try {
+      inc.apply(Hjson::TextEdit{0, inc.text().size() + 1, ""});
+      assert(!"Did not throw error for edit outside of text");
+    } catch(const Hjson::index_out_of_bounds& e) {}
+
+    try {
+      inc.apply(Hjson::TextEdit{inc.text().find("[1"), 1, ""});
+      assert(!"Did not throw error for invalid syntax");
+    } catch(const Hjson::syntax_error& e) {}
+    inc.apply(Hjson::TextEdit{inc.text().find("1, 20"), 0, "["});
+    assert(inc.root()["a"]["b"][1] == 20);
+  }
+  {
+    // Edits of the comments before and after the root.
+    Hjson::DecoderOptions decOpt;
+    decOpt.comments = true;
+    Hjson::IncrementalDecoder inc("#old\n{\n  a: 1\n}\n", decOpt);
+    assert(inc.root().get_comment_before() == "#old\n");
+    inc.apply(Hjson::TextEdit{0, 5, "#c\n"});
+    assert(inc.root().get_comment_before() == "#c\n");
+    assert(inc.root().get_comment_before() ==
+      Hjson::Unmarshal(inc.text(), decOpt).get_comment_before());
+    inc.apply(Hjson::TextEdit{inc.text().size(), 0, "# end"});
+    assert(inc.root().get_comment_after() ==
+      Hjson::Unmarshal(inc.text(), decOpt).get_comment_after());
+    assert(inc.root()["a"] == 1);
+  }
+  {
+    // The limits apply to the entire text, also when only a part of it is
+    // parsed again.
+    Hjson::DecoderOptions decOpt;
+    decOpt.maxDepth = 4;
+    Hjson::IncrementalDecoder inc("{a: {b: {c: []}}}", decOpt);
+    auto pos = inc.text().find("[]") + 1;
+    inc.apply(Hjson::TextEdit{pos, 0, "1"});
+    assert(inc.root()["a"]["b"]["c"][0] == 1);
+    try {
+      inc.apply(Hjson::TextEdit{pos, 1, "[[1]]"});
+      assert(!"Did not throw error for exceeded depth");
+    } catch(const Hjson::limit_error& e) {}
+    inc.apply(Hjson::TextEdit{pos, 5, "2"});
+    assert(inc.root()["a"]["b"]["c"][0] == 2);
+
+    decOpt = Hjson::DecoderOptions();
+    decOpt.maxNodes = 7;
+    Hjson::IncrementalDecoder inc2("{a: [1, 2], b: [3]}", decOpt);
+    pos = inc2.text().find("3");
+    // 6 values, then 7.
+    inc2.apply(Hjson::TextEdit{pos, 0, "4, "});
+    assert(inc2.root()["b"].size() == 2);
+    try {
+      inc2.apply(Hjson::TextEdit{pos, 0, "5, "});
+      assert(!"Did not throw error for exceeded node count");
+    } catch(const Hjson::limit_error& e) {}
+    // Shrinking one vector makes room in another.
+    inc2.apply(Hjson::TextEdit{inc2.text().find("1, "), 3, ""});
+    assert(inc2.root()["a"].size() == 1 && inc2.root()["b"].size() == 3);
+
+    decOpt = Hjson::DecoderOptions();
+    decOpt.maxStringBytes = 6;
+    Hjson::IncrementalDecoder inc3("{a: [\"xy\"], b: [\"z\"]}", decOpt);
+    pos = inc3.text().find("z");
+    try {
+      inc3.apply(Hjson::TextEdit{pos, 0, "zz"});
+      assert(!"Did not throw error for exceeded string bytes");
+    } catch(const Hjson::limit_error& e) {}
+  }
+  {
+    // dedupe is ignored.
+    Hjson::DecoderOptions decOpt;
+    decOpt.dedupe = true;
+    std::string str = "{a: [\"shared text that is long\", \"shared text that is long\"]}";
+    Hjson::IncrementalDecoder inc(str, decOpt);
+    assert(!inc.root()["a"][0].is_frozen());
+    const Hjson::Value copy = Hjson::Unmarshal(inc.text(), decOpt);
+    assert(copy["a"][0].is_frozen() && copy["a"][1].is_frozen());
+  }
+  {
+    // Compare a large Map with a simple model of it.
+    Hjson::Value val;
+    std::vector<std::string> keys;
+    for (int a = 0; a < 1000; ++a) {
+      keys.push_back("k" + std::to_string(a * 7919 % 1000));
+      val[keys.back()] = a;
+    }
+    for (int a = 0; a < 1000; a += 3) {
+      assert(val.erase(keys[a]) == 1);
+      keys[a].clear();
+    }
+    keys.erase(std::remove(keys.begin(), keys.end(), ""), keys.end());
+    assert(val.erase("k3") + val.erase("k3") == 1);
+    keys.erase(std::find(keys.begin(), keys.end(), "k3"));
+    val.move(5, 100);
+    keys.insert(keys.begin() + 100, keys[5]);
+    keys.erase(keys.begin() + 5);
+    val.move(200, 10);
+    keys.insert(keys.begin() + 10, keys[200]);
+    keys.erase(keys.begin() + 201);
+    val.erase(0);
+    keys.erase(keys.begin());
+    for (int a = 0; a < 100; ++a) {
+      keys.push_back("n" + std::to_string(a));
+      val[keys.back()] = a;
+    }
+
+    assert(val.size() == keys.size());
+    int index = 0;
+    for (auto it = val.insertion_begin(); it != val.insertion_end(); ++it) {
+      assert(it->first == keys[index]);
+      assert(val.key(index) == keys[index]);
+      assert(val[index].deep_equal(it->second));
+      assert(val.at(keys[index]).deep_equal(it->second));
+      ++index;
+    }
+    assert(index == int(keys.size()));
+
+    std::sort(keys.begin(), keys.end());
+    index = 0;
+    for (auto it = val.begin(); it != val.end(); ++it) {
+      assert(it->first == keys[index++]);
+    }
+    assert(index == int(keys.size()));
+
+    // References to elements are stable.
+    Hjson::Value &ref = val.at("n0");
+    for (int a = 0; a < 10000; ++a) {
+      val["x" + std::to_string(a)] = a;
+    }
+    assert(&ref == &val.at("n0"));
+
+    Hjson::Value empty;
+    assert(empty.insertion_begin() == empty.insertion_end());
+  }
+  {
+    // Erase every key of a large Map, reading it between the erasures. A
+    // quadratic erase would make this test very slow.
+    Hjson::Value val;
+    const int count = 100000;
+    for (int a = 0; a < count; ++a) {
+      val["k" + std::to_string(a)] = a;
+    }
+    for (int a = 0; a < count; ++a) {
+      assert(val.erase("k" + std::to_string(a)) == 1);
+      if (a % 9973 == 0) {
+        const Hjson::Value &cval = val;
+        assert(cval.size() == size_t(count - a - 1));
+        assert(cval.key(0) == "k" + std::to_string(a + 1));
+        assert(cval[cval.size() - 1] == count - 1);
+        assert(cval.insertion_begin()->first == cval.key(0));
+        val["extra"] = a;
+        assert(val.key(val.size() - 1) == "extra");
+        assert(val.erase("extra") == 1);
+      }
+    }
+    assert(val.empty() && val.begin() == val.end());
+    assert(val.insertion_begin() == val.insertion_end());
+  }
+  {
+    // Strings around the size limit for inline storage.
+    std::string str;
+    for (int a = 0; a < 30; ++a) {
+      Hjson::Value val(str);
+      assert(val == str);
+      assert(val.to_string() == str);
+      assert(strlen(val) == str.size());
+      Hjson::Value val2(Hjson::Type::String);
+      for (int b = 0; b < a; ++b) {
+        val2 += std::string(1, 'a' + b % 26);
+      }
+      assert(val2 == val);
+      assert(!(val2 < val) && !(val2 > val));
+      val2 += val2;
+      assert(val2 == str + str);
+      assert(val2.to_string().size() == 2 * str.size());
+      str += 'a' + a % 26;
+      assert(val < Hjson::Value(str));
+    }
+    assert(Hjson::Value("abc") < Hjson::Value("abd"));
+    assert(Hjson::Value("abc") > Hjson::Value("ab"));
+    assert(Hjson::Value(std::string("a\0b", 3)).to_string().size() == 3);
+    assert(Hjson::Value("12345678901234567890123456") == "12345678901234567890123456");
+    assert(Hjson::Value("3.5").to_double() == 3.5);
+    assert(Hjson::Value("1.50000000000000000000000000").to_double() == 1.5);
+  }
+  {
+    // A Value is a vtable pointer plus one pointer, with or without comments.
+    assert(sizeof(Hjson::Value) == 2 * sizeof(void*));
+
+    Hjson::Value val;
+    val["a"] = 1;
+    val["a"].set_comment_after(" # a");
+    val["b"]["c"] = 2;
+    Hjson::Value a = val["a"];
+    assert(a.get_comment_after() == " # a");
+    a.set_comment_after(" # changed");
+    assert(val["a"].get_comment_after() == " # a");
+    // Moving from a temporary MapProxy must not take the comments from the
+    // map element.
+    Hjson::Value c;
+    c = val["a"];
+    assert(c.get_comment_after() == " # a");
+    assert(val["a"].get_comment_after() == " # a");
+    Hjson::Value vec;
+    vec.push_back(std::move(val["a"]));
+    assert(vec[0].get_comment_after() == " # a");
+    assert(val["a"].get_comment_after() == " # a");
+    Hjson::Value moved(std::move(a));
+    assert(moved.get_comment_after() == " # changed");
+    assert(moved == 1);
+    val["a"].clear_comments();
+    assert(val["a"].get_comment_after().empty());
+    assert(val["a"] == 1);
+
+    Hjson::Value b = val["b"];
+    b["d"] = 3;
+    assert(val["b"]["d"] == 3);
+    val["b"] = 4;
+    assert(b["c"] == 2);
+    assert(val["b"] == 4);
+  }
+  {
+    // Frozen trees.
+    Hjson::Value val;
+    val["a"] = 0;
+    val["b"]["c"] = "text";
+    val["d"].push_back(2.5);
+    val["d"].push_back(Hjson::Value(Hjson::Type::Map));
+    val.erase("a");
+    val["a"] = 1;
+    val["a"].set_comment_after(" # a");
+    Hjson::Value shared = val["b"];
+    assert(!val.is_frozen());
+    val.freeze();
+    assert(val.is_frozen());
+    assert(shared.is_frozen());
+    const Hjson::Value& cval = val;
+    assert(cval["d"][1].is_frozen());
+    val.freeze();
+
+    try {
+      val["a"] = 2;
+      assert(!"Did not throw error when assigning to a frozen map.");
+    } catch(const Hjson::frozen_error& e) {}
+    try {
+      val["x"] = 2;
+      assert(!"Did not throw error when inserting into a frozen map.");
+    } catch(const Hjson::frozen_error& e) {}
+    try {
+      val["d"].push_back(3);
+      assert(!"Did not throw error when adding to a frozen vector.");
+    } catch(const Hjson::frozen_error& e) {}
+    try {
+      shared["c"] += "more";
+      assert(!"Did not throw error when changing a frozen string.");
+    } catch(const Hjson::frozen_error& e) {}
+    try {
+      val["d"][0];
+      assert(!"Did not throw error for a non-const reference into a frozen vector.");
+    } catch(const Hjson::frozen_error& e) {}
+    try {
+      val.begin();
+      assert(!"Did not throw error for a non-const iterator into a frozen map.");
+    } catch(const Hjson::frozen_error& e) {}
+    try {
+      val.erase("a");
+      assert(!"Did not throw error when erasing from a frozen map.");
+    } catch(const Hjson::frozen_error& e) {}
+    try {
+      val.clear();
+      assert(!"Did not throw error when clearing a frozen map.");
+    } catch(const Hjson::frozen_error& e) {}
+
+    // Reading is still possible, and nothing was changed.
+    assert(val["a"] == 1);
+    assert(val["a"].get_comment_after() == " # a");
+    assert(!val["x"].defined());
+    assert(val.size() == 3);
+    assert(val.key(2) == "a");
+    assert(cval["d"][0] == 2.5);
+    int count = 0;
+    for (auto it = cval.begin(); it != cval.end(); ++it) {
+      ++count;
+    }
+    assert(count == 3);
+
+    Hjson::ConstValueRef ref(val);
+    assert(ref.type() == Hjson::Type::Map);
+    assert(ref.size() == 3);
+    assert(ref["b"]["c"].to_string() == "text");
+    assert(ref["d"][0].to_double() == 2.5);
+    assert(ref["d"][1].empty());
+    assert(!ref["x"]["y"].defined());
+    assert(ref.key(0) == "b");
+    assert(&ref["b"].value() == &cval.at("b"));
+
+    // Handles to a frozen tree can be created and destroyed freely.
+    Hjson::Value copy = val;
+    copy = Hjson::Value();
+    assert(val.size() == 3);
+
+    // A clone is mutable.
+    Hjson::Value cl = val.clone();
+    assert(!cl.is_frozen());
+    cl["a"] = 2;
+    cl["b"]["c"] += "more";
+    cl["d"][0] = 3;
+    assert(cl["b"]["c"] == "textmore");
+    assert(val["a"] == 1);
+    assert(val["b"]["c"] == "text");
+    assert(cval["d"][0] == 2.5);
+    Hjson::Value scalar = Hjson::Value(5);
+    scalar.freeze();
+    Hjson::Value scalarClone = scalar.clone();
+    ++scalarClone;
+    assert(scalar == 5 && scalarClone == 6);
+  }
+  {
+    // Clones of frozen trees share unchanged subtrees.
+    Hjson::Value base;
+    base["a"]["b"]["c"] = 1;
+    base["a"]["b"].set_comment_before("// b\n");
+    base["a"]["d"] = "text";
+    base["e"]["f"].push_back(1);
+    base["e"]["f"].push_back(Hjson::Value(Hjson::Type::Map));
+    base["e"]["f"][1]["g"] = 2;
+    base.freeze();
+    const Hjson::Value& cbase = base;
+
+    Hjson::Value variant = base.clone();
+    const Hjson::Value& cvariant = variant;
+    assert(!variant.is_frozen());
+    assert(cvariant["a"].is_frozen());
+    assert(&cvariant["a"]["b"].at("c") == &cbase["a"]["b"].at("c"));
+    variant["a"]["b"]["c"] = 2;
+    variant["e"]["f"][1]["g"] = 3;
+    variant["e"]["f"].push_back(4);
+    assert(cbase["a"]["b"]["c"] == 1);
+    assert(cbase["e"]["f"][1]["g"] == 2);
+    assert(cbase["e"]["f"].size() == 2);
+    assert(cvariant["a"]["b"]["c"] == 2);
+    assert(cvariant["e"]["f"][1]["g"] == 3);
+    assert(cvariant["e"]["f"].size() == 3);
+    assert(cvariant["a"]["b"].get_comment_before() == "// b\n");
+    assert(!cvariant["a"].is_frozen());
+    assert(cvariant["a"]["d"].is_frozen());
+    assert(Hjson::Marshal(base) != Hjson::Marshal(variant));
+    variant["a"]["b"]["c"] = 1;
+    variant["e"]["f"][1]["g"] = 2;
+    variant["e"]["f"].erase(2);
+    assert(Hjson::Marshal(base) == Hjson::Marshal(variant));
+
+    // A mutable tree that contains a frozen subtree.
+    Hjson::Value tree;
+    tree["base"] = base;
+    tree["own"]["x"] = 1;
+    Hjson::Value cl = tree.clone();
+    cl["own"]["x"] = 2;
+    cl["base"]["a"]["d"] = "changed";
+    assert(tree["own"]["x"] == 1);
+    assert(base["a"]["d"] == "text");
+    assert(cl["base"]["a"]["d"] == "changed");
+
+    Hjson::Value ext;
+    ext["a"]["d"] = "ext";
+    ext.freeze();
+    Hjson::Value merged = Hjson::Merge(base, ext);
+    assert(merged["a"]["d"] == "ext");
+    assert(merged["a"]["b"]["c"] == 1);
+    merged["e"]["f"][0] = 5;
+    assert(cbase["e"]["f"][0] == 1);
+  }
+  {
+    // MergeInto and MergeLayers give the same result as Merge.
+    std::vector<Hjson::Value> layers;
+    layers.push_back(Hjson::Unmarshal(R"(
+      # defaults
+      a: 1
+      b: {c: 2, d: [1, 2], e: {f: 3}}
+      g: x
+      h: {i: 1}
+    )"));
+    layers.push_back(Hjson::Unmarshal(R"(
+      b: {
+        # site
+        c: 20
+        e: 7
+      }
+      j: 5
+    )"));
+    layers.push_back(Hjson::Value());
+    layers.push_back(Hjson::Unmarshal(R"(
+      h: 4
+      b: {d: [3], k: {l: 1}}
+    )"));
+    layers.push_back(Hjson::Unmarshal("{b: {k: {m: 2}}, a: 10}"));
+
+    Hjson::Value chained = layers[0].clone();
+    Hjson::Value inPlace = layers[0].clone();
+    for (size_t a = 1; a < layers.size(); ++a) {
+      chained = Hjson::Merge(chained, layers[a]);
+      Hjson::MergeInto(inPlace, layers[a]);
+    }
+    Hjson::Value folded = Hjson::MergeLayers(layers);
+    assert(Hjson::Marshal(folded) == Hjson::Marshal(chained));
+    assert(inPlace.deep_equal(chained));
+    assert(inPlace.key(0) == "a");
+    assert(inPlace["b"]["c"] == 20);
+    assert(inPlace["b"]["e"] == 7);
+    assert(inPlace["b"]["k"]["l"] == 1 && inPlace["b"]["k"]["m"] == 2);
+    assert(inPlace["b"]["c"].get_comment_before().find("# site") != std::string::npos);
+    assert(layers[0]["b"]["c"] == 2);
+    assert(layers[0]["h"]["i"] == 1);
+
+    // Changes in the results do not affect the layers.
+    folded["b"]["k"]["l"] = 2;
+    inPlace["b"]["k"]["l"] = 3;
+    assert(layers[3]["b"]["k"]["l"] == 1);
+
+    assert(!Hjson::MergeLayers(layers.data(), 0).defined());
+    assert(Hjson::MergeLayers(layers.data(), 1).deep_equal(layers[0]));
+    assert(Hjson::MergeLayers(&layers[2], 1).type() == Hjson::Type::Undefined);
+
+    // The rvalue overload moves elements that no other Value refers to.
+    Hjson::Value ext = Hjson::Unmarshal("{b: {n: {o: 1}}, p: [1]}");
+    Hjson::Value keep = ext["p"];
+    Hjson::Value target = layers[0].clone();
+    Hjson::MergeInto(target, std::move(ext));
+    assert(target["b"]["n"]["o"] == 1);
+    assert(target["b"]["c"] == 2);
+    target["p"].push_back(2);
+    assert(keep.size() == 1);
+
+    // Frozen subtrees in the target are copied on write.
+    Hjson::Value base = layers[0].clone();
+    base.freeze();
+    Hjson::Value variant = base.clone();
+    Hjson::MergeInto(variant, layers[1]);
+    assert(variant["b"]["c"] == 20);
+    assert(base["b"]["c"] == 2);
+    try {
+      Hjson::MergeInto(base, layers[1]);
+      assert(!"Did not throw error when merging into a frozen map.");
+    } catch(const Hjson::frozen_error& e) {}
+  }
+  {
+    // Overlay resolves lookups like MergeLayers.
+    std::vector<Hjson::Value> layers;
+    layers.push_back(Hjson::Unmarshal("{a: 1, b: {c: 2, d: {e: 3}}, f: [1, 2]}"));
+    layers.push_back(Hjson::Unmarshal("{b: {c: 20, g: 4}, h: 5}"));
+    layers.push_back(Hjson::Value());
+    layers.push_back(Hjson::Unmarshal("{b: {d: 7}, a: null}"));
+
+    Hjson::Overlay overlay(layers);
+    Hjson::Value merged = Hjson::MergeLayers(layers);
+    assert(overlay.layer_count() == 4);
+    assert(overlay.type() == Hjson::Type::Map);
+    assert(overlay.size() == merged.size());
+    std::vector<std::string> keys = overlay.keys();
+    for (int a = 0; a < int(keys.size()); ++a) {
+      assert(keys[a] == merged.key(a));
+    }
+    assert(overlay["a"].type() == Hjson::Type::Null);
+    assert(overlay["b"]["c"].to_int64() == 20);
+    assert(overlay["b"]["d"].to_int64() == 7);
+    assert(overlay["b"]["g"].to_int64() == 4);
+    assert(overlay["b"].keys().size() == 3);
+    assert(overlay["f"].size() == 2);
+    assert(!overlay["x"]["y"].defined());
+    assert(overlay["b"].value().deep_equal(merged["b"]));
+    assert(overlay.value().deep_equal(merged));
+    try {
+      overlay["h"]["x"];
+      assert(!"Did not throw error when using a key on an Int64 overlay.");
+    } catch(const Hjson::type_mismatch& e) {}
+
+    // Changes in the layers are seen immediately.
+    layers[1]["b"]["c"] = 21;
+    assert(overlay["b"]["c"].to_int64() == 21);
+    overlay.set_layer(2, Hjson::Unmarshal("{h: 6}"));
+    assert(overlay["h"].to_int64() == 6);
+    overlay.push_layer(Hjson::Unmarshal("{b: 8}"));
+    assert(overlay["b"].to_int64() == 8);
+    assert(Hjson::Overlay().type() == Hjson::Type::Undefined);
+  }
+  {
+    // Lookups that don't create any std::string.
+    Hjson::Value val;
+    val["abc"] = 1;
+    val["a longer key than eight bytes"] = 2;
+    val[std::string("nul\0key", 7)] = 3;
+    const Hjson::Value *pVal = val.find("abc");
+    assert(pVal && *pVal == 1);
+    assert(pVal == &val.at("abc"));
+    assert(val.find("a longer key than eight bytes") == &val.at("a longer key than eight bytes"));
+    assert(*val.find("abcdef", 3) == 1);
+    assert(!val.find("ab"));
+    assert(!val.find("abcd"));
+    assert(*val.find("nul\0key", 7) == 3);
+    assert(!val.find("nul"));
+    assert(val.contains("abc") && !val.contains(std::string("x")));
+    Hjson::HashedKey hk("abc");
+    assert(hk.str() == "abc");
+    assert(val.find(hk) == pVal);
+    assert(val.contains(Hjson::HashedKey(std::string("a longer key than eight bytes"))));
+    assert(!val.contains(Hjson::HashedKey("abd")));
+#ifdef __cpp_lib_string_view
+    std::string_view sv("abcdef");
+    assert(val.find(sv.substr(0, 3)) == pVal);
+    assert(!val.contains(sv));
+#endif
+    assert(!Hjson::Value().find("abc"));
+    try {
+      Hjson::Value(1).find("abc");
+      assert(!"Did not throw error when using find() on an Int64 value.");
+    } catch(const Hjson::type_mismatch& e) {}
+
+    // Many keys, to check the distribution of the hash.
+    Hjson::Value big;
+    for (int a = 0; a < 5000; ++a) {
+      big["key" + std::to_string(a)] = a;
+    }
+    for (int a = 0; a < 5000; ++a) {
+      std::string key = "key" + std::to_string(a);
+      assert(big.find(key.c_str()) && *big.find(key.c_str()) == a);
+    }
+    assert(!big.contains("key5000"));
+  }
+  {
+    // Bulk construction.
+    std::string longStr(100, 'x');
+    Hjson::Value str(std::move(longStr));
+    assert(str.to_string() == std::string(100, 'x'));
+    Hjson::Value shortStr(std::string("short"));
+    assert(shortStr == "short");
+
+    Hjson::Value vec(Hjson::Type::Vector);
+    vec.reserve(100);
+    for (int a = 0; a < 50; ++a) {
+      Hjson::Value elem(a);
+      vec.push_back(std::move(elem));
+      vec.emplace_back(std::to_string(a));
+    }
+    vec.emplace_back();
+    assert(vec.size() == 101);
+    assert(vec[0] == 0 && vec[1] == "0" && vec[99] == "49");
+    assert(!vec[100].defined());
+
+    Hjson::Value map;
+    assert(map.insert_or_assign("b", 1));
+    std::string key("a");
+    assert(map.insert_or_assign(std::move(key), Hjson::Value("text")));
+    map["b"].set_comment_after(" # b");
+    assert(!map.insert_or_assign("b", 2));
+    assert(map["b"] == 2);
+    assert(map["b"].get_comment_after() == " # b");
+    assert(map.key(0) == "b" && map.key(1) == "a");
+    map.reserve(1000);
+    for (int a = 0; a < 1000; ++a) {
+      map.insert_or_assign("k" + std::to_string(a), a);
+    }
+    assert(map.size() == 1002);
+    assert(map["k999"] == 999);
+    assert(map.key(1001) == "k999");
+
+    Hjson::Builder mapBuilder(Hjson::Type::Map, 3);
+    mapBuilder.add("name", "first").add("count", 2).add("list", vec);
+    Hjson::Value built = mapBuilder.build();
+    assert(built.size() == 3);
+    assert(built["name"] == "first" && built["count"] == 2);
+    assert(built["list"].size() == 101);
+
+    Hjson::Builder vecBuilder(Hjson::Type::Vector, 2);
+    Hjson::Value vecBuilt = vecBuilder.add(1).add("two").build();
+    assert(vecBuilt.size() == 2 && vecBuilt[1] == "two");
+
+    try {
+      Hjson::Builder(Hjson::Type::String, 1);
+      assert(!"Did not throw error when creating a Builder for a String.");
+    } catch(const Hjson::type_mismatch& e) {}
+    try {
+      vec.insert_or_assign("a", 1);
+      assert(!"Did not throw error when using insert_or_assign() on a Vector.");
+    } catch(const Hjson::type_mismatch& e) {}
+    try {
+      Hjson::Value(1).reserve(1);
+      assert(!"Did not throw error when using reserve() on an Int64.");
+    } catch(const Hjson::type_mismatch& e) {}
+  }
+
+  {
+    Hjson::Value vec;
+    for (int a = 0; a < 10; ++a) {
+      vec.push_back(a * 0.5);
+    }
+    assert(vec.packed_type() == Hjson::Type::Double);
+    assert(vec.size() == 10);
+    assert(vec.double_span().size() == 10);
+    assert(vec.double_span()[3] == 1.5);
+    assert(vec.int64_span().empty());
+    double sum = 0;
+    for (double d : vec.double_span()) {
+      sum += d;
+    }
+    assert(sum == 22.5);
+
+    const Hjson::Value &cvec = vec;
+    assert(cvec[3] == 1.5);
+    assert(!cvec[3].is_frozen());
+    assert(vec.packed_type() == Hjson::Type::Double);
+    {
+      // A copy of an element can be changed without affecting the Vector.
+      const Hjson::Value &c = vec;
+      Hjson::Value x = c[0];
+      x++;
+      assert(x == 1.0 && c[0] == 0.0);
+      x += 2;
+      assert(x == 3.0 && c[0] == 0.0);
+      Hjson::Value y = c[1];
+      y.set_comment_after(" # y");
+      y = 8.0;
+      assert(y == 8.0 && c[1] == 0.5 && c[1].get_comment_after().empty());
+    }
+
+    Hjson::Value vec2 = vec.clone();
+    assert(vec2.packed_type() == Hjson::Type::Double);
+    assert(vec2.deep_equal(vec));
+    assert(Hjson::Unmarshal(Hjson::Marshal(vec)).deep_equal(vec));
+    assert(Hjson::Unmarshal(Hjson::Marshal(vec)).packed_type() ==
+      Hjson::Type::Double);
+
+    vec2.erase(0);
+    assert(vec2.size() == 9 && vec2.packed_type() == Hjson::Type::Double);
+    assert(vec.size() == 10);
+
+    // Non-const access unpacks the Vector.
+    vec[3] = 7;
+    assert(vec.packed_type() == Hjson::Type::Undefined);
+    assert(vec[3] == 7 && vec[4] == 2.0);
+    assert(!vec[4].is_frozen());
+    assert(vec.double_span().empty());
+
+    Hjson::Value ints;
+    ints.push_back(1);
+    ints.push_back(2);
+    assert(ints.packed_type() == Hjson::Type::Int64);
+    assert(ints.int64_span()[1] == 2);
+    assert(!ints.deep_equal(Hjson::Unmarshal("[1.0, 2.0]")));
+    ints.push_back(3.5);
+    assert(ints.packed_type() == Hjson::Type::Undefined);
+    assert(ints.size() == 3 && ints[0] == 1 && ints[2] == 3.5);
+    ints.clear();
+    ints.push_back(4);
+    assert(ints.packed_type() == Hjson::Type::Int64);
+
+    Hjson::Value commented(5);
+    commented.set_comment_after(" # five");
+    Hjson::Value withComments;
+    withComments.push_back(commented);
+    assert(withComments.packed_type() == Hjson::Type::Undefined);
+    assert(withComments[0].get_comment_after() == " # five");
+
+    Hjson::Value frozen;
+    frozen.push_back(1);
+    frozen.push_back(2);
+    frozen.freeze();
+    assert(frozen.packed_type() == Hjson::Type::Int64);
+    const Hjson::Value &cfrozen = frozen;
+    assert(cfrozen[1] == 2);
+    assert(cfrozen[1].is_frozen());
+    try {
+      Hjson::Value x = cfrozen[0];
+      x++;
+      assert(!"Did not throw error when changing an element of a frozen Vector.");
+    } catch(const Hjson::frozen_error& e) {}
+
+    // The mirror was created before the Vector was frozen.
+    Hjson::Value frozenLater;
+    frozenLater.push_back(1);
+    frozenLater.push_back(2);
+    const Hjson::Value &cfrozenLater = frozenLater;
+    Hjson::Value copy = cfrozenLater[0];
+    frozenLater.freeze();
+    assert(cfrozenLater[0].is_frozen() && copy.is_frozen());
+    try {
+      ++copy;
+      assert(!"Did not throw error when changing an element of a frozen Vector.");
+    } catch(const Hjson::frozen_error& e) {}
+    try {
+      frozen.push_back(3);
+      assert(!"Did not throw error when using push_back() on a frozen Vector.");
+    } catch(const Hjson::frozen_error& e) {}
+  }
+  {
+    // Changing a packed Vector frees the elements created by the const
+    // bracket operator, and keeps the Vector packed.
+    Hjson::Value vec;
+    for (int a = 0; a < 1000; ++a) {
+      vec.push_back(a);
+    }
+    const Hjson::Value &cvec = vec;
+    size_t packedBytes = vec.memory_usage().total();
+    assert(cvec[10] == 10);
+    Hjson::Value held = cvec[20];
+    assert(vec.memory_usage().total() > packedBytes + 1000 * sizeof(Hjson::Value));
+    vec.push_back(1000);
+    assert(vec.packed_type() == Hjson::Type::Int64);
+    assert(vec.memory_usage().nodeCount == 1);
+    assert(cvec[1000] == 1000 && cvec[10] == 10);
+    vec.erase(0);
+    assert(vec.packed_type() == Hjson::Type::Int64);
+    assert(vec.memory_usage().nodeCount == 1);
+    assert(vec.size() == 1000 && cvec[0] == 1 && cvec[999] == 1000);
+    assert(held == 20);
+    held += 1;
+    assert(held == 21 && cvec[19] == 20);
+    vec.push_back(2.5);
+    assert(vec.packed_type() == Hjson::Type::Undefined);
+    assert(vec[19] == 20 && vec[1000] == 2.5);
+  }
+
+  {
+    Hjson::Value root;
+    for (int a = 0; a < 3; ++a) {
+      Hjson::Value server;
+      server["host"] = "db.example.com";
+      server["port"] = 5432;
+      server["policy"] = Hjson::Unmarshal("{retries: 3, mode: \"strict\"}");
+      server["policy"].freeze();
+      root["servers"].push_back(server);
+    }
+    Hjson::Value outside = root["servers"][0]["host"];
+    std::string before = Hjson::Marshal(root);
+    root.dedupe(true);
+    assert(Hjson::Marshal(root) == before);
+
+    const Hjson::Value &croot = root;
+    assert(croot["servers"][1]["host"].is_frozen());
+    assert(croot["servers"][2]["policy"].is_frozen());
+    // The String referred to by "outside" was not shared.
+    assert(!croot["servers"][0]["host"].is_frozen());
+    outside += ".local";
+    assert(root["servers"][0]["host"] == "db.example.com.local");
+    assert(croot["servers"][2]["host"] == "db.example.com");
+
+    // Writing copies the shared String.
+    root["servers"][1]["host"] += ".other";
+    assert(root["servers"][1]["host"] == "db.example.com.other");
+    assert(croot["servers"][2]["host"] == "db.example.com");
+    assert(!croot["servers"][2]["port"].is_frozen());
+
+    Hjson::Value commented = Hjson::Unmarshal("{a: [1, \"x\"], b: [1, \"x\"], "
+      "c: [\n  1 # one\n  \"x\"\n]}");
+    commented.freeze();
+    std::string commentedBefore = Hjson::Marshal(commented);
+    commented.dedupe(true);
+    assert(Hjson::Marshal(commented) == commentedBefore);
+    const Hjson::Value &ccommented = commented;
+    assert(ccommented["a"] == ccommented["b"]);
+    assert(ccommented["a"] != ccommented["c"]);
+
+    Hjson::DecoderOptions decOpt;
+    decOpt.dedupe = true;
+    Hjson::Value decoded = Hjson::Unmarshal("[\"same\", \"same\", \"other\"]",
+      decOpt);
+    const Hjson::Value &cdecoded = decoded;
+    assert(cdecoded[0] == "same" && cdecoded[1] == "same");
+    assert(cdecoded[1].is_frozen() && !cdecoded[2].is_frozen());
+    // Non-const access copies the shared String.
+    decoded[1] += "!";
+    assert(cdecoded[0] == "same" && cdecoded[1] == "same!");
+  }
+
+  {
+    Hjson::Reclaimer reclaimer;
+    Hjson::Value tree;
+    for (int a = 0; a < 1000; ++a) {
+      tree["list"].push_back(Hjson::Value("elem" + std::to_string(a)));
+    }
+    Hjson::Value shared = tree["list"];
+    reclaimer.reclaim(tree);
+    assert(!tree.defined());
+    reclaimer.flush();
+    assert(reclaimer.pending() == 0);
+    // Only the reference held by "tree" was dropped.
+    assert(shared.size() == 1000 && shared[999] == "elem999");
+
+    for (int a = 0; a < 10; ++a) {
+      Hjson::Value next = Hjson::Unmarshal("{a: [1, 2, 3], b: {c: \"d\"}}");
+      reclaimer.reclaim(next);
+    }
+    reclaimer.reclaim(shared);
+  }
+
+  {
+    for (int a = 0; a < 1000; ++a) {
+      Hjson::Value val(Hjson::Type::Map);
+      val["key"] = a;
+    }
+    Hjson::PoolStats stats = Hjson::GetPoolStats();
+    assert(stats.hits <= stats.allocations);
+    // Unless the pool is disabled, nodes are reused.
+    assert(!stats.allocations || stats.hits);
+    Hjson::TrimPools();
+    stats = Hjson::GetPoolStats();
+    assert(!stats.localBytes && !stats.sharedBytes);
+  }
+
+  {
+    CountingResource res;
+    Hjson::Value global;
+    {
+      Hjson::Value tree;
+      {
+        Hjson::MemoryResourceScope scope(&res);
+        tree["name"] = std::string(100, 'n');
+        tree["name"] += "!";
+        tree["list"].push_back(1.5);
+        tree["list"].set_comment_after(" # list");
+        tree["map"]["a"] = "short";
+        assert(Hjson::MemoryResourceScope::current() == &res);
+      }
+      assert(!Hjson::MemoryResourceScope::current());
+      assert(res.allocated > 0 && res.outstanding > 0);
+      size_t before = res.allocated;
+      // The Vector grows into the same resource after the scope has ended.
+      for (int a = 0; a < 100; ++a) {
+        tree["list"].push_back(Hjson::Value("elem"));
+      }
+      assert(res.allocated > before);
+      tree["list"].clear();
+      assert(tree["name"] == std::string(100, 'n') + "!");
+      global["fromResource"] = tree["map"];
+    }
+    assert(res.outstanding > 0);
+    assert(global["fromResource"]["a"] == "short");
+    global = Hjson::Value();
+    assert(res.outstanding == 0);
+
+    Hjson::DecoderOptions decOpt;
+    decOpt.memoryResource = &res;
+    size_t before = res.allocated;
+    Hjson::Value decoded = Hjson::Unmarshal("{a: [1, 2], b: {c: \"d\"}}",
+      decOpt);
+    assert(res.allocated > before);
+    assert(decoded["b"]["c"] == "d");
+    decoded = Hjson::Value();
+    assert(res.outstanding == 0);
+  }
+
+  {
+    Hjson::Value shared = Hjson::Unmarshal("{a: 1, b: \"text\"}");
+    Hjson::Value root;
+    root["first"] = shared;
+    root["second"] = shared;
+    root["long"] = std::string(100, 'x');
+    root["long"].set_comment_before("# a comment that is longer than the "
+      "internal buffer of std::string\n");
+    root["list"] = Hjson::Value(Hjson::Type::Vector);
+    root["list"].reserve(10);
+    root["list"].push_back(Hjson::Value("elem"));
+
+    Hjson::MemoryUsage usage = root.memory_usage();
+    // root, shared, a, b, long, list and elem.
+    assert(usage.nodeCount == 7);
+    assert(usage.stringBytes >= 101);
+    assert(usage.commentBytes > 0);
+    assert(usage.vectorBytes >= 10 * sizeof(Hjson::Value));
+    assert(usage.vectorSlackBytes == 9 * sizeof(Hjson::Value));
+    assert(usage.mapBytes > 0 && usage.keyBytes == 0);
+    assert(usage.total() > usage.nodeBytes);
+
+    Hjson::Value packed(Hjson::Type::Vector);
+    packed.reserve(8);
+    packed.push_back(1.5);
+    usage = packed.memory_usage();
+    assert(usage.nodeCount == 1);
+    assert(usage.vectorSlackBytes == 7 * sizeof(double));
+  }
+
+  {
+    Hjson::Value root = Hjson::Unmarshal("{\n  # config\n  name: first\n"
+      "  list: [1, 2, 3]\n  mixed: [\n    1 # one\n    \"two\"\n  ]\n}");
+    Hjson::Value shared(Hjson::Type::Vector);
+    shared.reserve(10);
+    shared.push_back(Hjson::Value("elem"));
+    root["a"] = shared;
+    root["b"] = shared;
+    root["frozen"] = Hjson::Unmarshal("{x: 1, y: [\"z\"]}");
+    root["frozen"].freeze();
+    root["long"] = std::string(100, 'l');
+    std::string before = Hjson::Marshal(root);
+    Hjson::Value outside = root["name"];
+
+    root.compact();
+    assert(Hjson::Marshal(root) == before);
+    const Hjson::Value &croot = root;
+    assert(croot["a"] == croot["b"]);
+    assert(croot["frozen"].is_frozen() && croot["frozen"]["y"].is_frozen());
+    assert(!croot["list"].is_frozen());
+    assert(croot["list"].packed_type() == Hjson::Type::Int64);
+    assert(croot.memory_usage().vectorSlackBytes == 0);
+    assert(outside == "first");
+
+    // The compacted tree can still be changed.
+    for (int a = 0; a < 100; ++a) {
+      root["a"].push_back(a);
+      root["new" + std::to_string(a)] = std::string(50, 'n');
+    }
+    root["name"] += " changed";
+    assert(root["b"].size() == 101);
+    assert(root["name"] == "first changed" && outside == "first");
+  }
+  {
+    // The size of the compacted tree is computed without copying it, also
+    // for large Maps and Vectors.
+    Hjson::Value root;
+    Hjson::Value shared(std::string(40, 's'));
+    for (int a = 0; a < 5000; ++a) {
+      Hjson::Value elem;
+      elem["text"] = std::string(a % 50, 't');
+      elem["shared"] = shared;
+      elem["ints"].push_back(a);
+      elem["mixed"].push_back(a);
+      elem["mixed"].push_back("x");
+      elem["mixed"][0].set_comment_after(" # first");
+      root["key" + std::to_string(a)] = elem;
+      root["list"].push_back(elem["text"]);
+    }
+    std::string before = Hjson::Marshal(root);
+    Hjson::MemoryUsage usageBefore = root.memory_usage();
+    root.compact();
+    assert(Hjson::Marshal(root) == before);
+    const Hjson::Value &croot = root;
+    assert(croot.memory_usage().nodeCount == usageBefore.nodeCount);
+    assert(croot["key7"]["shared"] == croot["key9"]["shared"]);
+    // Nodes shared within the tree are still shared, but not with "shared".
+    root["key7"]["shared"] += "t";
+    assert(croot["key9"]["shared"] == croot["key7"]["shared"]);
+    assert(shared == std::string(40, 's'));
+  }
+
+  {
+    Hjson::Value root = Hjson::Unmarshal("{b: {c: \"text\"}, a: 1, d: [2.5, 3, \"x\"], p: [1, 2, 3]}");
+    Hjson::ConstValueRef ref(root);
+    assert(ref.is_container() && !ref.is_numeric());
+    assert(ref["a"].is_numeric());
+    assert(ref.contains("b") && !ref.contains(std::string("x")));
+    assert(ref.find("x") == 0);
+    assert(ref.find("a") == root.find("a"));
+    Hjson::HashedKey hk("b");
+    assert(ref.contains(hk) && ref[hk]["c"].to_string() == "text");
+    assert(std::string(ref["b"]["c"].c_str()) == "text");
+    assert(ref["b"]["c"].c_str() == static_cast<const char*>(root.at("b").at("c")));
+    try {
+      ref["a"].c_str();
+      assert(!"Did not throw error for c_str() on Int64");
+    } catch (const Hjson::type_mismatch&) {}
+    assert(ref["a"] && !ref["x"]);
+
+    // Map elements are iterated in insertion order.
+    std::string keys;
+    int count = 0;
+    for (auto it = ref.begin(); it != ref.end(); ++it) {
+      keys += it.key();
+      assert(it.pos() == count);
+      assert(&(*it).value() == &root[count]);
+      ++count;
+    }
+    assert(keys == "badp");
+
+    double sum = 0;
+    for (Hjson::ConstValueRef elem : ref["d"]) {
+      if (elem.is_numeric()) {
+        sum += elem.to_double();
+      }
+    }
+    assert(sum == 5.5);
+    try {
+      ref["d"].begin().key();
+      assert(!"Did not throw error for key() on a Vector iterator");
+    } catch (const Hjson::type_mismatch&) {}
+
+    std::int64_t isum = 0;
+    for (auto elem : ref["p"]) {
+      isum += elem.to_int64();
+    }
+    assert(isum == 6);
+
+    assert(ref["a"].begin() == ref["a"].end());
+    assert(Hjson::ConstValueRef(Hjson::Value()).begin() ==
+      Hjson::ConstValueRef(Hjson::Value()).end());
+
+    // Viewing a tree does not change any reference counts, so a frozen tree
+    // can be walked while other handles come and go.
+    root.freeze();
+    Hjson::ConstValueRef fref(root);
+    Hjson::Value handle = root["b"];
+    handle = Hjson::Value();
+    assert(fref["b"]["c"].to_string() == "text");
+
+    // deep_equal() compares a packed Vector with an unpacked one.
+    Hjson::Value packed(Hjson::Type::Vector);
+    packed.push_back(1);
+    packed.push_back(2);
+    Hjson::Value mixed(Hjson::Type::Vector);
+    mixed.push_back(1);
+    mixed.push_back(2.0);
+    assert(packed.packed_type() == Hjson::Type::Int64);
+    assert(mixed.packed_type() == Hjson::Type::Undefined);
+    assert(packed.deep_equal(mixed) && mixed.deep_equal(packed));
+    mixed.push_back("x");
+    packed.push_back(3);
+    assert(!packed.deep_equal(mixed) && !mixed.deep_equal(packed));
+  }
+
+  {
+    // Doubles are written with the shortest text that is parsed back to the
+    // same value.
+    assert(Hjson::Value(0.1).to_string() == "0.1");
+    assert(Hjson::Value(0.1 + 0.2).to_string() == "0.30000000000000004");
+    assert(Hjson::Value(1.0).to_string() == "1.0");
+    assert(Hjson::Value(-0.0).to_string() == "-0.0");
+    assert(Hjson::Value(123456.0).to_string() == "123456.0");
+    assert(Hjson::Value(1e22).to_string() == "1e+22");
+    assert(Hjson::Value(1e-7).to_string() == "1e-07");
+    assert(Hjson::Value(0.001).to_string() == "0.001");
+    assert(Hjson::Value(-2.5e-300).to_string() == "-2.5e-300");
+    assert(Hjson::Value(5e-324).to_string() == "5e-324");
+    assert(Hjson::Value(1.7976931348623157e308).to_string() ==
+      "1.7976931348623157e+308");
+    assert(Hjson::Value(std::numeric_limits<std::int64_t>::min()).to_string() ==
+      "-9223372036854775808");
+    assert(Hjson::Value(std::numeric_limits<std::int64_t>::max()).to_string() ==
+      "9223372036854775807");
+    assert(Hjson::Value(-42).to_string() == "-42");
+
+    Hjson::Value vec(Hjson::Type::Vector);
+    double d = 1.0 / 3;
+    for (int a = 0; a < 250; ++a) {
+      vec.push_back(d);
+      vec.push_back(-d * 7);
+      d *= 3.7;
+    }
+    vec.push_back(std::numeric_limits<std::int64_t>::min());
+    Hjson::Value vec2 = Hjson::Unmarshal(Hjson::Marshal(vec));
+    assert(vec2.size() == vec.size());
+    for (int a = 0; a < int(vec.size()); ++a) {
+      assert(vec2[a].type() == vec[a].type());
+      assert(vec2[a] == vec[a]);
+    }
+  }
+
+  {
+    // Short strings containing numbers store the parsed number.
+    Hjson::Value port("8080");
+    assert(port.to_int64() == 8080);
+    assert(port.to_double() == 8080.0);
+    assert(Hjson::Value("-42").to_int64() == -42);
+    assert(Hjson::Value("2.5").to_double() == 2.5);
+    assert(Hjson::Value("2.5").to_int64() == 2);
+    assert(Hjson::Value("-3.25e2").to_double() == -325.0);
+    assert(Hjson::Value("1E3").to_int64() == 1000);
+    assert(Hjson::Value("0").to_int64() == 0);
+    assert(std::signbit(Hjson::Value("-0").to_double()));
+    assert(Hjson::Value("9999999999999").to_int64() == 9999999999999);
+    assert(Hjson::Value("99999999999999").to_int64() == 99999999999999);
+    assert(Hjson::Value("12345678901234567").to_int64() == 12345678901234567);
+    assert(Hjson::Value("1.5x").to_double() == 0.0);
+    assert(Hjson::Value("-").to_int64() == 0);
+    assert(Hjson::Value("").to_double() == 0.0);
+    assert(Hjson::Value("").to_int64() == 0);
+    assert(Hjson::Value("1e999").to_double() == 0.0);
+    assert(Hjson::Value("1.").to_double() == 1.0);
+
+    // The stored number follows changes to the string.
+    port += "1";
+    assert(port.to_int64() == 80801);
+    port += "x";
+    assert(port.to_int64() == 0);
+    Hjson::Value num("12");
+    num += ".5";
+    assert(num.to_double() == 12.5);
+    num += "123456789012";
+    assert(num.to_string() == "12.5123456789012");
+    assert(num.to_double() == 12.5123456789012);
+
+    // Copies of the string also store the number.
+    Hjson::Value root;
+    root["port"] = "8081";
+    root.freeze();
+    Hjson::Value cl = root.clone();
+    assert(cl["port"].to_int64() == 8081);
+    cl.compact();
+    assert(cl["port"].to_int64() == 8081);
+    assert(Hjson::Unmarshal("{a: \"443\"}")["a"].to_int64() == 443);
+  }
+
+  {
+    Hjson::Value root = Hjson::Unmarshal("{server: {ports: [80, 443], name: \"main\", ratio: 0.5, on: true}, \"a/b\": {\"m~n\": 1}, \"\": 2}");
+
+    assert(root.find_path("") == &root);
+    assert(root.find_path("/server/ports/1")->to_int64() == 443);
+    assert(root.find_path(std::string("/server/name"))->to_string() == "main");
+    assert(root.find_path("/a~1b/m~0n")->to_int64() == 1);
+    assert(root.find_path("/")->to_int64() == 2);
+    assert(root.find_path("/server/ports/2") == 0);
+    assert(root.find_path("/server/ports/01") == 0);
+    assert(root.find_path("/server/ports/-1") == 0);
+    assert(root.find_path("/server/ports/x") == 0);
+    assert(root.find_path("/server/name/x") == 0);
+    assert(root.find_path("/server/missing") == 0);
+    assert(root.find_path("/a~2b") == 0);
+    assert(root.find_path("server") == 0);
+    assert(Hjson::Value().find_path("/a") == 0);
+    const Hjson::Value &croot = root;
+    assert(root.find_path("/server/ports/0") == &croot.at("server").at("ports")[0]);
+
+    // An index into a packed Vector.
+    Hjson::Value samples;
+    samples.push_back(0.5);
+    samples.push_back(1.5);
+    samples.push_back(2.5);
+    Hjson::Value holder;
+    holder["samples"] = samples;
+    const Hjson::Value &cholder = holder;
+    assert(cholder["samples"].packed_type() == Hjson::Type::Double);
+    const Hjson::Value *pSample = cholder.find_path("/samples/1");
+    assert(pSample && *pSample == 1.5);
+    assert(pSample == cholder.find_path("/samples/1"));
+    assert(pSample == &cholder.at("samples")[1]);
+    assert(!cholder.find_path("/samples/3"));
+    assert(!cholder.find_path("/samples/01"));
+    assert(cholder["samples"].packed_type() == Hjson::Type::Double);
+
+    const Hjson::Value &server = *root.find_path("/server");
+    std::int64_t i = -1;
+    double d = -1;
+    bool b = false;
+    std::string str;
+    const char *pStr = 0;
+    assert(server["ports"][0].try_get(&i) && i == 80);
+    assert(server["ratio"].try_get(&d) && d == 0.5);
+    assert(server["ratio"].try_get(&i) && i == 0);
+    assert(server["ports"][1].try_get(&d) && d == 443.0);
+    assert(server["on"].try_get(&b) && b);
+    assert(server["name"].try_get(&str) && str == "main");
+    assert(server["name"].try_get(&pStr) && std::string(pStr) == "main");
+    i = -1;
+    assert(!server["name"].try_get(&i) && i == -1);
+    assert(!server["missing"].try_get(&d) && d == 443.0);
+    assert(!server["ports"].try_get(&str) && str == "main");
+    assert(!server["ports"][0].try_get(&b));
+    assert(!Hjson::Value("12").try_get(&i));
+
+    assert(*server["on"].get_if<bool>());
+    assert(server["ratio"].get_if<double>() == server.at("ratio").get_if<double>());
+    assert(*server["ratio"].get_if<double>() == 0.5);
+    assert(!server["ratio"].get_if<std::int64_t>());
+    assert(!server["ports"][0].get_if<double>());
+    assert(*server["ports"][0].get_if<std::int64_t>() == 80);
+    assert(!server["name"].get_if<bool>());
+
+#ifdef __cpp_lib_optional
+    assert(server["ports"][1].try_get<std::int64_t>().value() == 443);
+    assert(!server["name"].try_get<double>());
+    assert(server["name"].try_get<std::string>().value() == "main");
+#endif
+  }
+
+#if !HJSON_SINGLE_THREADED
+  {
+    // Const access to a map that is not frozen must not change anything that
+    // other threads read at the same time.
+    Hjson::Value root;
+    for (int a = 0; a < 200; ++a) {
+      root[std::to_string(1000 - a)] = a;
+    }
+    root.erase("999");
+    root.erase("900");
+    const Hjson::Value &croot = root;
+
+    std::vector<std::thread> threads;
+    std::vector<int> counts(4, 0);
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&croot, &counts, t]() {
+        for (int rep = 0; rep < 20; ++rep) {
+          std::string prev;
+          for (auto it = croot.begin(); it != croot.end(); ++it) {
+            assert(prev < it->first);
+            prev = it->first;
+            ++counts[t];
+          }
+          for (int a = 0; a < static_cast<int>(croot.size()); ++a) {
+            assert(croot[croot.key(a)] == croot[a]);
+          }
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    for (int t = 0; t < 4; ++t) {
+      assert(counts[t] == 20 * 198);
+    }
+    assert(croot.key(0) == "1000" && croot.key(197) == "801");
+  }
+
+  {
+    // The number in a short String is stored by the first reader.
+    Hjson::Value root;
+    root["port"] = "8080";
+    root["ratio"] = "0.25";
+    const Hjson::Value &croot = root;
+
+    std::vector<std::thread> threads;
+    std::vector<int> counts(4, 0);
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&croot, &counts, t]() {
+        for (int rep = 0; rep < 1000; ++rep) {
+          if (croot["port"].to_int64() == 8080 &&
+            croot["ratio"].to_double() == 0.25)
+          {
+            ++counts[t];
+          }
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    for (int t = 0; t < 4; ++t) {
+      assert(counts[t] == 1000);
+    }
+  }
+#endif
 }